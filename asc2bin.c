@@ -0,0 +1,68 @@
+/**
+ * @file asc2bin.c
+ * @brief Converter from CANalyzer .ASC logs to the binary capture format
+ *
+ * Usage:
+ * @code
+ * asc2bin [--no-bitmaps] log.asc capture.bin
+ * @endcode
+ *
+ * @authored by Roger da Silva Moschiel
+ * @date 1 August 2024
+ */
+
+#include "dtc_parser/asc_reader.h"
+#include "dtc_parser/can_bin.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static CanBinWriter_t writer; // Holds a whole block, too big for the stack
+
+int main(int argc, char* argv[]) {
+    bool bitmaps = true;
+    int arg = 1;
+    if (arg < argc && strcmp(argv[arg], "--no-bitmaps") == 0) {
+        bitmaps = false;
+        arg++;
+    }
+    if ((argc - arg) != 2) {
+        fprintf(stderr, "usage: %s [--no-bitmaps] log.asc capture.bin\n", argv[0]);
+        return 1;
+    }
+
+    AscReader_t reader;
+    if (!asc_reader_open(&reader, argv[arg])) {
+        perror("Failed to open file");
+        return 1;
+    }
+    if (!can_bin_writer_open(&writer, argv[arg + 1], bitmaps)) {
+        perror("Failed to create file");
+        asc_reader_close(&reader);
+        return 1;
+    }
+
+    CanFrame_t frame;
+    bool ok = true;
+    uint32_t second = 0;
+    while (ok && !asc_reader_eof(&reader)) {
+        // One frame at a time, or up to the first line of the next second if there is no frame before it
+        if (asc_reader_read_frames(&reader, &frame, 1, second + 1) == 1) {
+            ok = can_bin_write_frame(&writer, reader.timestamp_us, frame.can_id, reader.extended, 8, frame.data);
+        } else if (asc_reader_timestamp(&reader) > second) {
+            ok = can_bin_write_time_mark(&writer, reader.timestamp_us);
+        }
+        if (asc_reader_timestamp(&reader) > second) second = asc_reader_timestamp(&reader);
+    }
+    if (!can_bin_writer_close(&writer)) ok = false;
+
+    if (ok) {
+        fprintf(stderr, "%llu frames, %llu time marks, %llu bytes -> %llu bytes\n", (unsigned long long)writer.frame_count,
+            (unsigned long long)writer.mark_count, (unsigned long long)reader.map.size, (unsigned long long)writer.file_size);
+    } else {
+        fprintf(stderr, "Failed to write %s\n", argv[arg + 1]);
+    }
+
+    asc_reader_close(&reader);
+    return ok ? 0 : 1;
+}
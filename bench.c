@@ -0,0 +1,373 @@
+/**
+ * @file bench.c
+ * @brief Benchmark of the DTC parser engines over CANalyzer logs and synthetic workloads
+ *
+ * Every workload is held in memory as a `CanFrame_t` array, then ingested once per engine
+ * (parser options and ingestion API): frames are given to the parser one second at a time and
+ * `check_dtcs` runs after each second, as in the test application. The ingest and `check_dtcs`
+ * phases are timed separately, the best of `-n` runs is reported with the peak table occupancy
+ * read from `get_dtc_parser_stats`. For the logs the parse phase (`asc_reader`) is timed too.
+ *
+ * The synthetic workloads stress what the bundled logs don't have: hundreds of ECUs, maximum
+ * size (1785 bytes) BAM sessions and a high turnover of candidate and active DTCs.
+ *
+ * Usage:
+ * @code
+ * bench [-n runs] [log.asc...]
+ * @endcode
+ *
+ * @authored by Roger da Silva Moschiel
+ * @date 1 August 2024
+ */
+
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "dtc_parser/dtc_parser.h"
+#include "dtc_parser/asc_reader.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// Tables of the benchmarked parser, big enough for the synthetic workloads and for 1785 byte sessions
+#define BENCH_MAX_ACTIVE 512
+#define BENCH_MAX_CANDIDATE 512
+#define BENCH_MAX_MULTI_FRAME 32
+#define BENCH_READ_BATCH 256 // Frames read per 'asc_reader_read_frames' call
+
+typedef struct {
+    const char* name;
+    uint32_t options;
+    bool batch;         // Ingest through 'process_dtc_frames' instead of 'process_dtc_frame'
+} BenchEngine_t;
+
+typedef struct {
+    char name[64];
+    CanFrame_t* frames;
+    size_t frame_count;
+    size_t frame_capacity;
+    DtcParseConfig_t config;
+} BenchWorkload_t;
+
+typedef struct {
+    uint64_t ingest_ns;
+    uint64_t check_ns;
+    size_t check_count;
+    DtcParserStats_t stats;
+    bool has_stats;
+} BenchResult_t;
+
+static const BenchEngine_t engines[] = {
+    { "linear",  0,                                             false },
+    { "hash",    DTC_OPT_HASH_INDEX,                            false },
+    { "default", DTC_PARSER_DEFAULT_OPTIONS,                    false },
+    { "heap",    DTC_PARSER_DEFAULT_OPTIONS | DTC_OPT_TIMER_HEAP, false },
+    { "batch",   DTC_PARSER_DEFAULT_OPTIONS,                    true  },
+    { "stream",  DTC_PARSER_DEFAULT_OPTIONS | DTC_OPT_STREAM_DM1, true },
+};
+
+static const char* default_logs[] = {
+    "canalyzer_logs/test.asc",
+    "canalyzer_logs/VWConstel2024_1.asc",
+    "canalyzer_logs/VWConstel2024_2.asc",
+};
+
+static DTC_PARSER_BUFFERS(BENCH_MAX_ACTIVE, BENCH_MAX_CANDIDATE, BENCH_MAX_MULTI_FRAME, BENCH_MAX_MULTI_FRAME * DTC_MULTIFRAME_CHUNKS_FOR(1785),
+    DTC_INDEX_SIZE_FOR(BENCH_MAX_ACTIVE + BENCH_MAX_CANDIDATE)) bench_buffers;
+static DtcParser_t parser;
+static uint32_t rng_state = 0x12345678;
+
+static uint64_t now_ns(void) {
+#if defined(_WIN32)
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// xorshift32, the synthetic workloads are the same on every run
+static uint32_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static bool push_frame(BenchWorkload_t* w, uint32_t can_id, const uint8_t data[8], uint32_t timestamp) {
+    if (w->frame_count == w->frame_capacity) {
+        size_t capacity = w->frame_capacity ? 2 * w->frame_capacity : 4096;
+        CanFrame_t* frames = realloc(w->frames, capacity * sizeof(CanFrame_t));
+        if (!frames) return false;
+        w->frames = frames;
+        w->frame_capacity = capacity;
+    }
+    CanFrame_t* f = &w->frames[w->frame_count++];
+    f->can_id = can_id;
+    memcpy(f->data, data, 8);
+    f->timestamp = timestamp;
+    return true;
+}
+
+// Packs a DTC as in the DM1 payload: SPN low, SPN mid, SPN high bits + FMI, CM + OC
+static void pack_dtc(uint8_t out[4], uint32_t spn, uint8_t fmi, uint8_t oc) {
+    out[0] = (uint8_t)spn;
+    out[1] = (uint8_t)(spn >> 8);
+    out[2] = (uint8_t)(((spn >> 16) & 0x7) << 5) | (fmi & 0x1F);
+    out[3] = oc & 0x7F;
+}
+
+static void push_noise(BenchWorkload_t* w, uint32_t timestamp) {
+    // EEC1, CCVS and other periodic traffic the pre-filter must reject
+    static const uint32_t ids[] = { 0x0CF00400, 0x18FEF100, 0x18FEEE00, 0x0CF00300 };
+    uint8_t data[8];
+    uint32_t r = rng_next();
+    for (int i = 0; i < 8; i++) data[i] = (uint8_t)(r >> (i * 4));
+    push_frame(w, ids[r % 4] | (r >> 24), data, timestamp);
+}
+
+static void push_dm1(BenchWorkload_t* w, uint8_t src, const uint8_t* payload, size_t size, uint32_t timestamp) {
+    uint8_t data[8];
+    if (size <= 8) {
+        memset(data, 0xFF, 8);
+        memcpy(data, payload, size);
+        push_frame(w, 0x18FECA00 | src, data, timestamp);
+        return;
+    }
+
+    // BAM announcement then one TP.DT per 7 bytes
+    uint8_t packets = (uint8_t)((size + 6) / 7);
+    uint8_t cm[8] = { TP_CM_BAM, (uint8_t)size, (uint8_t)(size >> 8), packets, 0xFF, 0xCA, 0xFE, 0x00 };
+    push_frame(w, 0x1CECFF00 | src, cm, timestamp);
+    for (uint8_t p = 0; p < packets; p++) {
+        data[0] = (uint8_t)(p + 1);
+        for (size_t i = 0; i < 7; i++) {
+            size_t offset = (size_t)p * 7 + i;
+            data[1 + i] = offset < size ? payload[offset] : 0xFF;
+        }
+        push_frame(w, 0x1CEBFF00 | src, data, timestamp);
+    }
+}
+
+// 250 ECUs with one DTC each, DM1 every 100 ms, every 8th ECU also sends a 6 DTC BAM per second, half of the bus is other traffic
+static bool build_many_ecus(BenchWorkload_t* w) {
+    uint8_t payload[2 + 6 * 4];
+    for (uint32_t t = 0; t < 60; t++) {
+        for (int tick = 0; tick < 10; tick++) {
+            for (uint32_t src = 0; src < 250; src++) {
+                payload[0] = 0x04;
+                payload[1] = 0xFF;
+                pack_dtc(&payload[2], 100 + (src % 16), 1, 1);
+                push_dm1(w, (uint8_t)src, payload, 6, t);
+                push_noise(w, t);
+                if (tick == 0 && (src % 8) == 0) {
+                    for (int d = 0; d < 6; d++) pack_dtc(&payload[2 + d * 4], 2000 + (uint32_t)d, 3, 1);
+                    push_dm1(w, (uint8_t)src, payload, sizeof(payload), t);
+                }
+            }
+        }
+    }
+    w->config = (DtcParseConfig_t){ .dtc_active_read_count = 10, .dtc_active_time_window = 10, .debounce_dtc_inactive_time = 10, .timeout_multi_frame = 5 };
+    return w->frame_count > 0;
+}
+
+// 4 ECUs interleaving 1785 byte BAMs (445 DTCs, 255 packets) every second
+static bool build_max_bam(BenchWorkload_t* w) {
+    static uint8_t payload[4][1785];
+    for (int s = 0; s < 4; s++) {
+        payload[s][0] = 0x44;
+        payload[s][1] = 0xFF;
+        for (uint32_t d = 0; d < 445; d++) pack_dtc(&payload[s][2 + d * 4], 1 + (d % 64), (uint8_t)((d / 64) & 1), 1);
+        payload[s][1782] = payload[s][1783] = payload[s][1784] = 0xFF;
+    }
+    for (uint32_t t = 0; t < 60; t++) {
+        uint8_t cm[8] = { TP_CM_BAM, 1785 & 0xFF, 1785 >> 8, 255, 0xFF, 0xCA, 0xFE, 0x00 };
+        for (uint8_t s = 0; s < 4; s++) push_frame(w, 0x1CECFF00 | (0x10u + s), cm, t);
+        for (int p = 0; p < 255; p++) {
+            for (uint8_t s = 0; s < 4; s++) {
+                uint8_t data[8];
+                data[0] = (uint8_t)(p + 1);
+                memcpy(&data[1], &payload[s][p * 7], 7);
+                push_frame(w, 0x1CEBFF00 | (0x10u + s), data, t);
+            }
+            push_noise(w, t);
+        }
+    }
+    w->config = (DtcParseConfig_t){ .dtc_active_read_count = 10, .dtc_active_time_window = 10, .debounce_dtc_inactive_time = 10, .timeout_multi_frame = 5 };
+    return w->frame_count > 0;
+}
+
+// 32 ECUs sending 4 DTCs per second, half from a small recurring set (promoted and expired) and half random (candidates that expire)
+static bool build_churn(BenchWorkload_t* w) {
+    uint8_t payload[2 + 4 * 4];
+    for (uint32_t t = 0; t < 120; t++) {
+        for (uint32_t src = 0; src < 32; src++) {
+            payload[0] = 0x10;
+            payload[1] = 0xFF;
+            for (int d = 0; d < 4; d++) {
+                uint32_t r = rng_next();
+                uint32_t spn = (r & 1) ? 500 + ((r >> 1) % 8) : 10000 + ((r >> 1) % 4096);
+                pack_dtc(&payload[2 + d * 4], spn, (uint8_t)((r >> 20) % 4), 1);
+            }
+            push_dm1(w, (uint8_t)(0x80 + src), payload, sizeof(payload), t);
+            for (int n = 0; n < 8; n++) push_noise(w, t);
+        }
+    }
+    w->config = (DtcParseConfig_t){ .dtc_active_read_count = 2, .dtc_active_time_window = 3, .debounce_dtc_inactive_time = 2, .timeout_multi_frame = 2 };
+    return w->frame_count > 0;
+}
+
+static bool load_log(BenchWorkload_t* w, const char* file_path) {
+    AscReader_t reader;
+    CanFrame_t frames[BENCH_READ_BATCH];
+
+    uint64_t start = now_ns();
+    if (!asc_reader_open(&reader, file_path)) return false;
+    size_t file_size = reader.map.size;
+    while (!asc_reader_eof(&reader)) {
+        size_t n = asc_reader_read_frames(&reader, frames, BENCH_READ_BATCH, UINT32_MAX);
+        for (size_t i = 0; i < n; i++) {
+            if (!push_frame(w, frames[i].can_id, frames[i].data, frames[i].timestamp)) {
+                asc_reader_close(&reader);
+                return false;
+            }
+        }
+    }
+    asc_reader_close(&reader);
+    uint64_t elapsed = now_ns() - start;
+
+    printf("%-24s parse   %9zu frames %8.1f MB/s %9.2f Mframes/s\n", w->name, w->frame_count,
+        (double)file_size * 1e3 / (double)(elapsed ? elapsed : 1), (double)w->frame_count * 1e3 / (double)(elapsed ? elapsed : 1));
+    w->config = (DtcParseConfig_t){ .dtc_active_read_count = 10, .dtc_active_time_window = 10, .debounce_dtc_inactive_time = 10, .timeout_multi_frame = 5 };
+    return true;
+}
+
+static void run_workload(const BenchWorkload_t* w, const BenchEngine_t* engine, BenchResult_t* result) {
+    DtcParserStorage_t storage = DTC_PARSER_STORAGE(bench_buffers);
+    init_dtc_parser_with_storage(&parser, &storage);
+    set_dtc_parser_options(&parser, engine->options);
+    set_dtc_filtering(&parser, w->config.dtc_active_read_count, w->config.dtc_active_time_window,
+        w->config.debounce_dtc_inactive_time, w->config.timeout_multi_frame);
+    memset((void*)result, 0, sizeof(BenchResult_t));
+
+    // One second of frames, then 'check_dtcs'
+    size_t i = 0;
+    while (i < w->frame_count) {
+        uint32_t second = w->frames[i].timestamp;
+        size_t end = i;
+        while (end < w->frame_count && w->frames[end].timestamp == second) end++;
+
+        uint64_t start = now_ns();
+        if (engine->batch) {
+            process_dtc_frames(&parser, &w->frames[i], end - i, NULL);
+        } else {
+            for (size_t j = i; j < end; j++) process_dtc_frame(&parser, w->frames[j].can_id, w->frames[j].data, second);
+        }
+        uint64_t ingested = now_ns();
+        check_dtcs(&parser, second + 1);
+        uint64_t checked = now_ns();
+
+        result->ingest_ns += ingested - start;
+        result->check_ns += checked - ingested;
+        result->check_count++;
+        i = end;
+    }
+    result->has_stats = get_dtc_parser_stats(&parser, &result->stats);
+}
+
+static void bench_workload(const BenchWorkload_t* w, int runs) {
+    for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++) {
+        BenchResult_t best = { 0 };
+        for (int r = 0; r < runs; r++) {
+            BenchResult_t result;
+            run_workload(w, &engines[e], &result);
+            if (r == 0 || (result.ingest_ns + result.check_ns) < (best.ingest_ns + best.check_ns)) best = result;
+        }
+
+        double ingest_ns = best.ingest_ns ? (double)best.ingest_ns : 1.0;
+        printf("%-24s %-7s %9zu frames %9.2f Mframes/s %7.1f ns/frame %9.1f ns/check",
+            w->name, engines[e].name, w->frame_count, (double)w->frame_count * 1e3 / ingest_ns,
+            ingest_ns / (double)(w->frame_count ? w->frame_count : 1), (double)best.check_ns / (double)(best.check_count ? best.check_count : 1));
+        if (best.has_stats) {
+            printf("  peak %u candidates, %u active, %u sessions\n", best.stats.candidate_peak, best.stats.active_peak, best.stats.multi_frame_peak);
+        } else {
+            printf("\n");
+        }
+    }
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [-n runs] [log.asc...]\n", name);
+}
+
+int main(int argc, char* argv[]) {
+    int runs = 3;
+    int first_file = argc;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && (i + 1) < argc) {
+            runs = atoi(argv[++i]);
+            if (runs < 1) runs = 1;
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            first_file = i;
+            break;
+        }
+    }
+
+    const char** logs = (const char**)&argv[first_file];
+    size_t log_count = (size_t)(argc - first_file);
+    if (log_count == 0) {
+        logs = default_logs;
+        log_count = sizeof(default_logs) / sizeof(default_logs[0]);
+    }
+
+    bool ok = true;
+    for (size_t l = 0; l < log_count; l++) {
+        BenchWorkload_t w = { 0 };
+        const char* base = strrchr(logs[l], '/');
+        snprintf(w.name, sizeof(w.name), "%s", base ? base + 1 : logs[l]);
+        if (load_log(&w, logs[l])) {
+            bench_workload(&w, runs);
+        } else {
+            fprintf(stderr, "Failed to load %s\n", logs[l]);
+            ok = false;
+        }
+        free(w.frames);
+    }
+
+    static const struct {
+        const char* name;
+        bool (*build)(BenchWorkload_t* w);
+    } synthetic[] = {
+        { "synthetic:many_ecus", build_many_ecus },
+        { "synthetic:max_bam",   build_max_bam },
+        { "synthetic:churn",     build_churn },
+    };
+    for (size_t s = 0; s < sizeof(synthetic) / sizeof(synthetic[0]); s++) {
+        BenchWorkload_t w = { 0 };
+        snprintf(w.name, sizeof(w.name), "%s", synthetic[s].name);
+        if (synthetic[s].build(&w)) {
+            bench_workload(&w, runs);
+        } else {
+            fprintf(stderr, "Out of memory\n");
+            ok = false;
+        }
+        free(w.frames);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,175 @@
+/**
+ * @file asc_reader.c
+ * @brief Source file for the CANalyzer .ASC log reader
+ *
+ * The file is memory mapped (see `file_map.h`) and parsed in place: each line is located with `memchr` and tokenized by hand, timestamps are decoded as
+ * fixed-point microseconds and the identifier/data bytes with a nibble lookup table. The lines
+ * that are not frames are rejected on their first unexpected character.
+ *
+ * @authored by Roger da Silva Moschiel
+ * @date 1 August 2024
+ */
+
+#include "asc_reader.h"
+#include <string.h>
+
+// Hex digit value + 1, 0 for any other character
+#define HEX_ENTRY(c, v) [c] = (v) + 1
+static const uint8_t hex_table[256] = {
+    HEX_ENTRY('0', 0), HEX_ENTRY('1', 1), HEX_ENTRY('2', 2), HEX_ENTRY('3', 3),
+    HEX_ENTRY('4', 4), HEX_ENTRY('5', 5), HEX_ENTRY('6', 6), HEX_ENTRY('7', 7),
+    HEX_ENTRY('8', 8), HEX_ENTRY('9', 9),
+    HEX_ENTRY('A', 10), HEX_ENTRY('B', 11), HEX_ENTRY('C', 12), HEX_ENTRY('D', 13), HEX_ENTRY('E', 14), HEX_ENTRY('F', 15),
+    HEX_ENTRY('a', 10), HEX_ENTRY('b', 11), HEX_ENTRY('c', 12), HEX_ENTRY('d', 13), HEX_ENTRY('e', 14), HEX_ENTRY('f', 15),
+};
+
+// Private function prototypes
+static bool parse_line(AscReader_t* reader, const char* p, const char* end, CanFrame_t* frame);
+
+// Private functions
+static inline bool is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+static inline bool is_digit(char c) {
+    return (unsigned char)(c - '0') < 10;
+}
+
+static inline const char* skip_blanks(const char* p, const char* end) {
+    while (p < end && is_blank(*p)) p++;
+    return p;
+}
+
+// Converts a log timestamp to the reader time base, truncated to 32 bits
+static uint32_t to_ticks(const AscReader_t* reader, uint64_t timestamp_us) {
+    if (reader->ticks_per_second == 1) return (uint32_t)(timestamp_us / 1000000u);
+    return (uint32_t)(timestamp_us * reader->ticks_per_second / 1000000u);
+}
+
+// Parses one line (without the '\n'), returns true if it is an 8 byte received data frame
+static bool parse_line(AscReader_t* reader, const char* p, const char* end, CanFrame_t* frame) {
+    p = skip_blanks(p, end);
+
+    // Timestamp "seconds.fraction", decoded as fixed-point microseconds
+    if (p == end || !is_digit(*p)) return false; // Header, comments, "Begin/End TriggerBlock"
+    uint64_t seconds = 0;
+    while (p < end && is_digit(*p)) seconds = seconds * 10 + (uint64_t)(*p++ - '0');
+    uint32_t micros = 0;
+    if (p < end && *p == '.') {
+        int digits = 0;
+        for (p++; p < end && is_digit(*p); p++) {
+            if (digits < 6) {
+                micros = micros * 10 + (uint32_t)(*p - '0');
+                digits++;
+            }
+        }
+        for (; digits < 6; digits++) micros *= 10;
+    }
+    if (p == end || !is_blank(*p)) return false;
+    reader->timestamp_us = seconds * 1000000u + micros;
+
+    // Channel, not a number on "CAN 1 Status", "Start of measurement", "TriggerEvent" lines
+    p = skip_blanks(p, end);
+    if (p == end || !is_digit(*p)) return false;
+    while (p < end && is_digit(*p)) p++;
+    if (p == end || !is_blank(*p)) return false;
+
+    // Identifier, with the 'x' suffix if extended. "ErrorFrame", "Statistic:", "J1939TP" end here
+    p = skip_blanks(p, end);
+    uint32_t can_id = 0;
+    int nibbles = 0;
+    uint8_t v;
+    while (p < end && (v = hex_table[(uint8_t)*p]) != 0) {
+        can_id = (can_id << 4) | (uint32_t)(v - 1);
+        nibbles++;
+        p++;
+    }
+    if (nibbles == 0 || nibbles > 8) return false;
+    bool extended = (p < end && *p == 'x');
+    if (extended) p++;
+    if (p == end || !is_blank(*p)) return false;
+
+    // Direction, only received frames
+    p = skip_blanks(p, end);
+    if ((end - p) < 3 || p[0] != 'R' || p[1] != 'x' || !is_blank(p[2])) return false;
+
+    // Data frame ('d', remote frames are 'r') with DLC 8
+    p = skip_blanks(p + 2, end);
+    if ((end - p) < 2 || p[0] != 'd' || !is_blank(p[1])) return false;
+    p = skip_blanks(p + 1, end);
+    if ((end - p) < 2 || p[0] != '8' || !is_blank(p[1])) return false;
+    p++;
+
+    for (int i = 0; i < 8; i++) {
+        p = skip_blanks(p, end);
+        if ((end - p) < 2) return false;
+        uint8_t hi = hex_table[(uint8_t)p[0]];
+        uint8_t lo = hex_table[(uint8_t)p[1]];
+        if (hi == 0 || lo == 0) return false;
+        frame->data[i] = (uint8_t)(((hi - 1) << 4) | (lo - 1));
+        p += 2;
+    }
+
+    frame->can_id = can_id;
+    frame->timestamp = to_ticks(reader, reader->timestamp_us);
+    reader->extended = extended;
+    return true;
+}
+
+// Public functions
+bool asc_reader_open(AscReader_t* reader, const char* file_path) {
+    memset((void*)reader, 0, sizeof(AscReader_t));
+    reader->ticks_per_second = 1;
+    return file_map_open(&reader->map, file_path);
+}
+
+void asc_reader_close(AscReader_t* reader) {
+    file_map_close(&reader->map);
+    memset((void*)reader, 0, sizeof(AscReader_t));
+}
+
+void asc_reader_set_time_base(AscReader_t* reader, uint32_t ticks_per_second) {
+    if (ticks_per_second > 0) reader->ticks_per_second = ticks_per_second;
+}
+
+size_t asc_reader_read_frames(AscReader_t* reader, CanFrame_t* frames, size_t max_frames, uint32_t stop_timestamp) {
+    if (reader->map.data == NULL) return 0;
+
+    const char* p = reader->map.data + reader->pos;
+    const char* end = reader->map.data + reader->map.size;
+    // First microsecond whose timestamp in ticks is at least 'stop_timestamp'
+    uint64_t tps = reader->ticks_per_second;
+    uint64_t stop_us = ((uint64_t)stop_timestamp * 1000000u + tps - 1) / tps;
+    size_t n = 0;
+
+    while (n < max_frames && p < end) {
+        const char* nl = (const char*)memchr(p, '\n', (size_t)(end - p));
+        const char* line_end = nl ? nl : end;
+        reader->line_pos = (size_t)(p - reader->map.data);
+        if (parse_line(reader, p, line_end, &frames[n])) n++;
+        reader->line_count++;
+        p = nl ? nl + 1 : end;
+        if (reader->timestamp_us >= stop_us) break;
+    }
+
+    reader->pos = (size_t)(p - reader->map.data);
+    reader->frame_count += n;
+    return n;
+}
+
+bool asc_reader_frame_at(AscReader_t* reader, size_t offset, CanFrame_t* frame) {
+    if (offset >= reader->map.size) return false;
+
+    const char* p = reader->map.data + offset;
+    const char* end = reader->map.data + reader->map.size;
+    const char* nl = (const char*)memchr(p, '\n', (size_t)(end - p));
+    return parse_line(reader, p, nl ? nl : end, frame);
+}
+
+uint32_t asc_reader_timestamp(const AscReader_t* reader) {
+    return to_ticks(reader, reader->timestamp_us);
+}
+
+bool asc_reader_eof(const AscReader_t* reader) {
+    return reader->pos >= reader->map.size;
+}
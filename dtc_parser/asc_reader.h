@@ -0,0 +1,117 @@
+/**
+ * @file asc_reader.h
+ * @brief Header file for the CANalyzer .ASC log reader
+ *
+ * Reads the CAN frames of a CANalyzer/CANoe log in ASCII format (.ASC, "base hex") straight from
+ * a memory mapping of the file, with a hand-written tokenizer: fixed-point timestamps, direct hex
+ * nibble decoding, no `sscanf` and no copy of the lines. The frames are delivered in batches of
+ * `CanFrame_t`, ready to be passed to `process_dtc_frames`.
+ *
+ * Only received 8 byte data frames are delivered, e.g.:
+ * @code
+ *    6.474846 1  18FECA03x       Rx   d 8 04 FF 22 EE E3 81 FF FF  Length = 559804 BitCount = 144 ID = 419351043x
+ * @endcode
+ * Every other line (header, ErrorFrame, Status, Statistic, J1939TP reassembled messages, remote
+ * frames, Tx frames, shorter frames) is skipped, only its timestamp is taken into account.
+ *
+ * @authored by Roger da Silva Moschiel
+ * @date 1 August 2024
+ */
+
+#ifndef ASC_READER_H
+#define ASC_READER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "dtc_parser.h"
+#include "file_map.h"
+
+/**
+ * @brief Struct for an open .ASC log
+ */
+typedef struct {
+    FileMap_t map;          // Memory mapping of the whole file
+    size_t pos;             // Offset of the next line to be parsed
+    size_t line_pos;        // Offset of the last parsed line
+    uint64_t timestamp_us;  // Timestamp of the last parsed line with a timestamp, in microseconds
+    uint64_t frame_count;   // Frames delivered so far
+    uint64_t line_count;    // Lines parsed so far
+    bool extended;          // Identifier of the last delivered frame is extended ('x' suffix)
+    uint32_t ticks_per_second; // Unit of the delivered timestamps ('asc_reader_set_time_base'), 1 for seconds
+} AscReader_t;
+
+/**
+ * @brief Opens and maps an .ASC log file
+ *
+ * @param reader Reader context to be initialized
+ * @param file_path Path of the .ASC file
+ * @return bool True on success, false if the file could not be opened or mapped
+ */
+bool asc_reader_open(AscReader_t* reader, const char* file_path);
+
+/**
+ * @brief Unmaps and closes a log opened by `asc_reader_open`
+ *
+ * @param reader Reader context
+ */
+void asc_reader_close(AscReader_t* reader);
+
+/**
+ * @brief Sets the unit of the timestamps delivered by the reader and of `stop_timestamp`
+ *
+ * The logs are opened with timestamps in seconds. A finer unit (e.g. 1000 for milliseconds)
+ * matches a parser whose time base was changed by `set_dtc_time_base`. The timestamps are
+ * truncated to 32 bits like the free running counter of a target, `stop_timestamp` is compared
+ * without wrapping, so it only applies to logs shorter than 2^32 ticks.
+ *
+ * @param reader Reader context
+ * @param ticks_per_second Timestamp ticks per second, ignored if 0
+ */
+void asc_reader_set_time_base(AscReader_t* reader, uint32_t ticks_per_second);
+
+/**
+ * @brief Reads the next CAN frames of the log
+ *
+ * Parses lines until `max_frames` frames were stored or until a line with a timestamp of at
+ * least `stop_timestamp` was parsed (the frame of that line, if any, is included), so the
+ * caller can run its periodic work (e.g. `check_dtcs`) at the same point of the log as a line by
+ * line reader would. Pass `UINT32_MAX` to only stop when the buffer is full.
+ *
+ * @param reader Reader context
+ * @param frames Output buffer, the frame timestamps are in ticks (seconds unless changed by `asc_reader_set_time_base`)
+ * @param max_frames Number of frames that fit in `frames`
+ * @param stop_timestamp Timestamp in ticks where the reading stops
+ * @return size_t Number of frames stored in `frames`
+ */
+size_t asc_reader_read_frames(AscReader_t* reader, CanFrame_t* frames, size_t max_frames, uint32_t stop_timestamp);
+
+/**
+ * @brief Parses the frame of the line at a given offset of the log
+ *
+ * Random access for indexes built from `line_pos`, it does not move the reading position.
+ *
+ * @param reader Reader context
+ * @param offset Offset of the line in the log
+ * @param frame Output frame, the timestamp is in ticks
+ * @return bool True if the line is a frame that `asc_reader_read_frames` would deliver
+ */
+bool asc_reader_frame_at(AscReader_t* reader, size_t offset, CanFrame_t* frame);
+
+/**
+ * @brief Returns the timestamp of the last parsed line, in ticks
+ *
+ * @param reader Reader context
+ * @return uint32_t Timestamp in ticks (seconds unless changed by `asc_reader_set_time_base`)
+ */
+uint32_t asc_reader_timestamp(const AscReader_t* reader);
+
+/**
+ * @brief Tells if the whole log was parsed
+ *
+ * @param reader Reader context
+ * @return bool True if there are no more lines to be parsed
+ */
+bool asc_reader_eof(const AscReader_t* reader);
+
+#endif // ASC_READER_H
@@ -0,0 +1,221 @@
+/**
+ * @file can_bin.c
+ * @brief Source file for the compact binary CAN capture format
+ *
+ * The writer keeps one block in memory and writes it with its header (and ID bitmap) when it is
+ * full, when the gap to the previous frame does not fit in the 28-bit delta or when the time goes
+ * backwards. The reader maps the file and walks the blocks in place.
+ *
+ * @authored by Roger da Silva Moschiel
+ * @date 1 August 2024
+ */
+
+#include "can_bin.h"
+#include <string.h>
+
+// The records are read in place from the mapping, the layout must not have any padding
+typedef char can_bin_layout_check[(sizeof(CanBinFileHeader_t) == 16 && sizeof(CanBinBlockHeader_t) == 32 && sizeof(CanBinRecord_t) == 16) ? 1 : -1];
+
+// Private function prototypes
+static bool flush_block(CanBinWriter_t* writer);
+static CanBinRecord_t* append_record(CanBinWriter_t* writer, uint64_t timestamp_us, uint8_t dlc);
+static bool load_next_block(CanBinReader_t* reader);
+
+// Private functions
+static inline uint32_t bitmap_bin(uint32_t can_id) {
+    uint32_t pf = (can_id >> 16) & 0xFF;
+    return (pf < 0xF0) ? pf : (256 + ((can_id >> 8) & 0xFF)); // PDU2 PGNs are told apart by their group extension
+}
+
+static inline bool is_dtc_can_id(uint32_t can_id) {
+    return ((can_id & 0x00FFFF00) == 0x00FECA00) || // single frame DM1 message
+           ((can_id & 0x00FF0000) == 0x00EC0000) || // multi frame message
+           ((can_id & 0x00FF0000) == 0x00EB0000);   // multi frame data
+}
+
+static bool flush_block(CanBinWriter_t* writer) {
+    if (writer->block.frame_count == 0) return true;
+
+    size_t count = writer->block.frame_count;
+    if (fwrite(&writer->block, sizeof(CanBinBlockHeader_t), 1, writer->file) != 1 ||
+        (writer->bitmaps && fwrite(writer->bitmap, CAN_BIN_BITMAP_BYTES, 1, writer->file) != 1) ||
+        fwrite(writer->records, sizeof(CanBinRecord_t), count, writer->file) != count) {
+        writer->failed = true;
+    }
+    writer->file_size += sizeof(CanBinBlockHeader_t) + (writer->bitmaps ? CAN_BIN_BITMAP_BYTES : 0) + count * sizeof(CanBinRecord_t);
+
+    memset(&writer->block, 0, sizeof(CanBinBlockHeader_t));
+    memset(writer->bitmap, 0, CAN_BIN_BITMAP_BYTES);
+    return !writer->failed;
+}
+
+static bool load_next_block(CanBinReader_t* reader) {
+    size_t header = reader->next_block;
+    size_t size = reader->map.size;
+    reader->block = NULL;
+    if (size < sizeof(CanBinBlockHeader_t) || header > (size - sizeof(CanBinBlockHeader_t))) {
+        reader->next_block = size;
+        return false;
+    }
+
+    const CanBinBlockHeader_t* block = (const CanBinBlockHeader_t*)(reader->map.data + header);
+    size_t records = header + sizeof(CanBinBlockHeader_t) + (reader->bitmaps ? CAN_BIN_BITMAP_BYTES : 0);
+    if (records > size || block->frame_count > ((size - records) / sizeof(CanBinRecord_t))) {
+        reader->next_block = size; // Truncated file, the incomplete block is ignored
+        return false;
+    }
+
+    reader->block = block;
+    reader->bitmap = reader->bitmaps ? (const uint8_t*)(reader->map.data + header + sizeof(CanBinBlockHeader_t)) : NULL;
+    reader->records = (const CanBinRecord_t*)(reader->map.data + records);
+    reader->record = 0;
+    reader->next_block = records + (size_t)block->frame_count * sizeof(CanBinRecord_t);
+    return true;
+}
+
+// Public functions
+bool can_bin_writer_open(CanBinWriter_t* writer, const char* file_path, bool bitmaps) {
+    memset((void*)writer, 0, sizeof(CanBinWriter_t));
+    writer->file = fopen(file_path, "wb");
+    if (!writer->file) return false;
+    writer->bitmaps = bitmaps;
+
+    CanBinFileHeader_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CAN_BIN_MAGIC, 4);
+    header.version = CAN_BIN_VERSION;
+    header.flags = bitmaps ? CAN_BIN_FLAG_BITMAPS : 0;
+    header.block_frames = CAN_BIN_BLOCK_FRAMES;
+    if (fwrite(&header, sizeof(header), 1, writer->file) != 1) writer->failed = true;
+    writer->file_size = sizeof(header);
+    return !writer->failed;
+}
+
+static CanBinRecord_t* append_record(CanBinWriter_t* writer, uint64_t timestamp_us, uint8_t dlc) {
+    CanBinBlockHeader_t* block = &writer->block;
+    if (block->frame_count == CAN_BIN_BLOCK_FRAMES ||
+        (block->frame_count > 0 && (timestamp_us < writer->timestamp_us || (timestamp_us - writer->timestamp_us) > CAN_BIN_MAX_DELTA_US))) {
+        flush_block(writer);
+    }
+    if (block->frame_count == 0) {
+        block->base_timestamp_us = timestamp_us;
+        writer->timestamp_us = timestamp_us;
+    }
+
+    CanBinRecord_t* record = &writer->records[block->frame_count++];
+    memset(record, 0, sizeof(CanBinRecord_t));
+    record->delta_dlc = (uint32_t)(timestamp_us - writer->timestamp_us) | ((uint32_t)dlc << 28);
+    block->last_timestamp_us = timestamp_us;
+    writer->timestamp_us = timestamp_us;
+    return record;
+}
+
+bool can_bin_write_frame(CanBinWriter_t* writer, uint64_t timestamp_us, uint32_t can_id, bool extended, uint8_t dlc, const uint8_t* data) {
+    if (dlc > 8) return false;
+
+    CanBinRecord_t* record = append_record(writer, timestamp_us, dlc);
+    record->can_id = (can_id & 0x1FFFFFFF) | (extended ? CAN_BIN_RECORD_EXTENDED : 0);
+    memcpy(record->data, data, dlc);
+
+    uint32_t bin = bitmap_bin(can_id);
+    writer->bitmap[bin >> 3] |= (uint8_t)(1u << (bin & 7));
+    if (is_dtc_can_id(can_id)) writer->block.flags |= CAN_BIN_BLOCK_HAS_DTC;
+    writer->frame_count++;
+    return !writer->failed;
+}
+
+bool can_bin_write_time_mark(CanBinWriter_t* writer, uint64_t timestamp_us) {
+    append_record(writer, timestamp_us, CAN_BIN_DLC_TIME_MARK);
+    writer->mark_count++;
+    return !writer->failed;
+}
+
+bool can_bin_writer_close(CanBinWriter_t* writer) {
+    flush_block(writer);
+    if (writer->file && fclose(writer->file) != 0) writer->failed = true;
+    writer->file = NULL;
+    return !writer->failed;
+}
+
+bool can_bin_reader_open(CanBinReader_t* reader, const char* file_path, bool dtc_only) {
+    memset((void*)reader, 0, sizeof(CanBinReader_t));
+    if (!file_map_open(&reader->map, file_path)) return false;
+
+    const CanBinFileHeader_t* header = (const CanBinFileHeader_t*)reader->map.data;
+    if (reader->map.size < sizeof(CanBinFileHeader_t) ||
+        memcmp(header->magic, CAN_BIN_MAGIC, 4) != 0 || header->version != CAN_BIN_VERSION) {
+        can_bin_reader_close(reader);
+        return false;
+    }
+    reader->bitmaps = (header->flags & CAN_BIN_FLAG_BITMAPS) != 0;
+    reader->dtc_only = dtc_only;
+    reader->next_block = sizeof(CanBinFileHeader_t);
+    return true;
+}
+
+void can_bin_reader_close(CanBinReader_t* reader) {
+    file_map_close(&reader->map);
+    memset((void*)reader, 0, sizeof(CanBinReader_t));
+}
+
+size_t can_bin_read_frames(CanBinReader_t* reader, CanFrame_t* frames, size_t max_frames, uint32_t stop_timestamp) {
+    uint64_t stop_us = (uint64_t)stop_timestamp * 1000000u;
+    size_t n = 0;
+
+    while (n < max_frames) {
+        if (reader->block == NULL || reader->record == reader->block->frame_count) {
+            if (!load_next_block(reader)) break;
+            if (reader->dtc_only && !(reader->block->flags & CAN_BIN_BLOCK_HAS_DTC) &&
+                reader->block->last_timestamp_us < stop_us) {
+                // Nothing to deliver and no stop inside, the whole block is skipped at once
+                reader->timestamp_us = reader->block->last_timestamp_us;
+                reader->record = reader->block->frame_count;
+                reader->skipped_blocks++;
+                continue;
+            }
+            reader->timestamp_us = reader->block->base_timestamp_us;
+        }
+
+        const CanBinRecord_t* record = &reader->records[reader->record++];
+        reader->record_pos = (size_t)((const char*)record - reader->map.data);
+        reader->timestamp_us += record->delta_dlc & CAN_BIN_MAX_DELTA_US;
+        bool deliver = (record->delta_dlc >> 28) == 8 &&
+                       !(reader->dtc_only && !(reader->block->flags & CAN_BIN_BLOCK_HAS_DTC));
+        if (deliver) {
+            CanFrame_t* frame = &frames[n++];
+            frame->can_id = record->can_id & 0x1FFFFFFF;
+            memcpy(frame->data, record->data, 8);
+            frame->timestamp = (uint32_t)(reader->timestamp_us / 1000000u);
+        }
+        if (reader->timestamp_us >= stop_us) break;
+    }
+
+    reader->frame_count += n;
+    return n;
+}
+
+bool can_bin_frame_at(const CanBinReader_t* reader, size_t offset, CanFrame_t* frame) {
+    if (offset < sizeof(CanBinFileHeader_t) || offset > (reader->map.size - sizeof(CanBinRecord_t)) || (offset & 15) != 0) return false;
+
+    const CanBinRecord_t* record = (const CanBinRecord_t*)(reader->map.data + offset);
+    if ((record->delta_dlc >> 28) != 8) return false;
+    frame->can_id = record->can_id & 0x1FFFFFFF;
+    memcpy(frame->data, record->data, 8);
+    frame->timestamp = 0;
+    return true;
+}
+
+uint32_t can_bin_reader_timestamp(const CanBinReader_t* reader) {
+    return (uint32_t)(reader->timestamp_us / 1000000u);
+}
+
+bool can_bin_reader_eof(const CanBinReader_t* reader) {
+    bool block_done = (reader->block == NULL) || (reader->record == reader->block->frame_count);
+    return block_done && (reader->map.size < sizeof(CanBinBlockHeader_t) ||
+                          reader->next_block > (reader->map.size - sizeof(CanBinBlockHeader_t)));
+}
+
+bool can_bin_bitmap_may_contain(const uint8_t* bitmap, uint32_t can_id) {
+    uint32_t bin = bitmap_bin(can_id);
+    return (bitmap[bin >> 3] >> (bin & 7)) & 1;
+}
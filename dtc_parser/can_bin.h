@@ -0,0 +1,232 @@
+/**
+ * @file can_bin.h
+ * @brief Header file for the compact binary CAN capture format
+ *
+ * Fixed-record capture format for fast, repeated replays of CAN logs. A file is:
+ * @code
+ * CanBinFileHeader_t                                  16 bytes
+ * block 0: CanBinBlockHeader_t                        32 bytes
+ *          ID bitmap (if CAN_BIN_FLAG_BITMAPS)        64 bytes
+ *          CanBinRecord_t[frame_count]                16 bytes each
+ * block 1: ...
+ * @endcode
+ * Every record is 16 bytes: microseconds since the previous record of the block (the first one
+ * is relative to the block base timestamp), DLC, 29-bit identifier and 8 data bytes. Records
+ * with the DLC `CAN_BIN_DLC_TIME_MARK` are not frames, they only move the time forward.
+ * All the fields are in the byte order of the host that wrote the file (little endian on every
+ * supported target) and every record is 16 byte aligned in the file, so a mapped file is read
+ * in place.
+ *
+ * The block header tells if the block has any DTC related frame (DM1, TP.CM, TP.DT), so a DTC
+ * only replay skips whole blocks without looking at their frames. The optional ID bitmap is a
+ * "may contain" filter with one bit per J1939 PDU format (PDU1) or group extension (PDU2), for
+ * readers looking for other PGNs. A converted log is about 12x smaller than its `.ASC` source.
+ *
+ * @authored by Roger da Silva Moschiel
+ * @date 1 August 2024
+ */
+
+#ifndef CAN_BIN_H
+#define CAN_BIN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "dtc_parser.h"
+#include "file_map.h"
+
+#define CAN_BIN_MAGIC "CANB"
+#define CAN_BIN_VERSION 1
+#define CAN_BIN_BLOCK_FRAMES 256         // Frames per block written by `can_bin_writer` (small enough for most blocks to have no DM1)
+#define CAN_BIN_BITMAP_BYTES 64          // 512 bins: PDU1 PDU format 0-255, PDU2 group extension 256-511
+#define CAN_BIN_MAX_DELTA_US 0x0FFFFFFF  // Larger gaps between frames start a new block
+
+#define CAN_BIN_FLAG_BITMAPS (1u << 0)   // File flag: every block header is followed by an ID bitmap
+#define CAN_BIN_BLOCK_HAS_DTC (1u << 0)  // Block flag: the block has at least one DM1, TP.CM or TP.DT frame
+#define CAN_BIN_RECORD_EXTENDED (1u << 31) // Record identifier flag: 29-bit identifier
+#define CAN_BIN_DLC_TIME_MARK 15         // Record DLC of a time mark: no frame, only moves the time (e.g. a Status line of the log)
+
+/**
+ * @brief Struct for the file header
+ */
+typedef struct {
+    char magic[4];              // CAN_BIN_MAGIC
+    uint16_t version;           // CAN_BIN_VERSION
+    uint16_t flags;             // CAN_BIN_FLAG_*
+    uint32_t block_frames;      // Maximum frames per block
+    uint32_t reserved;
+} CanBinFileHeader_t; // (16 bytes)
+
+/**
+ * @brief Struct for a block header
+ */
+typedef struct {
+    uint32_t frame_count;       // Records in the block
+    uint32_t flags;             // CAN_BIN_BLOCK_*
+    uint64_t base_timestamp_us; // Timestamp of the first frame of the block, microseconds
+    uint64_t last_timestamp_us; // Timestamp of the last frame of the block, microseconds
+    uint64_t reserved;
+} CanBinBlockHeader_t; // (32 bytes)
+
+/**
+ * @brief Struct for a frame record
+ */
+typedef struct {
+    uint32_t delta_dlc;         // Bits 0-27: microseconds since the previous record of the block, bits 28-31: DLC or CAN_BIN_DLC_TIME_MARK
+    uint32_t can_id;            // Bits 0-28: identifier, CAN_BIN_RECORD_EXTENDED for 29-bit identifiers
+    uint8_t data[8];
+} CanBinRecord_t; // (16 bytes)
+
+/**
+ * @brief Struct for a file being written
+ */
+typedef struct {
+    FILE* file;
+    bool bitmaps;
+    bool failed;                // A write failed, the file is incomplete
+    CanBinBlockHeader_t block;
+    uint8_t bitmap[CAN_BIN_BITMAP_BYTES];
+    uint64_t timestamp_us;      // Timestamp of the last written frame
+    uint64_t frame_count;
+    uint64_t mark_count;        // Time marks written
+    uint64_t file_size;         // Bytes written so far
+    CanBinRecord_t records[CAN_BIN_BLOCK_FRAMES];
+} CanBinWriter_t;
+
+/**
+ * @brief Struct for a file being read
+ */
+typedef struct {
+    FileMap_t map;
+    bool bitmaps;
+    bool dtc_only;                      // Skip the blocks without DTC frames (see `can_bin_reader_open`)
+    size_t next_block;                  // Offset of the next block header
+    const CanBinBlockHeader_t* block;   // Current block, NULL before the first one
+    const uint8_t* bitmap;              // ID bitmap of the current block, NULL if the file has none
+    const CanBinRecord_t* records;      // Records of the current block
+    uint32_t record;                    // Next record of the current block
+    size_t record_pos;                  // Offset of the last read record
+    uint64_t timestamp_us;              // Timestamp of the last read (or skipped) frame, microseconds
+    uint64_t frame_count;               // Frames delivered so far
+    uint64_t skipped_blocks;            // Blocks skipped because of `dtc_only`
+} CanBinReader_t;
+
+/**
+ * @brief Creates a binary capture file
+ *
+ * @param writer Writer context to be initialized
+ * @param file_path Path of the file, it is overwritten if it exists
+ * @param bitmaps True to store an ID bitmap with every block
+ * @return bool True on success
+ */
+bool can_bin_writer_open(CanBinWriter_t* writer, const char* file_path, bool bitmaps);
+
+/**
+ * @brief Appends a frame to a binary capture file
+ *
+ * @param writer Writer context
+ * @param timestamp_us Timestamp of the frame in microseconds
+ * @param can_id CAN identifier
+ * @param extended True if the identifier is a 29-bit one
+ * @param dlc Data length code (0 to 8)
+ * @param data Frame data, `dlc` bytes are stored, the others are zero
+ * @return bool True on success
+ */
+bool can_bin_write_frame(CanBinWriter_t* writer, uint64_t timestamp_us, uint32_t can_id, bool extended, uint8_t dlc, const uint8_t* data);
+
+/**
+ * @brief Appends a time mark to a binary capture file
+ *
+ * Records that the log time reached `timestamp_us` without a frame (e.g. an error or status
+ * line of the original log), so a replay runs its periodic work at the same points as the
+ * replay of the original log. Writing a mark on the first such line of every second is enough.
+ *
+ * @param writer Writer context
+ * @param timestamp_us Timestamp in microseconds
+ * @return bool True on success
+ */
+bool can_bin_write_time_mark(CanBinWriter_t* writer, uint64_t timestamp_us);
+
+/**
+ * @brief Writes the last block and closes a binary capture file
+ *
+ * @param writer Writer context
+ * @return bool True if the whole file was written successfully
+ */
+bool can_bin_writer_close(CanBinWriter_t* writer);
+
+/**
+ * @brief Opens and maps a binary capture file
+ *
+ * With `dtc_only` the blocks without DTC related frames are skipped, the timestamp still moves
+ * through them so `stop_timestamp` of `can_bin_read_frames` is honored exactly.
+ *
+ * @param reader Reader context to be initialized
+ * @param file_path Path of the file
+ * @param dtc_only True to only deliver the frames of blocks with DTC related frames
+ * @return bool True on success, false if the file could not be mapped or is not a binary capture
+ */
+bool can_bin_reader_open(CanBinReader_t* reader, const char* file_path, bool dtc_only);
+
+/**
+ * @brief Unmaps a file opened by `can_bin_reader_open`
+ *
+ * @param reader Reader context
+ */
+void can_bin_reader_close(CanBinReader_t* reader);
+
+/**
+ * @brief Reads the next CAN frames of the capture
+ *
+ * Same contract as `asc_reader_read_frames`: reads until `max_frames` frames were stored or
+ * until a frame with a timestamp of at least `stop_timestamp` seconds was read (and included).
+ * Only frames with DLC 8 are delivered, as with the .ASC reader.
+ *
+ * @param reader Reader context
+ * @param frames Output buffer, the frame timestamps are in seconds
+ * @param max_frames Number of frames that fit in `frames`
+ * @param stop_timestamp Timestamp in seconds where the reading stops
+ * @return size_t Number of frames stored in `frames`
+ */
+size_t can_bin_read_frames(CanBinReader_t* reader, CanFrame_t* frames, size_t max_frames, uint32_t stop_timestamp);
+
+/**
+ * @brief Reads the frame of the record at a given offset of the capture
+ *
+ * Random access for indexes built from `record_pos`, it does not move the reading position.
+ * The record does not hold its absolute timestamp, `frame->timestamp` is set to 0.
+ *
+ * @param reader Reader context
+ * @param offset Offset of the record in the capture
+ * @param frame Output frame
+ * @return bool True if the record is a frame with DLC 8
+ */
+bool can_bin_frame_at(const CanBinReader_t* reader, size_t offset, CanFrame_t* frame);
+
+/**
+ * @brief Returns the timestamp of the last read frame, in seconds
+ *
+ * @param reader Reader context
+ * @return uint32_t Timestamp in seconds
+ */
+uint32_t can_bin_reader_timestamp(const CanBinReader_t* reader);
+
+/**
+ * @brief Tells if the whole capture was read
+ *
+ * @param reader Reader context
+ * @return bool True if there are no more frames
+ */
+bool can_bin_reader_eof(const CanBinReader_t* reader);
+
+/**
+ * @brief Tells if a block may contain frames with a given identifier, according to its ID bitmap
+ *
+ * @param bitmap ID bitmap of the block (`reader->bitmap`)
+ * @param can_id CAN identifier
+ * @return bool False if the block has no frame of the identifier PGN, true if it may have
+ */
+bool can_bin_bitmap_may_contain(const uint8_t* bitmap, uint32_t can_id);
+
+#endif // CAN_BIN_H
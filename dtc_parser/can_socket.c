@@ -0,0 +1,222 @@
+/**
+ * @file can_socket.c
+ * @brief Source file for the SocketCAN live ingest of the DTC parser (Linux)
+ *
+ * @authored by Roger da Silva Moschiel
+ * @date 1 August 2024
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // recvmmsg
+#endif
+
+#include "can_socket.h"
+#include <string.h>
+
+#if defined(__linux__)
+#include <errno.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+
+#define CAN_SOCKET_CONTROL_SIZE 128 // Ancillary data of one frame: SCM_TIMESTAMPING (3 timespec) and SO_RXQ_OVFL
+
+// Private function prototypes
+static uint32_t timespec_to_ticks(const struct timespec* ts, uint32_t ticks_per_second);
+static uint64_t monotonic_ns(void);
+static void read_control(CanSocket_t* sock, struct msghdr* msg, CanFrame_t* frame);
+
+// Private functions
+static uint32_t timespec_to_ticks(const struct timespec* ts, uint32_t ticks_per_second) {
+    // Truncated to 32 bits, the parser compares the timestamps wrap-safe
+    return (uint32_t)((uint64_t)ts->tv_sec * ticks_per_second + (uint64_t)ts->tv_nsec * ticks_per_second / 1000000000u);
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void read_control(CanSocket_t* sock, struct msghdr* msg, CanFrame_t* frame) {
+    const struct timespec* sw = NULL;
+    const struct timespec* hw = NULL;
+
+    for (struct cmsghdr* c = CMSG_FIRSTHDR(msg); c != NULL; c = CMSG_NXTHDR(msg, c)) {
+        if (c->cmsg_level != SOL_SOCKET) continue;
+        if (c->cmsg_type == SCM_TIMESTAMPING) {
+            // ts[0] software (kernel clock), ts[2] raw hardware clock of the controller
+            const struct scm_timestamping* t = (const struct scm_timestamping*)CMSG_DATA(c);
+            sw = &t->ts[0];
+            if (t->ts[2].tv_sec != 0 || t->ts[2].tv_nsec != 0) hw = &t->ts[2];
+        } else if (c->cmsg_type == SO_RXQ_OVFL) {
+            uint32_t drops;
+            memcpy(&drops, CMSG_DATA(c), sizeof(drops));
+            sock->kernel_drops = drops;
+        }
+    }
+
+    // A driver without hardware timestamps switches the socket to the kernel clock for good, clocks are never mixed
+    if (sock->hw_timestamps && hw == NULL) sock->hw_timestamps = false;
+    if (sock->hw_timestamps) {
+        frame->timestamp = timespec_to_ticks(hw, sock->ticks_per_second);
+    } else if (sw != NULL) {
+        frame->timestamp = timespec_to_ticks(sw, sock->ticks_per_second);
+    } else {
+        frame->timestamp = can_socket_now(sock);
+    }
+}
+#endif
+
+// Public functions
+bool can_socket_open(CanSocket_t* sock, const char* ifname, uint32_t ticks_per_second, bool hw_timestamps) {
+    memset((void*)sock, 0, sizeof(CanSocket_t));
+    sock->fd = -1;
+    sock->ticks_per_second = ticks_per_second > 0 ? ticks_per_second : 1;
+    sock->hw_timestamps = hw_timestamps;
+
+#if defined(__linux__)
+    // Same frames as 'is_dtc_frame': the mask leaves out the priority, the data page and the addresses where they don't matter
+    const struct can_filter filters[] = {
+        { CAN_EFF_FLAG | 0x00FECA00, CAN_EFF_FLAG | CAN_RTR_FLAG | 0x00FFFF00 }, // DM1
+        { CAN_EFF_FLAG | 0x00EC0000, CAN_EFF_FLAG | CAN_RTR_FLAG | 0x00FF0000 }, // TP.CM
+        { CAN_EFF_FLAG | 0x00EB0000, CAN_EFF_FLAG | CAN_RTR_FLAG | 0x00FF0000 }, // TP.DT
+    };
+    int timestamping = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if (hw_timestamps) timestamping |= SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+    int one = 1;
+
+    struct ifreq ifr;
+    size_t name_len = strlen(ifname);
+    if (name_len >= sizeof(ifr.ifr_name)) {
+        errno = ENODEV;
+        return false;
+    }
+
+    int fd = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (fd < 0) return false;
+
+    memset(&ifr, 0, sizeof(ifr));
+    memcpy(ifr.ifr_name, ifname, name_len);
+    struct sockaddr_can addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family = AF_CAN;
+    if (ioctl(fd, SIOCGIFINDEX, &ifr) != 0 ||
+        setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FILTER, filters, sizeof(filters)) != 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &timestamping, sizeof(timestamping)) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return false;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)); // Drop counter is optional
+
+    addr.can_ifindex = ifr.ifr_ifindex;
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return false;
+    }
+    sock->fd = fd;
+    sock->last_read_ns = monotonic_ns();
+    return true;
+#else
+    (void)ifname;
+    return false;
+#endif
+}
+
+size_t can_socket_read_frames(CanSocket_t* sock, CanFrame_t* frames, size_t max_frames, int timeout_ms) {
+    size_t n = 0;
+#if defined(__linux__)
+    struct can_frame raw[CAN_SOCKET_BATCH];
+    struct iovec iov[CAN_SOCKET_BATCH];
+    struct mmsghdr msgs[CAN_SOCKET_BATCH];
+    union {
+        char buf[CAN_SOCKET_CONTROL_SIZE];
+        struct cmsghdr align;
+    } control[CAN_SOCKET_BATCH];
+
+    if (sock->fd < 0) return 0;
+    struct pollfd pfd = { sock->fd, POLLIN, 0 };
+    if (poll(&pfd, 1, timeout_ms) <= 0) return 0;
+
+    while (n < max_frames) {
+        size_t batch = max_frames - n;
+        if (batch > CAN_SOCKET_BATCH) batch = CAN_SOCKET_BATCH;
+        for (size_t i = 0; i < batch; i++) {
+            iov[i].iov_base = &raw[i];
+            iov[i].iov_len = sizeof(struct can_frame);
+            memset(&msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = control[i].buf;
+            msgs[i].msg_hdr.msg_controllen = sizeof(control[i].buf);
+        }
+
+        int got = recvmmsg(sock->fd, msgs, (unsigned int)batch, MSG_DONTWAIT, NULL);
+        if (got <= 0) break; // EAGAIN: the queue is empty
+
+        for (int i = 0; i < got; i++) {
+            CanFrame_t* frame = &frames[n];
+            if (msgs[i].msg_len < sizeof(struct can_frame) || !(raw[i].can_id & CAN_EFF_FLAG)) continue;
+            frame->can_id = raw[i].can_id & CAN_EFF_MASK;
+            memset(frame->data, 0xFF, sizeof(frame->data)); // Shorter frames are padded as J1939 does
+            memcpy(frame->data, raw[i].data, raw[i].can_dlc <= 8 ? raw[i].can_dlc : 8);
+            read_control(sock, &msgs[i].msg_hdr, frame);
+            n++;
+        }
+        if ((size_t)got < batch) break;
+    }
+
+    if (n > 0) {
+        sock->last_timestamp = frames[n - 1].timestamp;
+        sock->last_read_ns = monotonic_ns();
+        sock->frames_read += (uint32_t)n;
+    }
+#else
+    (void)sock;
+    (void)frames;
+    (void)max_frames;
+    (void)timeout_ms;
+#endif
+    return n;
+}
+
+size_t can_socket_process(CanSocket_t* sock, DtcParser_t* parser, int timeout_ms) {
+    CanFrame_t frames[CAN_SOCKET_BATCH];
+    size_t n = can_socket_read_frames(sock, frames, CAN_SOCKET_BATCH, timeout_ms);
+    if (n > 0) process_dtc_frames(parser, frames, n, NULL);
+    return n;
+}
+
+uint32_t can_socket_now(const CanSocket_t* sock) {
+#if defined(__linux__)
+    if (sock->hw_timestamps) {
+        // The controller clock is only known through the frames: last frame plus the time elapsed since it was read
+        uint64_t elapsed = monotonic_ns() - sock->last_read_ns;
+        return sock->last_timestamp + (uint32_t)(elapsed * sock->ticks_per_second / 1000000000u);
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts); // Clock of the kernel software timestamps
+    return timespec_to_ticks(&ts, sock->ticks_per_second);
+#else
+    (void)sock;
+    return 0;
+#endif
+}
+
+void can_socket_close(CanSocket_t* sock) {
+#if defined(__linux__)
+    if (sock->fd >= 0) close(sock->fd);
+#endif
+    sock->fd = -1;
+}
@@ -0,0 +1,92 @@
+/**
+ * @file can_socket.h
+ * @brief Header file for the SocketCAN live ingest of the DTC parser (Linux)
+ *
+ * Opens a raw CAN socket on one interface with kernel filters for the J1939 frames the parser
+ * acts on (DM1 0xFECA, TP.CM 0xEC and TP.DT 0xEB, any priority, data page and source), so the
+ * rest of the bus traffic is dropped in the kernel and never copied to user space. The frames
+ * are read in batches with `recvmmsg` as `CanFrame_t` records for `process_dtc_frames`, stamped
+ * with the kernel receive time (hardware timestamps of the CAN controller when available).
+ *
+ * One `CanSocket_t` is opened per interface, each bus feeding its own parser context. On other
+ * platforms `can_socket_open` fails and the reads return no frames.
+ *
+ * @authored by Roger da Silva Moschiel
+ * @date 1 August 2024
+ */
+
+#ifndef CAN_SOCKET_H
+#define CAN_SOCKET_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "dtc_parser.h"
+
+#define CAN_SOCKET_BATCH 64     // Frames read per 'recvmmsg' call (stack buffers of 'can_socket_read_frames')
+
+/**
+ * @brief Struct for an open CAN socket
+ */
+typedef struct {
+    int fd;                     // Socket descriptor, -1 if closed
+    uint32_t ticks_per_second;  // Time base of the frame timestamps, the one given to 'set_dtc_time_base'
+    bool hw_timestamps;         // Frames stamped by the CAN controller clock, kernel clock otherwise
+    uint32_t last_timestamp;    // Timestamp (ticks) of the last frame read
+    uint64_t last_read_ns;      // CLOCK_MONOTONIC of the last frame read, for 'can_socket_now' with hardware timestamps
+    uint32_t frames_read;       // Frames returned by 'can_socket_read_frames'
+    uint32_t kernel_drops;      // Frames dropped by the kernel because the socket queue was full (SO_RXQ_OVFL)
+} CanSocket_t;
+
+/**
+ * @brief Opens a CAN interface with the DTC frame filters
+ *
+ * @param sock Socket to be initialized
+ * @param ifname Interface name, e.g. "can0"
+ * @param ticks_per_second Time base of the frame timestamps, e.g. 1000 with `set_dtc_time_base(&parser, 1000)`
+ * @param hw_timestamps Request the hardware timestamps of the controller, the kernel clock is used
+ *                      if the driver does not provide them
+ * @return bool True on success, false if the interface cannot be opened (see `errno`)
+ */
+bool can_socket_open(CanSocket_t* sock, const char* ifname, uint32_t ticks_per_second, bool hw_timestamps);
+
+/**
+ * @brief Reads the received DTC frames
+ *
+ * Waits up to `timeout_ms` for the first frame, then returns every frame already queued, up to
+ * `max_frames`, with a single `recvmmsg` per `CAN_SOCKET_BATCH` frames.
+ *
+ * @param sock Open socket
+ * @param frames Output buffer
+ * @param max_frames Number of frames that fit in `frames`
+ * @param timeout_ms Maximum wait for the first frame, 0 to return at once, -1 to wait forever
+ * @return size_t Number of frames stored in `frames`, 0 on timeout or error
+ */
+size_t can_socket_read_frames(CanSocket_t* sock, CanFrame_t* frames, size_t max_frames, int timeout_ms);
+
+/**
+ * @brief Reads the received DTC frames and gives them to a parser (`process_dtc_frames`)
+ *
+ * @param sock Open socket
+ * @param parser Parser context of the bus
+ * @param timeout_ms Maximum wait for the first frame, as in `can_socket_read_frames`
+ * @return size_t Number of frames processed
+ */
+size_t can_socket_process(CanSocket_t* sock, DtcParser_t* parser, int timeout_ms);
+
+/**
+ * @brief Returns the current time in the clock of the frame timestamps, for `check_dtcs`
+ *
+ * @param sock Open socket
+ * @return uint32_t Current time in ticks
+ */
+uint32_t can_socket_now(const CanSocket_t* sock);
+
+/**
+ * @brief Closes a socket opened by `can_socket_open`
+ *
+ * @param sock Socket
+ */
+void can_socket_close(CanSocket_t* sock);
+
+#endif // CAN_SOCKET_H
@@ -0,0 +1,260 @@
+/**
+ * @file dtc_history.c
+ * @brief Source file for the persistent DTC occurrence history
+ *
+ * @authored by Roger da Silva Moschiel
+ * @date 1 August 2024
+ */
+
+#include "dtc_history.h"
+#include <string.h>
+
+#define RECORD_SIZE sizeof(DtcHistoryRecord_t)
+#define HISTORY_READ_BATCH 16 // Events read per 'read_dtc_events' call of 'dtc_history_collect'
+
+// Private function prototypes
+static void read_record(const DtcHistory_t* history, size_t page, size_t offset, DtcHistoryRecord_t* r);
+static bool is_erased(const DtcHistoryRecord_t* r);
+static uint32_t record_type(const DtcHistoryRecord_t* r);
+static void push_record(DtcHistory_t* history, uint32_t key, uint32_t info);
+static bool start_page(DtcHistory_t* history, size_t page, uint32_t sequence);
+static void decode_record(const DtcHistoryRecord_t* r, uint32_t base, DtcEvent_t* e);
+
+// Private functions
+static void read_record(const DtcHistory_t* history, size_t page, size_t offset, DtcHistoryRecord_t* r) {
+    memcpy(r, history->store.mapped + page * history->store.page_size + offset, RECORD_SIZE);
+}
+
+static bool is_erased(const DtcHistoryRecord_t* r) {
+    return r->key == 0xFFFFFFFFu && r->info == 0xFFFFFFFFu;
+}
+
+static uint32_t record_type(const DtcHistoryRecord_t* r) {
+    return (r->info >> 14) & 0x03;
+}
+
+static void push_record(DtcHistory_t* history, uint32_t key, uint32_t info) {
+    DtcHistoryRecord_t* r = &history->ring[history->head & (history->ring_size - 1)];
+    r->key = key;
+    r->info = info;
+    history->head++;
+}
+
+/**
+ * @brief Erases a page and programs its header, the history moves to it only on success
+ */
+static bool start_page(DtcHistory_t* history, size_t page, uint32_t sequence) {
+    const DtcHistoryStore_t* s = &history->store;
+    DtcHistoryRecord_t header = { DTC_HISTORY_MAGIC, sequence };
+
+    if (!s->erase_page(s->user_data, page)) {
+        return false;
+    }
+    if (!s->program(s->user_data, page * s->page_size, &header, RECORD_SIZE)) {
+        return false;
+    }
+    history->page = page;
+    history->offset = RECORD_SIZE;
+    history->sequence = sequence;
+    return true;
+}
+
+static void decode_record(const DtcHistoryRecord_t* r, uint32_t base, DtcEvent_t* e) {
+    uint32_t info = r->info;
+    uint32_t lamps = info >> 24;
+
+    memset(e, 0, sizeof(*e));
+    e->type = (uint8_t)record_type(r);
+    e->timestamp = base + (info & DTC_HISTORY_MAX_DELTA);
+    e->dtc.src = (uint8_t)(r->key >> 24);
+    e->dtc.spn = (r->key >> 5) & 0x7FFFF;
+    e->dtc.fmi = r->key & 0x1F;
+    e->dtc.oc = (info >> 16) & 0x7F;
+    e->dtc.cm = (info >> 23) & 0x01;
+    e->dtc.mil = (lamps >> 6) & 0x03;
+    e->dtc.rsl = (lamps >> 4) & 0x03;
+    e->dtc.awl = (lamps >> 2) & 0x03;
+    e->dtc.pl = lamps & 0x03;
+}
+
+// Public functions
+bool dtc_history_init(DtcHistory_t* history, const DtcHistoryStore_t* store, DtcHistoryRecord_t* ring, size_t ring_size) {
+    bool found = false;
+    size_t newest = 0;
+    uint32_t newest_sequence = 0;
+
+    if (history == NULL || store == NULL || store->mapped == NULL || store->erase_page == NULL || store->program == NULL ||
+        store->page_size % RECORD_SIZE != 0 || store->page_size < 3 * RECORD_SIZE || store->page_count < 2 ||
+        ring == NULL || ring_size < 2 || (ring_size & (ring_size - 1)) != 0) {
+        return false;
+    }
+
+    memset(history, 0, sizeof(*history));
+    history->store = *store;
+    history->ring = ring;
+    history->ring_size = ring_size;
+
+    // Newest page: valid header with the highest sequence number (wrap-safe)
+    for (size_t p = 0; p < store->page_count; p++) {
+        DtcHistoryRecord_t header;
+        read_record(history, p, 0, &header);
+        if (header.key != DTC_HISTORY_MAGIC) {
+            continue;
+        }
+        if (!found || (int32_t)(header.info - newest_sequence) > 0) {
+            found = true;
+            newest = p;
+            newest_sequence = header.info;
+        }
+    }
+
+    if (!found) {
+        return start_page(history, 0, 1);
+    }
+
+    // Append after the last record of the newest page, keeping the base in effect there
+    history->page = newest;
+    history->sequence = newest_sequence;
+    history->offset = RECORD_SIZE;
+    while (history->offset < store->page_size) {
+        DtcHistoryRecord_t r;
+        read_record(history, newest, history->offset, &r);
+        if (is_erased(&r)) {
+            break;
+        }
+        if (record_type(&r) == DTC_HISTORY_BASE) {
+            history->store_base = r.key;
+        }
+        history->offset += RECORD_SIZE;
+    }
+    return true;
+}
+
+size_t dtc_history_append(DtcHistory_t* history, const DtcEvent_t* events, size_t count) {
+    size_t stored = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        const DtcEvent_t* e = &events[i];
+        const DTC_t* d = &e->dtc;
+        uint32_t delta = e->timestamp - history->ring_base;
+        bool need_base = !history->ring_base_valid || delta > DTC_HISTORY_MAX_DELTA;
+        size_t needed = need_base ? 2 : 1;
+        uint32_t lamps = ((uint32_t)d->mil << 6) | ((uint32_t)d->rsl << 4) | ((uint32_t)d->awl << 2) | d->pl;
+
+        if (history->ring_size - (history->head - history->tail) < needed) {
+            history->dropped++;
+            continue;
+        }
+        if (need_base) {
+            // Also taken when the time goes backwards (delta wraps above the maximum)
+            push_record(history, e->timestamp, (uint32_t)DTC_HISTORY_BASE << 14);
+            history->ring_base = e->timestamp;
+            history->ring_base_valid = true;
+            delta = 0;
+        }
+        push_record(history, DTC_HISTORY_KEY(d->src, d->spn, d->fmi),
+            delta | ((uint32_t)(e->type & 0x03) << 14) | ((uint32_t)d->oc << 16) | ((uint32_t)d->cm << 23) | (lamps << 24));
+        stored++;
+    }
+    return stored;
+}
+
+size_t dtc_history_collect(DtcHistory_t* history, DtcParser_t* parser) {
+    DtcEvent_t events[HISTORY_READ_BATCH];
+    size_t total = 0;
+    size_t n;
+
+    while ((n = read_dtc_events(parser, events, HISTORY_READ_BATCH)) > 0) {
+        total += dtc_history_append(history, events, n);
+    }
+    return total;
+}
+
+size_t dtc_history_pending(const DtcHistory_t* history) {
+    return history->head - history->tail;
+}
+
+bool dtc_history_flush(DtcHistory_t* history) {
+    const DtcHistoryStore_t* s = &history->store;
+    size_t mask = history->ring_size - 1;
+
+    while (history->tail != history->head) {
+        if (history->offset + RECORD_SIZE > s->page_size) {
+            // Wrap to the next (oldest) page, starting it with the base in effect so it decodes on its own
+            const DtcHistoryRecord_t* next = &history->ring[history->tail & mask];
+            if (!start_page(history, (history->page + 1) % s->page_count, history->sequence + 1)) {
+                return false;
+            }
+            if (record_type(next) != DTC_HISTORY_BASE) {
+                DtcHistoryRecord_t base = { history->store_base, (uint32_t)DTC_HISTORY_BASE << 14 };
+                if (!s->program(s->user_data, history->page * s->page_size + history->offset, &base, RECORD_SIZE)) {
+                    return false;
+                }
+                history->offset += RECORD_SIZE;
+            }
+        }
+
+        // Contiguous run: bounded by the pending records, the end of the ring storage and the end of the page
+        size_t start = history->tail & mask;
+        size_t run = history->head - history->tail;
+        if (run > history->ring_size - start) {
+            run = history->ring_size - start;
+        }
+        if (run > (s->page_size - history->offset) / RECORD_SIZE) {
+            run = (s->page_size - history->offset) / RECORD_SIZE;
+        }
+
+        if (!s->program(s->user_data, history->page * s->page_size + history->offset, &history->ring[start], run * RECORD_SIZE)) {
+            return false;
+        }
+        for (size_t i = 0; i < run; i++) {
+            if (record_type(&history->ring[start + i]) == DTC_HISTORY_BASE) {
+                history->store_base = history->ring[start + i].key;
+            }
+        }
+        history->tail += run;
+        history->offset += run * RECORD_SIZE;
+    }
+    return true;
+}
+
+size_t dtc_history_query(const DtcHistory_t* history, uint32_t key, uint32_t key_mask, DtcHistoryCursor_t* cursor, DtcEvent_t* events, size_t max_events) {
+    const DtcHistoryStore_t* s = &history->store;
+    size_t n = 0;
+
+    // The page after the one being written is the oldest, the written one is the last
+    while (cursor->step < s->page_count && n < max_events) {
+        size_t page = (history->page + 1 + cursor->step) % s->page_count;
+        size_t end = (page == history->page) ? history->offset : s->page_size;
+        DtcHistoryRecord_t r;
+
+        if (cursor->offset == 0) {
+            read_record(history, page, 0, &r);
+            if (r.key != DTC_HISTORY_MAGIC) {
+                cursor->step++;
+                continue;
+            }
+            cursor->offset = RECORD_SIZE;
+        }
+
+        while (cursor->offset < end && n < max_events) {
+            read_record(history, page, cursor->offset, &r);
+            if (is_erased(&r)) {
+                cursor->offset = end;
+                break;
+            }
+            cursor->offset += RECORD_SIZE;
+            if (record_type(&r) == DTC_HISTORY_BASE) {
+                cursor->base = r.key;
+            } else if (((r.key ^ key) & key_mask) == 0) {
+                decode_record(&r, cursor->base, &events[n++]);
+            }
+        }
+
+        if (cursor->offset >= end) {
+            cursor->step++;
+            cursor->offset = 0;
+        }
+    }
+    return n;
+}
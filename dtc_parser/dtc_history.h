@@ -0,0 +1,190 @@
+/**
+ * @file dtc_history.h
+ * @brief Header file for the persistent DTC occurrence history
+ *
+ * The active list only knows the DTCs that are active now, a DTC that is removed is forgotten
+ * together with its timestamps. The history keeps every transition of the active list
+ * (`DtcEvent_t` added/removed/changed) as 8 byte records: the DTC key (same packing as the
+ * key column of the parser), a 14 bit time delta, the event type, the occurrence counter and
+ * the lamps. A `DTC_HISTORY_BASE` record, carrying the absolute timestamp, is inserted when
+ * the delta does not fit and at the start of each page, so every page decodes on its own.
+ *
+ * Records are first buffered in a RAM ring (`dtc_history_append`, `dtc_history_collect`) and
+ * later written in batches (`dtc_history_flush`) to the backing store: a memory mapped region
+ * (e.g. internal flash of the MCU, or a mapped file) of `page_count` erasable pages, used as a
+ * circular log. Writes are sequential programs of whole records inside a page, each page is
+ * erased only when the log wraps to it, so every page receives the same number of erase cycles.
+ *
+ * Page layout (`page_size` bytes):
+ * | header (magic, sequence) | base record | records ... | erased (0xFF) ... |
+ *
+ * The queries (`dtc_history_query`) read the mapped store directly and compare the raw key of
+ * each record with a source/SPN/FMI mask, only the matching records are decoded.
+ *
+ * The history is not thread safe, the append, flush and query calls of a `DtcHistory_t` are
+ * made from the same task (usually the low priority task that also calls `check_dtcs`).
+ *
+ * @authored by Roger da Silva Moschiel
+ * @date 1 August 2024
+ */
+
+#ifndef DTC_HISTORY_H
+#define DTC_HISTORY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "dtc_parser.h"
+
+#define DTC_HISTORY_MAGIC 0x48435444u       // "DTCH", key of the page header record
+#define DTC_HISTORY_BASE 3                  // Record type of a base record (after the DtcEventType_t values)
+#define DTC_HISTORY_MAX_DELTA 0x3FFFu       // Largest time delta (ticks) of a record, a base record is inserted beyond it
+
+// Key of a record, same packing as the key column of the parser: SRC (8) | SPN (19) | FMI (5)
+#define DTC_HISTORY_KEY(src, spn, fmi) ((((uint32_t)(src) & 0xFF) << 24) | (((uint32_t)(spn) & 0x7FFFF) << 5) | ((uint32_t)(fmi) & 0x1F))
+#define DTC_HISTORY_MASK_SRC 0xFF000000u    // Query mask matching the source
+#define DTC_HISTORY_MASK_SPN 0x00FFFFE0u    // Query mask matching the SPN
+#define DTC_HISTORY_MASK_FMI 0x0000001Fu    // Query mask matching the FMI
+
+/**
+ * @brief Record of the history (8 bytes), as stored in RAM and in the backing store
+ *
+ * `info` bits: delta (0-13), type (14-15), OC (16-22), CM (23), lamps MIL:RSL:AWL:PL (24-31, DM1 byte order).
+ * For a base record `key` holds the absolute timestamp and `info` only the type.
+ * For the page header `key` is `DTC_HISTORY_MAGIC` and `info` the page sequence number.
+ */
+typedef struct {
+    uint32_t key;
+    uint32_t info;
+} DtcHistoryRecord_t;
+
+/**
+ * @brief Backing store of the history, a memory mapped region of erasable pages
+ */
+typedef struct {
+    const uint8_t* mapped;  // Mapped view of the store ('page_size' x 'page_count' bytes, 4 byte aligned), read by the queries
+    size_t page_size;       // Bytes per erasable page, multiple of 8, at least 3 records
+    size_t page_count;      // Pages used as a circular log, at least 2
+    // Erases a page (all bytes 0xFF afterwards), returns false on failure
+    bool (*erase_page)(void* user_data, size_t page);
+    // Programs 'size' bytes (multiple of 8) of erased memory at 'offset' from the start of the store, returns false on failure
+    bool (*program)(void* user_data, size_t offset, const void* data, size_t size);
+    void* user_data;        // Passed to the callbacks
+} DtcHistoryStore_t;
+
+/**
+ * @brief Position of a query in the store, zero initialized to start from the oldest record
+ */
+typedef struct {
+    size_t step;        // Pages already visited, oldest page first
+    size_t offset;      // Byte offset of the next record in the page
+    uint32_t base;      // Timestamp of the last base record read
+} DtcHistoryCursor_t;
+
+/**
+ * @brief History context
+ */
+typedef struct {
+    DtcHistoryStore_t store;
+    DtcHistoryRecord_t* ring;   // RAM ring of the records not yet flushed (caller storage)
+    size_t ring_size;           // Records of 'ring' (power of 2)
+    size_t head;                // Next record written by the append
+    size_t tail;                // Next record written to the store by the flush
+    uint32_t ring_base;         // Base timestamp of the last record appended
+    bool ring_base_valid;       // False until the first record after the init
+    uint32_t store_base;        // Base timestamp in effect at the end of the store
+    size_t page;                // Page currently written
+    size_t offset;              // Byte offset of the next record in 'page'
+    uint32_t sequence;          // Sequence number of 'page'
+    uint32_t dropped;           // Events lost because the RAM ring was full
+} DtcHistory_t;
+
+/**
+ * @brief Initializes a history and mounts its backing store
+ *
+ * The pages are scanned for the newest valid header. Records already in the store are kept
+ * and the new ones are appended after them, a store without any valid page is started on page 0.
+ *
+ * @param history History context
+ * @param store Backing store (copied)
+ * @param ring RAM ring storage
+ * @param ring_size Records of `ring`, must be a power of 2
+ * @return true If the store was mounted
+ * @return false If the arguments are invalid or the first page could not be erased/programmed
+ */
+bool dtc_history_init(DtcHistory_t* history, const DtcHistoryStore_t* store, DtcHistoryRecord_t* ring, size_t ring_size);
+
+/**
+ * @brief Appends active list events to the RAM ring of the history
+ *
+ * The events that do not fit are counted in `dropped`, `dtc_history_flush` makes room again.
+ *
+ * @param history History context
+ * @param events Events, e.g. read with `read_dtc_events`
+ * @param count Number of events
+ * @return size_t Number of events stored
+ */
+size_t dtc_history_append(DtcHistory_t* history, const DtcEvent_t* events, size_t count);
+
+/**
+ * @brief Reads every pending event of a parser (`read_dtc_events`) into the history
+ *
+ * The parser must run with the `DTC_OPT_EVENT_RING` option, and the history is then its single
+ * event consumer. Applications that also forward the events read them themselves and call
+ * `dtc_history_append`.
+ *
+ * @param history History context
+ * @param parser Parser context
+ * @return size_t Number of events stored
+ */
+size_t dtc_history_collect(DtcHistory_t* history, DtcParser_t* parser);
+
+/**
+ * @brief Returns the number of records waiting in the RAM ring
+ *
+ * @param history History context
+ * @return size_t Records not yet written to the store
+ */
+size_t dtc_history_pending(const DtcHistory_t* history);
+
+/**
+ * @brief Writes the records of the RAM ring to the backing store
+ *
+ * The records are programmed with one call per page touched, the next page is erased when the
+ * current one is full (the oldest records of the store are lost then).
+ *
+ * @param history History context
+ * @return true If every record was written
+ * @return false If a callback failed, the records not written stay in the RAM ring
+ */
+bool dtc_history_flush(DtcHistory_t* history);
+
+/**
+ * @brief Reads the records of the store that match a key, oldest first
+ *
+ * A record matches when `(record key & key_mask) == (key & key_mask)`, e.g.
+ * `DTC_HISTORY_KEY(0x00, 0, 0)` with `DTC_HISTORY_MASK_SRC` for all DTCs of source 0x00,
+ * or a mask of 0 for every record. The records still in the RAM ring are not visible, call
+ * `dtc_history_flush` before.
+ *
+ * Example usage:
+ * @code
+ * DtcHistoryCursor_t cursor = {0};
+ * DtcEvent_t events[16];
+ * size_t event_count;
+ * while ((event_count = dtc_history_query(&history, DTC_HISTORY_KEY(0, 110, 0), DTC_HISTORY_MASK_SPN, &cursor, events, 16)) > 0) {
+ *     // Use the events here
+ * }
+ * @endcode
+ *
+ * @param history History context
+ * @param key Key to match
+ * @param key_mask Bits of the key compared
+ * @param cursor Query position, updated
+ * @param events Output buffer
+ * @param max_events Number of events that fit in `events`
+ * @return size_t Number of events stored in `events`, 0 at the end of the store
+ */
+size_t dtc_history_query(const DtcHistory_t* history, uint32_t key, uint32_t key_mask, DtcHistoryCursor_t* cursor, DtcEvent_t* events, size_t max_events);
+
+#endif // DTC_HISTORY_H
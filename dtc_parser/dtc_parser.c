@@ -5,7 +5,7 @@
  * This library is designed to parse J1939 Diagnostic Trouble Code (DTC) messages from CAN frames.
  * It manages the detection and tracking of DTCs by maintaining lists of candidate 
  * and active DTCs. The library can handle both single-frame and 
- * multi-frame DTC messages (using the BAM transport protocol). It is optimized for use within 
+ * multi-frame DTC messages (using the BAM and RTS/CTS transport protocol). It is optimized for use within
  * a CAN interrupt handler, with built-in mutex protection to ensure safe concurrent access 
  * to the DTC list. If the DTC list is being accessed when a new DTC frame arrives, the 
  * library will skip processing that frame to avoid concurrency issues, accepting the possibility 
@@ -18,6 +18,7 @@
  * - Debouncing mechanism to handle DTC transition from 'candidate' to 'active'.
  * - Debouncing mechanism to handle DTC removal once it is considered 'inactive'.
  * - Customizable DTC handling with user-defined callback functions.
+ * - Independent parser instances (one `DtcParser_t` context per CAN bus), no shared state.
  *
  * @authored by Roger da Silva Moschiel
  * @date 1 August 2024
@@ -28,29 +29,72 @@
 #include <stdlib.h>
 #include <string.h>
 
-// Print controls
-#define PRINT_DM1_FRAME 0
-#define PRINT_DM1_PARSED 0
-#define PRINT_TP_CM_FRAME 0
-#define PRINT_TP_CM_PARSED 0
-#define PRINT_TP_DT_FRAME 0
-#define PRINT_TP_DT_PARSED 0
-#define PRINT_TP_DT_INCORRECT_ORDER 0
-#define PRINT_TP_CONCAT_MULTI_FRAME 0
-#define PRINT_NEW_AND_REMOVED_DTC 0
-#define PRINT_WARNINGS 0
-
-
-// Private variables
-static DTC_Info_t candidate_dtcs[MAX_CANDIDATE_DTCS];
-static size_t candidate_dtcs_count = 0;
-static DTC_Info_t active_dtcs[MAX_ACTIVE_DTCS];
-static size_t active_dtcs_count = 0;
-static MultiFrameMessage multi_frame_messages[MAX_CONCURRENT_MULTIFRAME];
-static UpdatedActiveDTCsCallback updated_active_dtcs_callback = NULL;
-static bool changed_dtc_list = false;
-static bool dtc_mutex_taken = false;
-static DtcParseConfig_t dtcParseCfg = {
+#if DTC_PARSER_USE_SIMD && defined(__AVX2__)
+#include <immintrin.h>
+#define DTC_FILTER_AVX2 1
+#elif DTC_PARSER_USE_SIMD && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define DTC_FILTER_SSE2 1
+#elif DTC_PARSER_USE_SIMD && defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define DTC_FILTER_NEON 1
+#endif
+#if defined(_MSC_VER) && (DTC_FILTER_AVX2 || DTC_FILTER_SSE2)
+#include <intrin.h>
+#endif
+
+// Trace points, a record is only built if its category is enabled by 'set_dtc_trace_mask'
+#if DTC_PARSER_USE_TRACE
+#define DTC_TRACE(parser, category, event, timestamp, arg16, a0, a1, a2) do { \
+    if ((parser)->trace_mask & (category)) trace_record(parser, event, timestamp, (uint16_t)(arg16), (uint32_t)(a0), (uint32_t)(a1), (uint32_t)(a2)); \
+} while (0)
+#define DTC_TRACE_FRAME(parser, category, event, timestamp, can_id, data) \
+    DTC_TRACE(parser, category, event, timestamp, 0, can_id, load_le32(&(data)[0]), load_le32(&(data)[4]))
+#else
+#define DTC_TRACE(parser, category, event, timestamp, arg16, a0, a1, a2) ((void)0)
+#define DTC_TRACE_FRAME(parser, category, event, timestamp, can_id, data) ((void)0)
+#endif
+
+
+// Frames classified per 'filter_dtc_frames' call in the batch path (bounds the index buffer on the stack)
+#define DTC_FILTER_CHUNK 64
+
+// Instrumentation counters, compiled out with DTC_PARSER_USE_STATS
+#if DTC_PARSER_USE_STATS
+#define DTC_STAT_INC(parser, counter) ((parser)->stats.counter++)
+#define DTC_STAT_PEAK(parser, peak, value) do { if ((value) > (parser)->stats.peak) (parser)->stats.peak = (uint32_t)(value); } while (0)
+#define DTC_STAT_ADD_ATOMIC(parser, counter, n) dtc_atomic_fetch_add_relaxed(&(parser)->counter, (uint32_t)(n))
+#define DTC_STAT_CYCLES_START(start) uint32_t start = dtc_port_cycle_count()
+#define DTC_STAT_CYCLES_END(parser, histogram, max, start) stats_histogram_add((parser)->stats.histogram, &(parser)->stats.max, dtc_port_cycle_count() - (start))
+#else
+#define DTC_STAT_INC(parser, counter) ((void)0)
+#define DTC_STAT_PEAK(parser, peak, value) ((void)0)
+#define DTC_STAT_ADD_ATOMIC(parser, counter, n) ((void)0)
+#define DTC_STAT_CYCLES_START(start) ((void)0)
+#define DTC_STAT_CYCLES_END(parser, histogram, max, start) ((void)0)
+#endif
+
+// Per source DTC counters, compiled out with DTC_PARSER_USE_SOURCE_QUOTA
+#if DTC_PARSER_USE_SOURCE_QUOTA
+#define DTC_SRC_COUNT_INC(parser, counts, src) ((parser)->counts[(src)]++)
+#define DTC_SRC_COUNT_DEC(parser, counts, src) ((parser)->counts[(src)]--)
+#else
+#define DTC_SRC_COUNT_INC(parser, counts, src) ((void)0)
+#define DTC_SRC_COUNT_DEC(parser, counts, src) ((void)0)
+#endif
+
+// The vectorized filter reads 'can_id' as the first of 4 words of each frame
+typedef char can_frame_layout_check[(sizeof(CanFrame_t) == 16 && offsetof(CanFrame_t, can_id) == 0) ? 1 : -1];
+
+// Bytes of the context cleared by the initialization, the embedded tables are cleared through the storage
+#if DTC_PARSER_EMBEDDED_STORAGE
+#define DTC_PARSER_STATE_SIZE offsetof(DtcParser_t, embedded)
+#else
+#define DTC_PARSER_STATE_SIZE sizeof(DtcParser_t)
+#endif
+
+// Default debounce configuration applied by init_dtc_parser
+static const DtcParseConfig_t default_dtc_parse_cfg = {
     .dtc_active_read_count = 10,
     .dtc_active_time_window = 10,
     .debounce_dtc_inactive_time = 20,
@@ -58,100 +102,633 @@ static DtcParseConfig_t dtcParseCfg = {
 };
 
 // Private function prototypes
-static void remove_inactive_dtcs(uint32_t timestamp);
-static void add_candidate_dtc(DTC_Info_t DTC_Info);
-static void add_active_dtc(DTC_Info_t DTC_Info);
-static DTC_Info_t* find_dtc(DTC_Info_t* list, size_t count, uint32_t src, uint32_t spn, uint32_t fmi);
-static void update_dtc_status(uint32_t timestamp, uint8_t src, uint32_t spn, uint8_t fmi, uint8_t cm, uint8_t oc, uint8_t mil, uint8_t rsl, uint8_t awl, uint8_t pl);
-static void process_dm1_message(uint32_t can_id, uint8_t* data, uint32_t length, uint32_t timestamp);
-static void handle_tp_cm_message(uint32_t can_id, uint8_t data[8], uint32_t timestamp);
-static void handle_tp_dt_message(uint32_t can_id, uint8_t data[8], uint32_t timestamp);
-static MultiFrameMessage* find_multi_frame_message(uint32_t message_id_tp_dt);
-static void remove_multi_frame_message(uint32_t message_id_tp_dt);
-static void remove_incomplete_multi_frame_message(uint32_t timestamp);
+static void remove_inactive_dtcs(DtcParser_t* parser, uint32_t timestamp);
+static void add_candidate_dtc(DtcParser_t* parser, DTC_Info_t DTC_Info);
+static void add_active_dtc(DtcParser_t* parser, DTC_Info_t DTC_Info);
+static bool source_quota_reached(DtcParser_t* parser, uint8_t src, bool is_active, uint32_t timestamp);
+static DTC_Info_t* find_dtc(DtcParser_t* parser, uint32_t src, uint32_t spn, uint32_t fmi, bool* is_active);
+static size_t find_dtc_key(const uint32_t* keys, size_t count, uint32_t key);
+static void remove_candidate_dtc_at(DtcParser_t* parser, size_t i);
+static DTC_Info_t* update_dtc_status(DtcParser_t* parser, uint32_t timestamp, uint8_t src, uint32_t spn, uint8_t fmi, uint8_t cm, uint8_t oc, uint8_t mil, uint8_t rsl, uint8_t awl, uint8_t pl);
+static void process_dm1_message(DtcParser_t* parser, uint32_t can_id, const uint8_t* data, uint32_t length, uint32_t timestamp);
+static bool apply_dm1_repeat(DtcParser_t* parser, uint8_t src, const uint8_t* data, uint32_t length, uint32_t timestamp);
+static Dm1RepeatCache_t* claim_dm1_cache_entry(DtcParser_t* parser, uint8_t src);
+static void drop_dm1_cache_entry(DtcParser_t* parser, uint8_t src);
+static DTC_Info_t* update_dm1_dtc(DtcParser_t* parser, uint32_t timestamp, uint8_t src, uint8_t lamps, const uint8_t dtc[4]);
+static void stream_dm1_packet(DtcParser_t* parser, MultiFrameMessage* message, const uint8_t payload[7], uint32_t timestamp);
+static void handle_tp_cm_message(DtcParser_t* parser, uint32_t can_id, const uint8_t data[8], uint32_t timestamp);
+static void open_multi_frame_message(DtcParser_t* parser, uint32_t can_id, const uint8_t data[8], uint32_t timestamp);
+static void handle_tp_dt_message(DtcParser_t* parser, uint32_t can_id, const uint8_t data[8], uint32_t timestamp);
+static MultiFrameMessage* find_multi_frame_message(DtcParser_t* parser, uint8_t src, uint8_t dst);
+static void remove_incomplete_multi_frame_message(DtcParser_t* parser, uint32_t timestamp);
+static void free_multi_frame_slot(DtcParser_t* parser, MultiFrameMessage* message);
+static bool alloc_multi_frame_chunks(DtcParser_t* parser, size_t chunk_count, uint16_t* first_chunk);
+static inline bool is_dtc_frame(uint32_t can_id);
+static void handle_dtc_frame(DtcParser_t* parser, uint32_t can_id, const uint8_t data[8], uint32_t timestamp);
+static void push_dtc_event(DtcParser_t* parser, DtcEventType_t type, const DTC_t* dtc, uint32_t timestamp);
+#if DTC_PARSER_USE_TRACE
+static void trace_record(DtcParser_t* parser, uint16_t event, uint32_t timestamp, uint16_t arg16, uint32_t a0, uint32_t a1, uint32_t a2);
+#endif
+#if DTC_PARSER_USE_STATS
+static void stats_histogram_add(uint32_t bins[DTC_STATS_HISTOGRAM_BINS], uint32_t* max_cycles, uint32_t cycles);
+#endif
+static void begin_active_dtcs_write(DtcParser_t* parser);
+static void end_active_dtcs_write(DtcParser_t* parser);
+static bool publish_dtc_snapshot(DtcParser_t* parser);
+static uint64_t active_list_signature(const DtcParser_t* parser);
+static bool take_notification(DtcParser_t* parser, uint32_t timestamp);
+static uint16_t index_find(DtcParser_t* parser, uint32_t key);
+static void index_set(DtcParser_t* parser, uint32_t key, uint16_t ref);
+static void index_remove_slot(DtcParser_t* parser, uint32_t slot);
+static void rebuild_dtc_index(DtcParser_t* parser);
+static uint32_t scale_ticks(uint32_t value, uint32_t num, uint32_t den);
+static void timer_heap_sift_down(DtcParser_t* parser, DtcTimer_t t);
+static void timer_heap_pop(DtcParser_t* parser);
+static void timer_heap_rearm_top(DtcParser_t* parser, uint16_t ref, uint32_t deadline);
+static void timer_heap_push(DtcParser_t* parser, uint32_t key, uint16_t ref, uint8_t kind, uint32_t deadline);
+static uint16_t timer_dtc_ref(DtcParser_t* parser, const DtcTimer_t* timer);
+static void rebuild_timer_heap(DtcParser_t* parser);
+static void arm_session_timer(DtcParser_t* parser, size_t slot);
+static void expire_session_timer(DtcParser_t* parser, size_t slot, uint32_t timestamp);
+static void remove_expired_candidate_dtcs(DtcParser_t* parser, uint32_t timestamp, size_t first);
+static void remove_expired_active_dtcs(DtcParser_t* parser, uint32_t timestamp, size_t first);
+
+
+// Index references: 0 is an empty index slot, otherwise list position + 1, flagged if in the active list
+#define DTC_INDEX_EMPTY 0
+#define DTC_INDEX_ACTIVE_FLAG 0x8000
+#define CANDIDATE_REF(i) ((uint16_t)((i) + 1))
+#define ACTIVE_REF(i) ((uint16_t)(((i) + 1) | DTC_INDEX_ACTIVE_FLAG))
+
+// Packs (src, spn, fmi) in 32 bits: src:8 | spn:19 | fmi:5
+static inline uint32_t dtc_key(uint32_t src, uint32_t spn, uint32_t fmi) {
+    return (src << 24) | ((spn & 0x7FFFF) << 5) | (fmi & 0x1F);
+}
 
+static inline uint32_t dtc_info_key(const DTC_Info_t* f) {
+    return dtc_key(f->dtc.src, f->dtc.spn, f->dtc.fmi);
+}
+
+#if DTC_FILTER_AVX2 || DTC_FILTER_SSE2 || DTC_FILTER_NEON
+static inline uint32_t lowest_bit_index(uint32_t bits) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, bits);
+    return (uint32_t)index;
+#else
+    return (uint32_t)__builtin_ctz(bits);
+#endif
+}
+#endif
+
+#if DTC_PARSER_USE_TRACE
+static inline uint32_t load_le32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+#endif
+
+static inline uint32_t index_home(const DtcParser_t* parser, uint32_t key) {
+    uint32_t h = key * 0x9E3779B1u; // Fibonacci hashing, spreads the low entropy of spn/fmi
+    return (h ^ (h >> 16)) & parser->index_mask;
+}
+
+// Stores the index slot of the list entry 'ref' points to
+static inline void set_entry_index_slot(DtcParser_t* parser, uint16_t ref, uint32_t slot) {
+    size_t i = (ref & ~DTC_INDEX_ACTIVE_FLAG) - 1;
+    if (ref & DTC_INDEX_ACTIVE_FLAG) {
+        parser->active_index_slots[i] = (uint16_t)slot;
+    } else {
+        parser->candidate_index_slots[i] = (uint16_t)slot;
+    }
+}
+
+// Points the index entry in 'slot' to the list position 'ref' of its DTC, after the list moved it
+static inline void index_move(DtcParser_t* parser, uint32_t slot, uint16_t ref) {
+    parser->index_refs[slot] = ref;
+    set_entry_index_slot(parser, ref, slot);
+}
 
 // Private functions
-static void remove_inactive_dtcs(uint32_t timestamp) {
-    // Check candidate DTCs to be removed
-    for (size_t i = 0; i < candidate_dtcs_count; ++i) {
-        if ((timestamp - candidate_dtcs[i].first_seen) > dtcParseCfg.dtc_active_time_window) {
-            // Shift remaining DTCs
-            for (size_t j = i; j < candidate_dtcs_count - 1; ++j) {
-                candidate_dtcs[j] = candidate_dtcs[j + 1];
-            }
-            --candidate_dtcs_count;
-            --i; // recheck the current index
+static uint16_t index_find(DtcParser_t* parser, uint32_t key) {
+    // Linear probing, the table is never full so it always hits an empty slot
+    for (uint32_t i = index_home(parser, key); ; i = (i + 1) & parser->index_mask) {
+        uint16_t ref = parser->index_refs[i];
+        if (ref == DTC_INDEX_EMPTY) return DTC_INDEX_EMPTY;
+        if (parser->index_keys[i] == key) return ref;
+    }
+}
+
+static void index_set(DtcParser_t* parser, uint32_t key, uint16_t ref) {
+    uint32_t i = index_home(parser, key);
+    while (parser->index_refs[i] != DTC_INDEX_EMPTY && parser->index_keys[i] != key) {
+        i = (i + 1) & parser->index_mask;
+    }
+    parser->index_keys[i] = key;
+    parser->index_refs[i] = ref;
+    set_entry_index_slot(parser, ref, i);
+}
+
+static void index_remove_slot(DtcParser_t* parser, uint32_t slot) {
+    // Backward shift deletion: pull back the following entries of the cluster, so no tombstones are needed
+    uint32_t hole = slot;
+    for (uint32_t j = (slot + 1) & parser->index_mask; parser->index_refs[j] != DTC_INDEX_EMPTY; j = (j + 1) & parser->index_mask) {
+        uint32_t home = index_home(parser, parser->index_keys[j]);
+        // Move the entry only if its home is not between the hole and its current position (cyclically)
+        if (((j - home) & parser->index_mask) >= ((j - hole) & parser->index_mask)) {
+            parser->index_keys[hole] = parser->index_keys[j];
+            index_move(parser, hole, parser->index_refs[j]);
+            hole = j;
         }
     }
+    parser->index_refs[hole] = DTC_INDEX_EMPTY;
+}
 
-    // Check active DTCs to be removed
-    for (size_t i = 0; i < active_dtcs_count; ++i) {
-        if ((timestamp - active_dtcs[i].last_seen) > dtcParseCfg.debounce_dtc_inactive_time) {
-            #if PRINT_NEW_AND_REMOVED_DTC
-            DTC_Info_t f = active_dtcs[i];
-            printf("[%u] Removed DTC -> SRC: 0x%02X (%u), SPN: 0x%X (%u), FMI: %u, LastSeen: %u\n",
-                timestamp, f.dtc.src, f.dtc.src, f.dtc.spn, f.dtc.spn, f.dtc.fmi, f.last_seen);
-            #endif
+static void rebuild_dtc_index(DtcParser_t* parser) {
+    memset((void*)parser->index_refs, 0, (parser->index_mask + 1) * sizeof(uint16_t));
+    if (!(parser->options & DTC_OPT_HASH_INDEX)) return;
+    for (size_t i = 0; i < parser->candidate_dtcs_count; ++i) {
+        index_set(parser, parser->candidate_keys[i], CANDIDATE_REF(i));
+    }
+    for (size_t i = 0; i < parser->active_dtcs_count; ++i) {
+        index_set(parser, parser->active_keys[i], ACTIVE_REF(i));
+    }
+}
+
+static uint32_t scale_ticks(uint32_t value, uint32_t num, uint32_t den) {
+    // 'value * num / den' in 64 bits, saturated to the largest 32-bit time instead of wrapping to a short one
+    uint64_t ticks = (uint64_t)value * num / den;
+    return (ticks > UINT32_MAX) ? UINT32_MAX : (uint32_t)ticks;
+}
+
+static inline uint32_t dtc_deadline(DtcParser_t* parser, const DTC_Info_t* f, bool is_active) {
+    // First timestamp where the DTC is expired: 'timestamp - base > time' (wrap-safe)
+    if (is_active) return f->last_seen + parser->dtcParseCfg.debounce_dtc_inactive_time + 1;
+    return f->first_seen + parser->dtcParseCfg.dtc_active_time_window + 1;
+}
+
+static inline bool timer_before(const DtcTimer_t* a, const DtcTimer_t* b) {
+    return (int32_t)(a->deadline - b->deadline) < 0;
+}
+
+static void timer_heap_sift_down(DtcParser_t* parser, DtcTimer_t t) {
+    // Places 't' at the root and sifts it down, replacing the root timer
+    DtcTimer_t* heap = parser->timer_heap;
+    size_t n = parser->timer_heap_count;
+    size_t i = 0;
+    while (true) {
+        size_t child = 2 * i + 1;
+        if (child >= n) break;
+        if (child + 1 < n && timer_before(&heap[child + 1], &heap[child])) child++;
+        if (!timer_before(&heap[child], &t)) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = t;
+}
+
+static void timer_heap_pop(DtcParser_t* parser) {
+    DtcTimer_t last = parser->timer_heap[--parser->timer_heap_count];
+    if (parser->timer_heap_count > 0) timer_heap_sift_down(parser, last);
+}
 
-            // Shift remaining DTCs
-            for (size_t j = i; j < active_dtcs_count - 1; ++j) {
-                active_dtcs[j] = active_dtcs[j + 1];
+static void timer_heap_rearm_top(DtcParser_t* parser, uint16_t ref, uint32_t deadline) {
+    // One sift-down instead of a pop and a push
+    DtcTimer_t t = parser->timer_heap[0];
+    t.ref = ref;
+    t.deadline = deadline;
+    timer_heap_sift_down(parser, t);
+}
+
+static void timer_heap_push(DtcParser_t* parser, uint32_t key, uint16_t ref, uint8_t kind, uint32_t deadline) {
+    if (parser->timer_heap_count >= parser->timer_heap_size) {
+        // Only stale timers of removed DTCs can fill the heap, rebuilding it drops them (and arms the new DTC or session).
+        rebuild_timer_heap(parser);
+        return;
+    }
+
+    // Sift up the new timer
+    DtcTimer_t* heap = parser->timer_heap;
+    DtcTimer_t t = { .deadline = deadline, .key = key, .ref = ref, .kind = kind };
+    size_t i = parser->timer_heap_count++;
+    while (i > 0) {
+        size_t up = (i - 1) / 2;
+        if (!timer_before(&t, &heap[up])) break;
+        heap[i] = heap[up];
+        i = up;
+    }
+    heap[i] = t;
+}
+
+static void rebuild_timer_heap(DtcParser_t* parser) {
+    parser->timer_heap_count = 0;
+    parser->timer_rebuild_pending = false;
+    memset(parser->session_timer_map, 0, sizeof(parser->session_timer_map));
+    if (!(parser->options & DTC_OPT_TIMER_HEAP)) return;
+    for (size_t i = 0; i < parser->candidate_dtcs_count; ++i) {
+        timer_heap_push(parser, parser->candidate_keys[i], CANDIDATE_REF(i), DTC_TIMER_CANDIDATE, dtc_deadline(parser, &parser->candidate_dtcs[i], false));
+    }
+    for (size_t i = 0; i < parser->active_dtcs_count; ++i) {
+        timer_heap_push(parser, parser->active_keys[i], ACTIVE_REF(i), DTC_TIMER_ACTIVE, dtc_deadline(parser, &parser->active_dtcs[i], true));
+    }
+    for (size_t i = 0; i < parser->max_multi_frame; ++i) {
+        if (parser->multi_frame_messages[i].message_id) arm_session_timer(parser, i);
+    }
+}
+
+static uint16_t timer_dtc_ref(DtcParser_t* parser, const DtcTimer_t* timer) {
+    // The position the DTC had when armed is usually still right, the index is probed only if it moved
+    size_t i = (timer->ref & ~DTC_INDEX_ACTIVE_FLAG) - 1;
+    if (timer->kind == DTC_TIMER_ACTIVE) {
+        if (i < parser->active_dtcs_count && parser->active_keys[i] == timer->key) return timer->ref;
+    } else {
+        if (i < parser->candidate_dtcs_count && parser->candidate_keys[i] == timer->key) return timer->ref;
+    }
+    return index_find(parser, timer->key);
+}
+
+static void arm_session_timer(DtcParser_t* parser, size_t slot) {
+    // A slot keeps at most one timer: the one left by an earlier session of the slot fires early and is re-armed
+    if ((parser->session_timer_map[slot >> 5] >> (slot & 31)) & 1) return;
+    parser->session_timer_map[slot >> 5] |= 1u << (slot & 31);
+    timer_heap_push(parser, (uint32_t)slot, DTC_INDEX_EMPTY, DTC_TIMER_SESSION,
+        parser->multi_frame_messages[slot].last_seen + parser->dtcParseCfg.timeout_multi_frame + 1);
+}
+
+static void expire_session_timer(DtcParser_t* parser, size_t slot, uint32_t timestamp) {
+    // Called with the timer of the slot at the root of the heap
+    MultiFrameMessage* message = &parser->multi_frame_messages[slot];
+    if (message->message_id && (timestamp - message->last_seen) <= parser->dtcParseCfg.timeout_multi_frame) {
+        // Packets arrived since it was armed, the timer follows the last one
+        timer_heap_rearm_top(parser, DTC_INDEX_EMPTY, message->last_seen + parser->dtcParseCfg.timeout_multi_frame + 1);
+        return;
+    }
+    timer_heap_pop(parser);
+    parser->session_timer_map[slot >> 5] &= ~(1u << (slot & 31));
+    if (message->message_id) {
+        DTC_TRACE(parser, DTC_TRACE_WARNINGS, DTC_TRACE_EV_TP_TIMEOUT, timestamp, message->last_seen - message->first_seen,
+            message->message_id, message->pgn, message->last_seen);
+        DTC_STAT_INC(parser, tp_sessions_aborted_timeout);
+        free_multi_frame_slot(parser, message);
+    }
+}
+
+static void remove_candidate_dtc_at(DtcParser_t* parser, size_t i) {
+    DTC_SRC_COUNT_DEC(parser, candidate_count_by_src, parser->candidate_dtcs[i].dtc.src);
+    if (parser->options & DTC_OPT_HASH_INDEX) {
+        // When promoted the index already points to the active list, the slot no longer holds this candidate
+        uint32_t slot = parser->candidate_index_slots[i];
+        if (parser->index_refs[slot] == CANDIDATE_REF(i)) index_remove_slot(parser, slot);
+    }
+
+    size_t last = parser->candidate_dtcs_count - 1;
+    if (parser->options & DTC_OPT_SWAP_REMOVE) {
+        // Move the last DTC into the hole, O(1) but the list order changes
+        if (i != last) {
+            parser->candidate_dtcs[i] = parser->candidate_dtcs[last];
+            parser->candidate_keys[i] = parser->candidate_keys[last];
+            if (parser->options & DTC_OPT_HASH_INDEX) index_move(parser, parser->candidate_index_slots[last], CANDIDATE_REF(i));
+        }
+    } else {
+        // Shift remaining DTCs
+        for (size_t j = i; j < last; ++j) {
+            parser->candidate_dtcs[j] = parser->candidate_dtcs[j + 1];
+            parser->candidate_keys[j] = parser->candidate_keys[j + 1];
+            if (parser->options & DTC_OPT_HASH_INDEX) index_move(parser, parser->candidate_index_slots[j + 1], CANDIDATE_REF(j));
+        }
+    }
+    --parser->candidate_dtcs_count;
+}
+
+static void push_dtc_event(DtcParser_t* parser, DtcEventType_t type, const DTC_t* dtc, uint32_t timestamp) {
+    if (!(parser->options & DTC_OPT_EVENT_RING)) return;
+
+    // Single producer: events are only pushed while holding the mutex
+    uint32_t head = dtc_atomic_load_relaxed(&parser->event_ring_head);
+    uint32_t tail = dtc_atomic_load_acquire(&parser->event_ring_tail);
+    if ((head - tail) >= DTC_EVENT_RING_SIZE) {
+        dtc_atomic_fetch_add_relaxed(&parser->event_ring_overflows, 1);
+        return;
+    }
+
+    DtcEvent_t* event = &parser->event_ring[head & (DTC_EVENT_RING_SIZE - 1)];
+    event->type = (uint8_t)type;
+    event->dtc = *dtc;
+    event->timestamp = timestamp;
+    dtc_atomic_store_release(&parser->event_ring_head, head + 1);
+}
+
+static void begin_active_dtcs_write(DtcParser_t* parser) {
+    #if DTC_PARSER_USE_SEQLOCK
+    // Odd sequence tells the readers a write is in progress, the fence keeps the list writes after it
+    dtc_atomic_store_relaxed(&parser->active_dtcs_seq, dtc_atomic_load_relaxed(&parser->active_dtcs_seq) + 1);
+    dtc_atomic_fence_release();
+    #else
+    (void)parser;
+    #endif
+}
+
+static void end_active_dtcs_write(DtcParser_t* parser) {
+    #if DTC_PARSER_USE_SEQLOCK
+    dtc_atomic_store_release(&parser->active_dtcs_seq, dtc_atomic_load_relaxed(&parser->active_dtcs_seq) + 1);
+    #else
+    (void)parser;
+    #endif
+}
+
+static bool publish_dtc_snapshot(DtcParser_t* parser) {
+    // Only the mutex holder publishes, so the generation is not modified concurrently
+    uint32_t generation = dtc_atomic_load_relaxed(&parser->snapshot_generation);
+    uint32_t spare = (generation + 1) & 1;
+
+    // A reader still holds the old snapshot, try again on the next 'check_dtcs'
+    if (dtc_atomic_load(&parser->snapshot_readers[spare]) != 0) {
+        parser->snapshot_pending = true;
+        return false;
+    }
+
+    memcpy((void*)parser->snapshot_dtcs[spare], (void*)parser->active_dtcs, parser->active_dtcs_count * sizeof(DTC_Info_t));
+    parser->snapshot_dtcs_count[spare] = parser->active_dtcs_count;
+    dtc_atomic_store(&parser->snapshot_generation, generation + 1);
+    parser->snapshot_pending = false;
+    return true;
+}
+
+static uint64_t active_list_signature(const DtcParser_t* parser) {
+    // Order independent: sum of a 64-bit mix of each key with its MIL/RSL lamps
+    uint64_t signature = 0;
+    for (size_t i = 0; i < parser->active_dtcs_count; ++i) {
+        const DTC_t* d = &parser->active_dtcs[i].dtc;
+        uint64_t x = parser->active_keys[i] | ((uint64_t)((d->mil << 2) | d->rsl) << 32);
+        x *= 0x9E3779B97F4A7C15ull;
+        x ^= x >> 31;
+        signature += x * 0xBF58476D1CE4E5B9ull;
+    }
+    return signature;
+}
+
+/**
+ * @brief Marks the pending change as notified, returns false if it is coalesced away
+ */
+static bool take_notification(DtcParser_t* parser, uint32_t timestamp) {
+    parser->notify_pending = false;
+    parser->notify_urgent = false;
+    if (parser->notify_min_interval > 0) {
+        // Changes undone within the interval (e.g. a DTC added then removed) leave the list as last notified
+        uint64_t signature = active_list_signature(parser);
+        if (parser->notified && signature == parser->notified_signature) {
+            DTC_STAT_INC(parser, notifications_coalesced);
+            return false;
+        }
+        parser->notified_signature = signature;
+    }
+    parser->notified = true;
+    parser->last_notify = timestamp;
+    DTC_STAT_INC(parser, notifications);
+    return true;
+}
+
+// Lists are compacted in a single pass keeping their order, so expiring k DTCs costs O(n) in total.
+// The entries before 'first' are known not to be expired and are not visited.
+static void remove_expired_candidate_dtcs(DtcParser_t* parser, uint32_t timestamp, size_t first) {
+    size_t kept = first;
+    for (size_t i = first; i < parser->candidate_dtcs_count; ++i) {
+        DTC_Info_t* f = &parser->candidate_dtcs[i];
+        if ((timestamp - f->first_seen) > parser->dtcParseCfg.dtc_active_time_window) {
+            if (parser->options & DTC_OPT_HASH_INDEX) index_remove_slot(parser, parser->candidate_index_slots[i]);
+            DTC_SRC_COUNT_DEC(parser, candidate_count_by_src, f->dtc.src);
+            continue;
+        }
+        if (kept != i) {
+            parser->candidate_dtcs[kept] = *f;
+            parser->candidate_keys[kept] = parser->candidate_keys[i];
+            if (parser->options & DTC_OPT_HASH_INDEX) index_move(parser, parser->candidate_index_slots[i], CANDIDATE_REF(kept));
+        }
+        kept++;
+    }
+    parser->candidate_dtcs_count = kept;
+}
+
+static void remove_expired_active_dtcs(DtcParser_t* parser, uint32_t timestamp, size_t first) {
+    size_t kept = first;
+    for (size_t i = first; i < parser->active_dtcs_count; ++i) {
+        DTC_Info_t* f = &parser->active_dtcs[i];
+        if ((timestamp - f->last_seen) > parser->dtcParseCfg.debounce_dtc_inactive_time) {
+            DTC_TRACE(parser, DTC_TRACE_NEW_AND_REMOVED_DTC, DTC_TRACE_EV_REMOVED_DTC, timestamp, f->dtc.src, f->dtc.spn, f->dtc.fmi, f->last_seen);
+
+            if (parser->options & DTC_OPT_HASH_INDEX) index_remove_slot(parser, parser->active_index_slots[i]);
+            push_dtc_event(parser, DTC_EVENT_REMOVED, &f->dtc, timestamp);
+            DTC_SRC_COUNT_DEC(parser, active_count_by_src, f->dtc.src);
+            parser->changed_dtc_list = true;
+            continue;
+        }
+        if (kept != i) {
+            parser->active_dtcs[kept] = *f;
+            parser->active_keys[kept] = parser->active_keys[i];
+            if (parser->options & DTC_OPT_HASH_INDEX) index_move(parser, parser->active_index_slots[i], ACTIVE_REF(kept));
+        }
+        kept++;
+    }
+    if (kept != parser->active_dtcs_count) parser->active_layout_generation++;
+    parser->active_dtcs_count = kept;
+}
+
+static void remove_inactive_dtcs(DtcParser_t* parser, uint32_t timestamp) {
+    if (!(parser->options & DTC_OPT_TIMER_HEAP)) {
+        // Reference implementation: check every DTC on each call
+        remove_expired_candidate_dtcs(parser, timestamp, 0);
+        remove_expired_active_dtcs(parser, timestamp, 0);
+        return;
+    }
+
+    if (parser->timer_rebuild_pending) rebuild_timer_heap(parser);
+
+    // Only the timers whose deadline has passed are visited. Deadlines are lazy: refreshing 'last_seen'
+    // doesn't touch the heap, the timer is re-armed with the real deadline when it fires too early.
+    // Expired DTCs stay in place until the loop ends, then each list is compacted once from the first
+    // of them (swap-remove of the candidates with DTC_OPT_SWAP_REMOVE).
+    size_t first_expired_candidate = parser->candidate_dtcs_count;
+    size_t first_expired_active = parser->active_dtcs_count;
+    while (parser->timer_heap_count > 0 && (int32_t)(timestamp - parser->timer_heap[0].deadline) >= 0) {
+        const DtcTimer_t* timer = &parser->timer_heap[0];
+        if (timer->kind == DTC_TIMER_SESSION) {
+            expire_session_timer(parser, timer->key, timestamp);
+            continue;
+        }
+        uint16_t ref = timer_dtc_ref(parser, timer);
+        bool is_active = (ref & DTC_INDEX_ACTIVE_FLAG) != 0;
+        if (ref == DTC_INDEX_EMPTY || (timer->kind == DTC_TIMER_ACTIVE) != is_active) {
+            // DTC already removed (e.g. promoted with the active list full), or timer of the list the DTC was
+            // in before: the current list has its own timer
+            timer_heap_pop(parser);
+            continue;
+        }
+
+        // A DTC still seen is re-armed in place to its real deadline
+        size_t i = (ref & ~DTC_INDEX_ACTIVE_FLAG) - 1;
+        if (is_active) {
+            if ((timestamp - parser->active_dtcs[i].last_seen) > parser->dtcParseCfg.debounce_dtc_inactive_time) {
+                timer_heap_pop(parser);
+                if (i < first_expired_active) first_expired_active = i;
+            } else {
+                timer_heap_rearm_top(parser, ref, dtc_deadline(parser, &parser->active_dtcs[i], true));
+            }
+        } else {
+            if ((timestamp - parser->candidate_dtcs[i].first_seen) > parser->dtcParseCfg.dtc_active_time_window) {
+                timer_heap_pop(parser);
+                if (parser->options & DTC_OPT_SWAP_REMOVE) {
+                    remove_candidate_dtc_at(parser, i);
+                } else if (i < first_expired_candidate) {
+                    first_expired_candidate = i;
+                }
+            } else {
+                timer_heap_rearm_top(parser, ref, dtc_deadline(parser, &parser->candidate_dtcs[i], false));
             }
-            --active_dtcs_count;
-            --i; // recheck the current index
-            changed_dtc_list = true;
         }
     }
+
+    // Every DTC has a timer no later than its real deadline, so the passes find the same DTCs expired
+    if (first_expired_candidate < parser->candidate_dtcs_count) remove_expired_candidate_dtcs(parser, timestamp, first_expired_candidate);
+    if (first_expired_active < parser->active_dtcs_count) remove_expired_active_dtcs(parser, timestamp, first_expired_active);
 }
 
-static void add_candidate_dtc(DTC_Info_t DTC_Info) {
-    if (candidate_dtcs_count < MAX_CANDIDATE_DTCS) {
-        candidate_dtcs[candidate_dtcs_count++] = DTC_Info;
+static bool source_quota_reached(DtcParser_t* parser, uint8_t src, bool is_active, uint32_t timestamp) {
+    #if DTC_PARSER_USE_SOURCE_QUOTA
+    size_t quota = is_active ? parser->max_active_per_src : parser->max_candidate_per_src;
+    size_t count = is_active ? parser->active_count_by_src[src] : parser->candidate_count_by_src[src];
+    if (quota == 0 || count < quota) return false;
+
+    if (is_active) {
+        DTC_STAT_INC(parser, active_quota_overflows);
     } else {
-        #if PRINT_WARNINGS
-        printf("WARNING: Cannot exceed MAX_CANDIDATE_DTCS: %u\n", MAX_CANDIDATE_DTCS);
-        #endif
+        DTC_STAT_INC(parser, candidate_quota_overflows);
     }
+    DTC_TRACE(parser, DTC_TRACE_WARNINGS, DTC_TRACE_EV_SOURCE_QUOTA, timestamp, src, quota, is_active, 0);
+    (void)timestamp; // Only used by the trace
+    return true;
+    #else
+    (void)parser;
+    (void)src;
+    (void)is_active;
+    (void)timestamp;
+    return false;
+    #endif
 }
 
-static void add_active_dtc(DTC_Info_t f) {
-    if (active_dtcs_count < MAX_ACTIVE_DTCS) {
-        active_dtcs[active_dtcs_count++] = f;
-        changed_dtc_list = true;
+static void add_candidate_dtc(DtcParser_t* parser, DTC_Info_t DTC_Info) {
+    if (source_quota_reached(parser, DTC_Info.dtc.src, false, DTC_Info.last_seen)) return;
+    if (parser->candidate_dtcs_count < parser->max_candidate_dtcs) {
+        uint32_t key = dtc_info_key(&DTC_Info);
+        DTC_SRC_COUNT_INC(parser, candidate_count_by_src, DTC_Info.dtc.src);
+        if (parser->options & DTC_OPT_HASH_INDEX) index_set(parser, key, CANDIDATE_REF(parser->candidate_dtcs_count));
+        parser->candidate_keys[parser->candidate_dtcs_count] = key;
+        parser->candidate_dtcs[parser->candidate_dtcs_count++] = DTC_Info;
+        DTC_STAT_PEAK(parser, candidate_peak, parser->candidate_dtcs_count);
+        if (parser->options & DTC_OPT_TIMER_HEAP) timer_heap_push(parser, key, CANDIDATE_REF(parser->candidate_dtcs_count - 1), DTC_TIMER_CANDIDATE, dtc_deadline(parser, &DTC_Info, false));
+    } else {
+        DTC_STAT_INC(parser, candidate_overflows);
+        DTC_TRACE(parser, DTC_TRACE_WARNINGS, DTC_TRACE_EV_MAX_CANDIDATE, DTC_Info.last_seen, 0, parser->max_candidate_dtcs, 0, 0);
+    }
+}
 
-        #if PRINT_NEW_AND_REMOVED_DTC
-        printf("[%u] New DTC -> SRC: 0x%02X (%u), SPN: 0x%X (%u), FMI: %u\n",
-            f.last_seen, f.dtc.src, f.dtc.src, f.dtc.spn, f.dtc.spn, f.dtc.fmi);
-        #endif
+static void add_active_dtc(DtcParser_t* parser, DTC_Info_t f) {
+    if (source_quota_reached(parser, f.dtc.src, true, f.last_seen)) return;
+    if (parser->active_dtcs_count < parser->max_active_dtcs) {
+        uint32_t key = dtc_info_key(&f);
+        DTC_SRC_COUNT_INC(parser, active_count_by_src, f.dtc.src);
+        if (parser->options & DTC_OPT_HASH_INDEX) index_set(parser, key, ACTIVE_REF(parser->active_dtcs_count));
+        parser->active_keys[parser->active_dtcs_count] = key;
+        parser->active_dtcs[parser->active_dtcs_count++] = f;
+        DTC_STAT_PEAK(parser, active_peak, parser->active_dtcs_count);
+        if (parser->options & DTC_OPT_TIMER_HEAP) timer_heap_push(parser, key, ACTIVE_REF(parser->active_dtcs_count - 1), DTC_TIMER_ACTIVE, dtc_deadline(parser, &f, true));
+        push_dtc_event(parser, DTC_EVENT_ADDED, &f.dtc, f.last_seen);
+        parser->changed_dtc_list = true;
+        if ((parser->notify_flags & DTC_NOTIFY_LAMP_BYPASS) && (f.dtc.mil == 1 || f.dtc.rsl == 1)) parser->notify_urgent = true;
+
+        DTC_TRACE(parser, DTC_TRACE_NEW_AND_REMOVED_DTC, DTC_TRACE_EV_NEW_DTC, f.last_seen, f.dtc.src, f.dtc.spn, f.dtc.fmi, 0);
     } else {
-        #if PRINT_WARNINGS
-        printf("WARNING: Cannot exceed MAX_ACTIVE_DTCS: %u", MAX_ACTIVE_DTCS);
-        #endif
+        DTC_STAT_INC(parser, active_overflows);
+        DTC_TRACE(parser, DTC_TRACE_WARNINGS, DTC_TRACE_EV_MAX_ACTIVE, f.last_seen, 0, parser->max_active_dtcs, 0, 0);
     }
 }
 
-static DTC_Info_t* find_dtc(DTC_Info_t* list, size_t count, uint32_t src, uint32_t spn, uint32_t fmi) {
-    for (size_t i = 0; i < count; ++i) {
-        if (list[i].dtc.src == src && list[i].dtc.spn == spn && list[i].dtc.fmi == fmi) {
-            return &list[i];
-        }
+static DTC_Info_t* find_dtc(DtcParser_t* parser, uint32_t src, uint32_t spn, uint32_t fmi, bool* is_active) {
+    uint32_t key = dtc_key(src, spn, fmi);
+    if (parser->options & DTC_OPT_HASH_INDEX) {
+        uint16_t ref = index_find(parser, key);
+        if (ref == DTC_INDEX_EMPTY) return NULL;
+        *is_active = (ref & DTC_INDEX_ACTIVE_FLAG) != 0;
+        size_t i = (ref & ~DTC_INDEX_ACTIVE_FLAG) - 1;
+        return *is_active ? &parser->active_dtcs[i] : &parser->candidate_dtcs[i];
+    }
+
+    // Without the index the key columns are scanned, one aligned compare per DTC instead of the packed bitfields
+    size_t i = find_dtc_key(parser->active_keys, parser->active_dtcs_count, key);
+    if (i < parser->active_dtcs_count) {
+        *is_active = true;
+        return &parser->active_dtcs[i];
+    }
+    i = find_dtc_key(parser->candidate_keys, parser->candidate_dtcs_count, key);
+    if (i < parser->candidate_dtcs_count) {
+        *is_active = false;
+        return &parser->candidate_dtcs[i];
     }
     return NULL;
 }
 
-static void update_dtc_status(uint32_t timestamp, uint8_t src, uint32_t spn, uint8_t fmi, uint8_t cm, uint8_t oc, uint8_t mil, uint8_t rsl, uint8_t awl, uint8_t pl) {
-    DTC_Info_t* existing_dtc = find_dtc(active_dtcs, active_dtcs_count, src, spn, fmi);
-    if (existing_dtc) {
+static size_t find_dtc_key(const uint32_t* keys, size_t count, uint32_t key) {
+    size_t i = 0;
+#if DTC_FILTER_AVX2 || DTC_FILTER_SSE2
+    const __m128i k = _mm_set1_epi32((int)key);
+    for (; i + 4 <= count; i += 4) {
+        __m128i hit = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)&keys[i]), k);
+        uint32_t bits = (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(hit));
+        if (bits) return i + lowest_bit_index(bits);
+    }
+#elif DTC_FILTER_NEON
+    const uint32x4_t k = vdupq_n_u32(key);
+    const uint32x4_t lane_bits = { 1, 2, 4, 8 };
+    for (; i + 4 <= count; i += 4) {
+        uint32_t bits = vaddvq_u32(vandq_u32(vceqq_u32(vld1q_u32(&keys[i]), k), lane_bits));
+        if (bits) return i + lowest_bit_index(bits);
+    }
+#endif
+
+    // Scalar fallback and tail of the vectorized loops, keys are unique in a list
+    for (; i < count; i++) {
+        if (keys[i] == key) return i;
+    }
+    return count;
+}
+
+/**
+ * @brief Applies a DTC of a DM1, returns its entry when it is active afterwards (NULL if candidate or dropped)
+ */
+static DTC_Info_t* update_dtc_status(DtcParser_t* parser, uint32_t timestamp, uint8_t src, uint32_t spn, uint8_t fmi, uint8_t cm, uint8_t oc, uint8_t mil, uint8_t rsl, uint8_t awl, uint8_t pl) {
+    bool is_active = false;
+    DTC_Info_t* existing_dtc = find_dtc(parser, src, spn, fmi, &is_active);
+    DTC_Info_t* candidate = NULL; // Candidate updated or added by this call
+    if (existing_dtc && is_active) {
         // Update if exist on Active list already
+        bool changed = existing_dtc->dtc.oc != oc || existing_dtc->dtc.mil != mil || existing_dtc->dtc.rsl != rsl ||
+                       existing_dtc->dtc.awl != awl || existing_dtc->dtc.pl != pl;
+        if ((parser->notify_flags & DTC_NOTIFY_LAMP_BYPASS) && (existing_dtc->dtc.mil != mil || existing_dtc->dtc.rsl != rsl)) {
+            // Lamp changes are reported like list changes, ahead of the notify interval
+            parser->changed_dtc_list = true;
+            parser->notify_urgent = true;
+        }
         existing_dtc->dtc.oc = oc;
         existing_dtc->dtc.mil = mil;
         existing_dtc->dtc.rsl = rsl;
         existing_dtc->dtc.awl = awl;
         existing_dtc->dtc.pl = pl;
         existing_dtc->last_seen = timestamp;
+        if (changed) {
+            // Republished by the next 'check_dtcs' so the snapshot readers see the new OC and lamps, not a list change
+            parser->snapshot_pending = true;
+            push_dtc_event(parser, DTC_EVENT_CHANGED, &existing_dtc->dtc, timestamp);
+        }
+        return existing_dtc;
     } else {
-        existing_dtc = find_dtc(candidate_dtcs, candidate_dtcs_count, src, spn, fmi);
         if (existing_dtc) {
             // Update if exist on Candidate list already
             existing_dtc->dtc.oc = oc;
@@ -161,6 +738,7 @@ static void update_dtc_status(uint32_t timestamp, uint8_t src, uint32_t spn, uin
             existing_dtc->dtc.pl = pl;
             existing_dtc->read_count += 1;
             existing_dtc->last_seen = timestamp;
+            candidate = existing_dtc;
         } else {
             // Add new candidate DTC to the DTC list
             DTC_Info_t new_dtc_info = {
@@ -177,258 +755,810 @@ static void update_dtc_status(uint32_t timestamp, uint8_t src, uint32_t spn, uin
                 .last_seen = timestamp, 
                 .read_count = 1
             };    
-            add_candidate_dtc(new_dtc_info);
+            size_t count = parser->candidate_dtcs_count;
+            add_candidate_dtc(parser, new_dtc_info);
+            if (parser->candidate_dtcs_count > count) candidate = &parser->candidate_dtcs[count];
         }
     }
     
-    // Promote candidate DTCs to active if they meet the criteria
-    for (size_t i = 0; i < candidate_dtcs_count; ++i) {
-        if ((timestamp - candidate_dtcs[i].first_seen <= dtcParseCfg.dtc_active_time_window) && //Check if is within the window time to become active
-            (candidate_dtcs[i].read_count >= dtcParseCfg.dtc_active_read_count)) { // Check if has the minimum amount of read_count
-            add_active_dtc(candidate_dtcs[i]);
-            // Remove from candidates
-            for (size_t j = i; j < candidate_dtcs_count - 1; ++j) {
-                candidate_dtcs[j] = candidate_dtcs[j + 1];
-            }
-            --candidate_dtcs_count;
-            --i; // recheck the current index
-        }
+    // Promote the candidate to active if it meets the criteria, no other candidate changed
+    if (candidate &&
+        (timestamp - candidate->first_seen <= parser->dtcParseCfg.dtc_active_time_window) && //Check if is within the window time to become active
+        (candidate->read_count >= parser->dtcParseCfg.dtc_active_read_count)) { // Check if has the minimum amount of read_count
+        // Copy it to the active list, then remove the candidate (its index entry is only deleted if the copy failed)
+        size_t count = parser->active_dtcs_count;
+        add_active_dtc(parser, *candidate);
+        remove_candidate_dtc_at(parser, (size_t)(candidate - parser->candidate_dtcs));
+        if (parser->active_dtcs_count > count) return &parser->active_dtcs[count];
     }
+    return NULL;
 }
 
-static void process_dm1_message(uint32_t can_id, uint8_t* data, uint32_t length, uint32_t timestamp) {
+static void process_dm1_message(DtcParser_t* parser, uint32_t can_id, const uint8_t* data, uint32_t length, uint32_t timestamp) {
     if(length < 6) return;
 
     uint32_t spn = (((data[4] >> 5) & 0x7) << 16) | ((data[3] << 8) & 0xFF00) | data[2];
     if(spn == 0) return;
 
     uint8_t src = can_id & 0xFF;
-    uint8_t fmi;
-    uint8_t cm;
-    uint8_t oc;
-    uint8_t mil = (data[0] >> 6) & 0x03;
-    uint8_t rsl = (data[0] >> 4) & 0x03;
-    uint8_t awl = (data[0] >> 2) & 0x03;
-    uint8_t pl = data[0] & 0x03;
-
-    #if PRINT_DM1_PARSED
-    printf("[%u] DM1_PARSED -> SRC: 0x%02X (%u), MIL: %u, RSL: %u, AWL: %u, PL: %u\n",
-        timestamp, src, src, mil, rsl, awl, pl);
-    int f = 1;
-    #endif
 
+    if ((parser->options & DTC_OPT_DM1_REPEAT_CACHE) && apply_dm1_repeat(parser, src, data, length, timestamp)) return;
+
+    DTC_TRACE(parser, DTC_TRACE_DM1_PARSED, DTC_TRACE_EV_DM1_PARSED, timestamp, src, data[0], 0, 0);
+
+    // The payload is cached when all its DTCs are active afterwards, adding DTCs never moves the active ones
+    bool cacheable = (parser->options & DTC_OPT_DM1_REPEAT_CACHE) && length <= DTC_DM1_CACHE_BYTES;
+    uint16_t active_index[(DTC_DM1_CACHE_BYTES - 2) / 4];
+    uint8_t dtc_count = 0;
+
+    begin_active_dtcs_write(parser);
     for (uint32_t i = 2; i < (length-2); i += 4) {
-        spn = (((data[i + 2] >> 5) & 0x7) << 16) | ((data[i + 1] << 8) & 0xFF00) | data[i];
-        fmi = data[i + 2] & 0x1F;
-        cm = (data[i + 3] >> 7) & 0x01;
-        oc = data[i + 3] & 0x7F;
-
-        #if PRINT_DM1_PARSED
-        printf("        DTC[%u] -> SPN: 0x%X (%u), FMI: %u, CM: %u, OC: %u\n",
-            f, spn, spn, fmi, cm, oc);
-        f++;
-        #endif
+        DTC_Info_t* active = update_dm1_dtc(parser, timestamp, src, data[0], &data[i]);
+        if (cacheable) {
+            if (active) {
+                active_index[dtc_count++] = (uint16_t)(active - parser->active_dtcs);
+            } else {
+                cacheable = false;
+            }
+        }
+    }
+    end_active_dtcs_write(parser);
 
-        update_dtc_status(timestamp, src, spn, fmi, cm, oc, mil, rsl, awl, pl);
+    if (cacheable) {
+        Dm1RepeatCache_t* entry = claim_dm1_cache_entry(parser, src);
+        memcpy(entry->payload, data, length);
+        memcpy(entry->active_index, active_index, dtc_count * sizeof(uint16_t));
+        entry->length = (uint16_t)length;
+        entry->dtc_count = dtc_count;
+        entry->generation = parser->active_layout_generation;
+    } else {
+        drop_dm1_cache_entry(parser, src); // The previous payload of the source is no longer the last one
     }
 }
 
-static void handle_tp_cm_message(uint32_t can_id, uint8_t data[8], uint32_t timestamp) {
-    //uint32_t pgn = (data[7] << 16) | (data[6] << 8) | data[5];
-    //if (pgn != 0xFECA) return; //If it is not a DTC multiframe, return
+static bool apply_dm1_repeat(DtcParser_t* parser, uint8_t src, const uint8_t* data, uint32_t length, uint32_t timestamp) {
+    uint8_t ref = parser->dm1_cache_by_src[src];
+    if (ref == 0) return false;
+    Dm1RepeatCache_t* entry = &parser->dm1_cache[ref - 1];
+    if (entry->length != length || entry->generation != parser->active_layout_generation ||
+        memcmp(entry->payload, data, length) != 0) {
+        return false;
+    }
+    #if DTC_PARSER_USE_TRACE
+    if (parser->trace_mask & DTC_TRACE_DM1_PARSED) return false; // The trace records every parsed DTC
+    #endif
 
-    uint32_t message_id = can_id & 0x1FFFFFFF;
-    uint8_t control_byte = data[0];
+    // Same lamps and OC as already stored: the full path would only refresh last_seen
+    begin_active_dtcs_write(parser);
+    for (uint8_t i = 0; i < entry->dtc_count; i++) {
+        parser->active_dtcs[entry->active_index[i]].last_seen = timestamp;
+    }
+    end_active_dtcs_write(parser);
+    entry->last_use = ++parser->dm1_cache_clock;
+    DTC_STAT_INC(parser, dm1_repeats);
+    return true;
+}
 
-    if (control_byte == 0x20) { // BAM message
-        uint32_t total_size = (data[2] << 8) | data[1];
-        uint32_t num_packets = data[3];
+/**
+ * @brief Returns the repeat cache entry of a source, taking a free or the least recently used one if it has none
+ */
+static Dm1RepeatCache_t* claim_dm1_cache_entry(DtcParser_t* parser, uint8_t src) {
+    uint8_t ref = parser->dm1_cache_by_src[src];
+    if (ref == 0) {
+        // Ages are differences from the clock, so the choice stays right when it wraps
+        uint32_t oldest_age = 0;
+        for (uint8_t i = 0; i < DTC_DM1_CACHE_SIZE; i++) {
+            const Dm1RepeatCache_t* e = &parser->dm1_cache[i];
+            if (e->length == 0) {
+                ref = i + 1;
+                break;
+            }
+            if (ref == 0 || (parser->dm1_cache_clock - e->last_use) > oldest_age) {
+                ref = i + 1;
+                oldest_age = parser->dm1_cache_clock - e->last_use;
+            }
+        }
+        Dm1RepeatCache_t* victim = &parser->dm1_cache[ref - 1];
+        if (victim->length != 0) parser->dm1_cache_by_src[victim->src] = 0;
+        victim->src = src;
+        parser->dm1_cache_by_src[src] = ref;
+    }
+    Dm1RepeatCache_t* entry = &parser->dm1_cache[ref - 1];
+    entry->last_use = ++parser->dm1_cache_clock;
+    return entry;
+}
 
-        #if PRINT_TP_CM_FRAME
-        printf("[%u] TP_CM_FRAME -> ID: %08X, Data: %02X %02X %02X %02X %02X %02X %02X %02X\n",
-            timestamp,
-            can_id, 
-            data[0], data[1], data[2], data[3], data[4], data[5], data[6], data[7]);
-        #endif
-        #if PRINT_TP_CM_PARSED
-        printf("[%u] TP_CM_PARSED -> ID: %08X, Total Size: %u bytes, Number of Packets: %u\n",
-            timestamp, can_id, total_size, num_packets);
-        #endif
+static void drop_dm1_cache_entry(DtcParser_t* parser, uint8_t src) {
+    uint8_t ref = parser->dm1_cache_by_src[src];
+    if (ref == 0) return;
+    parser->dm1_cache[ref - 1].length = 0; // Free entry, taken first by the next store
+    parser->dm1_cache_by_src[src] = 0;
+}
 
-        if(total_size > MAX_MULTIFRAME_DATA_SIZE) {
-            #if PRINT_WARNINGS
-            printf("[%u] WARNING: Cannot exceed MAX_MULTIFRAME_DATA_SIZE: %u\n", timestamp, MAX_MULTIFRAME_DATA_SIZE);
-            #endif
-            return;
+static DTC_Info_t* update_dm1_dtc(DtcParser_t* parser, uint32_t timestamp, uint8_t src, uint8_t lamps, const uint8_t dtc[4]) {
+    uint32_t spn = (((dtc[2] >> 5) & 0x7) << 16) | ((dtc[1] << 8) & 0xFF00) | dtc[0];
+    uint8_t fmi = dtc[2] & 0x1F;
+    uint8_t cm = (dtc[3] >> 7) & 0x01;
+    uint8_t oc = dtc[3] & 0x7F;
+
+    DTC_TRACE(parser, DTC_TRACE_DM1_PARSED, DTC_TRACE_EV_DM1_DTC, timestamp, src, spn, fmi | (cm << 8) | (oc << 16), 0);
+
+    return update_dtc_status(parser, timestamp, src, spn, fmi, cm, oc, (lamps >> 6) & 0x03, (lamps >> 4) & 0x03, (lamps >> 2) & 0x03, lamps & 0x03);
+}
+
+static void stream_dm1_packet(DtcParser_t* parser, MultiFrameMessage* message, const uint8_t payload[7], uint32_t timestamp) {
+    // Same DTCs as 'process_dm1_message' over the reassembled message: 4 byte DTCs from offset 2 while offset < total_size - 2
+    uint32_t length = message->total_size;
+    uint32_t pos = message->received_packets * DTC_MULTIFRAME_CHUNK_SIZE; // Message offset of payload[0]
+    bool writing = false;
+
+    for (uint32_t j = 0; j < DTC_MULTIFRAME_CHUNK_SIZE && !message->stream_done; j++, pos++) {
+        if (pos == 0) {
+            message->stream_lamps = payload[j];
+            continue;
         }
+        if (pos < 2) continue;
 
-        int8_t k = -1; // Point to available slot
+        uint32_t k = (pos - 2) & 3;
+        message->stream_dtc[k] = payload[j];
+        if (k != 3) continue;
 
-        // "TP.CM" is the anouncement of a new multiframe BAM message, 
-        // therefore it should not exist on memory, but if it exists, we will overwrite the slot
-        for (int i = 0; i < MAX_CONCURRENT_MULTIFRAME; i++) {
-            if (multi_frame_messages[i].message_id == message_id) {
-                k = i;
-                break;
-            }
+        uint32_t i = pos - 3; // Message offset of the completed DTC
+        const uint8_t* dtc = message->stream_dtc;
+        if (length < 6 || i >= (length - 2) || (i == 2 && ((((dtc[2] >> 5) & 0x7) << 16) | (dtc[1] << 8) | dtc[0]) == 0)) {
+            message->stream_done = true; // Past the last DTC, or a DM1 without DTCs (first SPN 0)
+            break;
         }
-        // If it is not on memory, we search for one available slot
-        if(k == -1) {
-            for (int i = 0; i < MAX_CONCURRENT_MULTIFRAME; i++) {
-                if (multi_frame_messages[i].message_id == 0) {
-                    k = i;
-                    break;
-                }
-            }
+        if (!writing) {
+            // The streamed DTCs may change the OC and lamps of the cached payload of the source
+            drop_dm1_cache_entry(parser, message->src);
+            begin_active_dtcs_write(parser);
+            writing = true;
         }
+        update_dm1_dtc(parser, timestamp, message->src, message->stream_lamps, dtc);
+    }
+    if (writing) end_active_dtcs_write(parser);
+}
 
-        // Store on memory if slot available
-        if (k >= 0) {
-            multi_frame_messages[k].message_id = message_id;
-            multi_frame_messages[k].message_id_tp_dt = (message_id & 0xFF00FFFF) | 0x00EB0000; // TP.DT version of the TP.CM message
-            multi_frame_messages[k].total_size = total_size;
-            multi_frame_messages[k].num_packets = num_packets;
-            multi_frame_messages[k].received_packets = 0;
-            multi_frame_messages[k].first_seen = timestamp;
-            multi_frame_messages[k].last_seen = timestamp;
-            memset(multi_frame_messages[k].data, 0, MAX_MULTIFRAME_DATA_SIZE);
-        } else {
-            #if PRINT_WARNINGS
-            printf("[%u] WARNING: Cannot exceed MAX_CONCURRENT_MULTIFRAME: %u\n", timestamp, MAX_CONCURRENT_MULTIFRAME);
-            #endif
+static void handle_tp_cm_message(DtcParser_t* parser, uint32_t can_id, const uint8_t data[8], uint32_t timestamp) {
+    uint32_t pgn = (data[7] << 16) | (data[6] << 8) | data[5];
+    uint8_t control_byte = data[0];
+    uint8_t src = can_id & 0xFF;
+    uint8_t dst = (can_id >> 8) & 0xFF;
+
+    if (control_byte == TP_CM_BAM || control_byte == TP_CM_RTS) {
+        // "TP.CM" is the anouncement of a new multiframe message, only one session may be open
+        // per (source, destination), so a session still open on the pair is superseded
+        MultiFrameMessage* superseded = find_multi_frame_message(parser, src, dst);
+        if (superseded) {
+            DTC_STAT_INC(parser, tp_sessions_aborted_remote);
+            free_multi_frame_slot(parser, superseded);
         }
-    } else {
-        #if PRINT_WARNINGS
-        printf("[%u] WARNING: NOT BAM MESSAGE\n", timestamp);
-        #endif
+        if (pgn == DM1_PGN || (pgn == DM2_PGN && parser->tp_message_callback)) {
+            open_multi_frame_message(parser, can_id, data, timestamp);
+        }
+    } else if (control_byte == TP_CM_CTS) {
+        // Sent by the receiver of a connection mode session, we only listen: it keeps the session alive
+        MultiFrameMessage* message = find_multi_frame_message(parser, dst, src);
+        if (message && message->connection_mode && message->pgn == pgn) message->last_seen = timestamp;
+    } else if (control_byte == TP_CM_ABORT) {
+        // Sent by either side of a connection mode session
+        MultiFrameMessage* message = find_multi_frame_message(parser, src, dst);
+        if (!message || !message->connection_mode || message->pgn != pgn) message = find_multi_frame_message(parser, dst, src);
+        if (message && message->connection_mode && message->pgn == pgn) {
+            DTC_TRACE(parser, DTC_TRACE_WARNINGS, DTC_TRACE_EV_TP_ABORTED, timestamp, 0, message->message_id, data[1], 0);
+            DTC_STAT_INC(parser, tp_sessions_aborted_remote);
+            free_multi_frame_slot(parser, message);
+        }
+    }
+    // TP_CM_EOMA: the session was already closed with its last packet
+}
+
+static void open_multi_frame_message(DtcParser_t* parser, uint32_t can_id, const uint8_t data[8], uint32_t timestamp) {
+    uint32_t pgn = (data[7] << 16) | (data[6] << 8) | data[5];
+    uint32_t total_size = (data[2] << 8) | data[1];
+    uint32_t num_packets = data[3];
+    uint8_t src = can_id & 0xFF;
+
+    DTC_TRACE_FRAME(parser, DTC_TRACE_TP_CM_FRAME, DTC_TRACE_EV_TP_CM_FRAME, timestamp, can_id, data);
+    DTC_TRACE(parser, DTC_TRACE_TP_CM_PARSED, DTC_TRACE_EV_TP_CM_PARSED, timestamp, 0, can_id, pgn, total_size | (num_packets << 16));
+
+    bool streamed = (parser->options & DTC_OPT_STREAM_DM1) != 0 && pgn == DM1_PGN;
+    if(!streamed && total_size > parser->max_multi_frame_data_size) {
+        DTC_STAT_INC(parser, multi_frame_size_overflows);
+        DTC_TRACE(parser, DTC_TRACE_WARNINGS, DTC_TRACE_EV_MAX_DATA_SIZE, timestamp, 0, parser->max_multi_frame_data_size, total_size, 0);
+        return;
+    }
+    if (parser->multi_frame_free == 0) {
+        DTC_STAT_INC(parser, multi_frame_slot_overflows);
+        DTC_TRACE(parser, DTC_TRACE_WARNINGS, DTC_TRACE_EV_MAX_MULTI_FRAME, timestamp, 0, parser->max_multi_frame, 0, 0);
+        return;
+    }
+
+    // One chunk per announced packet, TP.DT writes 7 bytes per packet. Streamed sessions don't store the payload.
+    size_t chunk_count = streamed ? 0 : DTC_MULTIFRAME_CHUNKS_FOR(total_size);
+    if (!streamed && num_packets > chunk_count) chunk_count = num_packets;
+    uint16_t first_chunk = 0;
+    if (!alloc_multi_frame_chunks(parser, chunk_count, &first_chunk)) {
+        DTC_STAT_INC(parser, multi_frame_pool_overflows);
+        DTC_TRACE(parser, DTC_TRACE_WARNINGS, DTC_TRACE_EV_POOL_EXHAUSTED, timestamp, 0, chunk_count, 0, 0);
+        return;
+    }
+
+    // Take the first free slot and link it as the first session of its source
+    uint8_t ref = parser->multi_frame_free;
+    MultiFrameMessage* message = &parser->multi_frame_messages[ref - 1];
+    parser->multi_frame_free = message->next_session;
+    message->next_session = parser->session_by_src[src];
+    parser->session_by_src[src] = ref;
+    parser->multi_frame_count++;
+    DTC_STAT_INC(parser, tp_sessions_started);
+    DTC_STAT_PEAK(parser, multi_frame_peak, parser->multi_frame_count);
+
+    message->message_id = can_id & 0x1FFFFFFF;
+    message->pgn = pgn;
+    message->src = src;
+    message->dst = (can_id >> 8) & 0xFF;
+    message->connection_mode = data[0] == TP_CM_RTS;
+    message->total_size = total_size;
+    message->num_packets = num_packets;
+    message->received_packets = 0;
+    message->first_seen = timestamp;
+    message->last_seen = timestamp;
+    message->first_chunk = first_chunk;
+    message->chunk_count = (uint16_t)chunk_count;
+    message->streamed = streamed;
+    message->data = streamed ? NULL : &parser->multi_frame_pool[first_chunk * DTC_MULTIFRAME_CHUNK_SIZE];
+    // The packets overwrite the payload, only the bytes no packet carries are cleared
+    if (!streamed && num_packets * DTC_MULTIFRAME_CHUNK_SIZE < total_size) {
+        memset(&message->data[num_packets * DTC_MULTIFRAME_CHUNK_SIZE], 0, total_size - num_packets * DTC_MULTIFRAME_CHUNK_SIZE);
     }
+    if (parser->options & DTC_OPT_TIMER_HEAP) arm_session_timer(parser, ref - 1);
 }
 
-static void handle_tp_dt_message(uint32_t can_id, uint8_t data[8], uint32_t timestamp) {
-    uint32_t message_id = can_id & 0x1FFFFFFF;
-    MultiFrameMessage* message = find_multi_frame_message(message_id);
+static void handle_tp_dt_message(DtcParser_t* parser, uint32_t can_id, const uint8_t data[8], uint32_t timestamp) {
+    MultiFrameMessage* message = find_multi_frame_message(parser, can_id & 0xFF, (can_id >> 8) & 0xFF);
 
     if (message) {
         uint8_t packet_number = data[0];
-        
-        #if PRINT_TP_DT_FRAME
-        printf("[%u] TP_DT_FRAME -> ID: %08X, Data: %02X %02X %02X %02X %02X %02X %02X %02X\n",
-            timestamp,
-            can_id, 
-            data[0], data[1], data[2], data[3], data[4], data[5], data[6], data[7]);
-        #endif
-        #if PRINT_TP_DT_PARSED
-        printf("[%u] TP_DT_PARSED -> ID: %08X, Packet Number: %u of %u, Data: %02X %02X %02X %02X %02X %02X %02X %02X\n",
-            timestamp, can_id, packet_number, message->num_packets, data[0], data[1], data[2], data[3], data[4], data[5], data[6], data[7]);
-        #endif
 
-        if(packet_number != (message->received_packets + 1)) {
-            #if PRINT_TP_DT_INCORRECT_ORDER
-            printf("[%u] Packet Order is Incorrect, ID: %08X, Received: %u, Expected: %u\n", 
-                timestamp, message_id, packet_number, message->received_packets + 1);
-            #endif
-            remove_multi_frame_message(message_id);
+        DTC_TRACE_FRAME(parser, DTC_TRACE_TP_DT_FRAME, DTC_TRACE_EV_TP_DT_FRAME, timestamp, can_id, data);
+        DTC_TRACE(parser, DTC_TRACE_TP_DT_PARSED, DTC_TRACE_EV_TP_DT_PARSED, timestamp, 0, can_id, packet_number, message->num_packets);
+
+        if (message->connection_mode && packet_number >= 1 && packet_number <= message->received_packets) {
+            // Retransmission requested by a CTS of the receiver, the first copy was already taken
+            message->last_seen = timestamp;
+            return;
+        }
+        if(packet_number != (message->received_packets + 1) || (!message->streamed && packet_number > message->chunk_count)) {
+            DTC_TRACE(parser, DTC_TRACE_TP_DT_INCORRECT_ORDER, DTC_TRACE_EV_TP_DT_ORDER, timestamp, 0, can_id, packet_number, message->received_packets + 1);
+            DTC_STAT_INC(parser, tp_sessions_aborted_order);
+            free_multi_frame_slot(parser, message);
             return;
         }
 
-        uint32_t offset = (packet_number - 1) * 7;
-        memcpy(&message->data[offset], &data[1], 7);
+        if (message->streamed) {
+            stream_dm1_packet(parser, message, &data[1], timestamp);
+        } else {
+            uint32_t offset = (packet_number - 1) * DTC_MULTIFRAME_CHUNK_SIZE;
+            memcpy(&message->data[offset], &data[1], DTC_MULTIFRAME_CHUNK_SIZE);
+        }
         message->received_packets++;
         message->last_seen = timestamp;
 
-        if (message->received_packets == message->num_packets) {
-            #if PRINT_TP_CONCAT_MULTI_FRAME
-                printf("[%u] TP_CONCAT -> ID: %08X, Size: %u, Data:", timestamp, message->message_id, message->total_size);
-                for(uint8_t i=0; (i < message->total_size) && (i < sizeof(message->data)); i++) {
-                    printf(" %02X", message->data[i]);
-                }
-                printf("\n");
-            #endif
-            process_dm1_message(message_id, message->data, message->total_size, timestamp);
-            remove_multi_frame_message(message_id);
+        if (message->received_packets == message->num_packets && message->streamed) {
+            DTC_STAT_INC(parser, tp_sessions_completed);
+            free_multi_frame_slot(parser, message); // Every DTC was already processed
+        } else if (message->received_packets == message->num_packets) {
+            DTC_TRACE(parser, DTC_TRACE_TP_CONCAT_MULTI_FRAME, DTC_TRACE_EV_TP_CONCAT, timestamp, 0, message->message_id, message->pgn, message->total_size);
+            if (message->pgn == DM1_PGN) {
+                process_dm1_message(parser, message->src, message->data, message->total_size, timestamp);
+            } else if (parser->tp_message_callback) {
+                parser->tp_message_callback(parser->tp_message_user_data, message->pgn, message->src, message->dst, message->data, message->total_size, timestamp);
+            }
+            DTC_STAT_INC(parser, tp_sessions_completed);
+            free_multi_frame_slot(parser, message);
         }
     }
 }
 
-static MultiFrameMessage* find_multi_frame_message(uint32_t message_id_tp_dt) {
-    for (uint32_t i = 0; i < MAX_CONCURRENT_MULTIFRAME; i++) {
-        if (multi_frame_messages[i].message_id_tp_dt == message_id_tp_dt) {
-            return &multi_frame_messages[i];
-        }
+static MultiFrameMessage* find_multi_frame_message(DtcParser_t* parser, uint8_t src, uint8_t dst) {
+    // A source has at most one session per destination, the chain is as long as the destinations it is sending to
+    for (uint8_t ref = parser->session_by_src[src]; ref != 0; ref = parser->multi_frame_messages[ref - 1].next_session) {
+        if (parser->multi_frame_messages[ref - 1].dst == dst) return &parser->multi_frame_messages[ref - 1];
     }
     return NULL;
 }
 
-static void remove_multi_frame_message(uint32_t message_id_tp_dt) {
-    for (uint32_t i = 0; i < MAX_CONCURRENT_MULTIFRAME; i++) {
-        if (multi_frame_messages[i].message_id_tp_dt == message_id_tp_dt) {
-            memset(&multi_frame_messages[i], 0, sizeof(MultiFrameMessage));
-            return;
+static bool alloc_multi_frame_chunks(DtcParser_t* parser, size_t chunk_count, uint16_t* first_chunk) {
+    // First fit: the pool is small (a few hundred chunks) and the runs are freed as soon as a BAM ends
+    size_t run = 0;
+    for (size_t i = 0; chunk_count > 0 && i < parser->multi_frame_pool_chunks; i++) {
+        if ((parser->multi_frame_pool_map[i >> 5] >> (i & 31)) & 1) {
+            run = 0;
+            continue;
+        }
+        if (++run == chunk_count) {
+            size_t first = i + 1 - chunk_count;
+            for (size_t j = first; j <= i; j++) parser->multi_frame_pool_map[j >> 5] |= 1u << (j & 31);
+            *first_chunk = (uint16_t)first;
+            return true;
         }
     }
+    return chunk_count == 0;
 }
 
-static void remove_incomplete_multi_frame_message(uint32_t timestamp) {
-    for (uint32_t i = 0; i < MAX_CONCURRENT_MULTIFRAME; i++) {
-        if(multi_frame_messages[i].message_id) {
-            if ((timestamp - multi_frame_messages[i].last_seen) > dtcParseCfg.timeout_multi_frame) {
-                #if PRINT_WARNINGS
-                printf("[%u] WARNING: discard incomplete multiframe, CM: 0x%X, DT: 0x%X, FirstSeen: %u, LastSeen: %u\n", 
-                    timestamp, multi_frame_messages[i].message_id, multi_frame_messages[i].message_id_tp_dt, multi_frame_messages[i].first_seen, multi_frame_messages[i].last_seen);
-                #endif
-                memset(&multi_frame_messages[i], 0, sizeof(MultiFrameMessage));
+static void free_multi_frame_slot(DtcParser_t* parser, MultiFrameMessage* message) {
+    for (size_t j = message->first_chunk; j < (size_t)message->first_chunk + message->chunk_count; j++) {
+        parser->multi_frame_pool_map[j >> 5] &= ~(1u << (j & 31));
+    }
+    // Unlink from the sessions of its source
+    uint8_t ref = (uint8_t)(message - parser->multi_frame_messages + 1);
+    uint8_t* link = &parser->session_by_src[message->src];
+    while (*link != ref) link = &parser->multi_frame_messages[*link - 1].next_session;
+    *link = message->next_session;
+
+    // Only the header is cleared, the payload is overwritten by the next session
+    memset((void*)message, 0, sizeof(MultiFrameMessage));
+    message->next_session = parser->multi_frame_free;
+    parser->multi_frame_free = ref;
+    parser->multi_frame_count--;
+}
+
+static void remove_incomplete_multi_frame_message(DtcParser_t* parser, uint32_t timestamp) {
+    // With the timer heap the sessions expire through their own timers ('remove_inactive_dtcs')
+    if (parser->multi_frame_count == 0 || (parser->options & DTC_OPT_TIMER_HEAP)) return;
+    for (uint32_t i = 0; i < parser->max_multi_frame; i++) {
+        if(parser->multi_frame_messages[i].message_id) {
+            if ((timestamp - parser->multi_frame_messages[i].last_seen) > parser->dtcParseCfg.timeout_multi_frame) {
+                DTC_TRACE(parser, DTC_TRACE_WARNINGS, DTC_TRACE_EV_TP_TIMEOUT, timestamp,
+                    parser->multi_frame_messages[i].last_seen - parser->multi_frame_messages[i].first_seen,
+                    parser->multi_frame_messages[i].message_id, parser->multi_frame_messages[i].pgn, parser->multi_frame_messages[i].last_seen);
+                DTC_STAT_INC(parser, tp_sessions_aborted_timeout);
+                free_multi_frame_slot(parser, &parser->multi_frame_messages[i]);
             }
         }
     }
 }
 
+#if DTC_PARSER_USE_TRACE
+static void trace_record(DtcParser_t* parser, uint16_t event, uint32_t timestamp, uint16_t arg16, uint32_t a0, uint32_t a1, uint32_t a2) {
+    // Single producer: records are only written with the mutex held
+    uint32_t head = dtc_atomic_load_relaxed(&parser->trace_ring_head);
+    uint32_t tail = dtc_atomic_load_acquire(&parser->trace_ring_tail);
+    if ((head - tail) >= DTC_TRACE_RING_SIZE) {
+        dtc_atomic_fetch_add_relaxed(&parser->trace_ring_overflows, 1);
+        return;
+    }
+    DtcTraceRecord_t* r = &parser->trace_ring[head & (DTC_TRACE_RING_SIZE - 1)];
+    r->cycles = dtc_port_cycle_count();
+    r->timestamp = timestamp;
+    r->event = event;
+    r->arg16 = arg16;
+    r->args[0] = a0;
+    r->args[1] = a1;
+    r->args[2] = a2;
+    dtc_atomic_store_release(&parser->trace_ring_head, head + 1);
+}
+#endif
+
+#if DTC_PARSER_USE_STATS
+static void stats_histogram_add(uint32_t bins[DTC_STATS_HISTOGRAM_BINS], uint32_t* max_cycles, uint32_t cycles) {
+    // Bin of the highest set bit: bin i holds [2^i, 2^(i+1)) cycles
+    #if defined(__GNUC__)
+    uint32_t bin = 31 - (uint32_t)__builtin_clz(cycles | 1);
+    #else
+    uint32_t bin = 0;
+    while ((cycles >> bin) > 1) bin++;
+    #endif
+    if (bin >= DTC_STATS_HISTOGRAM_BINS) bin = DTC_STATS_HISTOGRAM_BINS - 1;
+    bins[bin]++;
+    if (cycles > *max_cycles) *max_cycles = cycles;
+}
+#endif
+
+static inline bool is_dtc_frame(uint32_t can_id) {
+    // Branchless: almost every frame on the bus is not DTC related, so the test must be cheap to reject
+    uint32_t pf = (can_id >> 16) & 0xFF;
+    return ((can_id & 0x00FFFF00) == 0x00FECA00) | // single frame DM1 message
+           ((pf - 0xEB) < 2);                      // multi frame data (0xEB) or message (0xEC)
+}
+
+static void handle_dtc_frame(DtcParser_t* parser, uint32_t can_id, const uint8_t data[8], uint32_t timestamp) {
+    if ((can_id & 0x00FFFF00) == 0x00FECA00) { // single frame DM1 message
+        DTC_TRACE_FRAME(parser, DTC_TRACE_DM1_FRAME, DTC_TRACE_EV_DM1_FRAME, timestamp, can_id, data);
+        DTC_STAT_INC(parser, frames_dm1);
+        process_dm1_message(parser, can_id, data, 8, timestamp);
+    }
+    else if ((can_id & 0x00FF0000) == 0x00EC0000) { // multi frame message
+        DTC_STAT_INC(parser, frames_tp_cm);
+        handle_tp_cm_message(parser, can_id, data, timestamp);
+    }
+    else if ((can_id & 0x00FF0000) == 0x00EB0000) { // multi frame data
+        DTC_STAT_INC(parser, frames_tp_dt);
+        if (parser->session_by_src[can_id & 0xFF] == 0) { // No session from this source, most TP.DT frames end here
+            DTC_STAT_INC(parser, frames_tp_dt_unmatched);
+            return;
+        }
+        handle_tp_dt_message(parser, can_id, data, timestamp);
+    }
+}
+
 // Public functions
-bool take_dtc_mutex() {
-    if(dtc_mutex_taken) return false;
-    dtc_mutex_taken = true;
+#if DTC_PARSER_EMBEDDED_STORAGE
+void init_dtc_parser(DtcParser_t* parser) {
+    DtcParserStorage_t storage = DTC_PARSER_STORAGE(parser->embedded);
+    storage.max_multi_frame_data_size = MAX_MULTIFRAME_DATA_SIZE;
+    init_dtc_parser_with_storage(parser, &storage);
+}
+#endif
+
+bool init_dtc_parser_with_storage(DtcParser_t* parser, const DtcParserStorage_t* storage) {
+    size_t dtc_n = storage->max_candidate_dtcs + storage->max_active_dtcs;
+    if (!storage->candidate_dtcs || !storage->active_dtcs || !storage->candidate_keys || !storage->active_keys || !storage->candidate_index_slots || !storage->active_index_slots || !storage->snapshot_dtcs || !storage->index_keys ||
+        !storage->index_refs || !storage->timer_heap || (storage->max_multi_frame > 0 && !storage->multi_frame_messages) ||
+        (storage->multi_frame_pool_chunks > 0 && (!storage->multi_frame_pool || !storage->multi_frame_pool_map)) || storage->multi_frame_pool_chunks > 0xFFFF ||
+        storage->max_candidate_dtcs >= 0x7FFF || storage->max_active_dtcs >= 0x7FFF || // Index references keep the position in 15 bits
+        storage->max_multi_frame > 255 || // Session references are 8 bits
+        storage->index_size == 0 || (storage->index_size & (storage->index_size - 1)) != 0 || storage->index_size < 2 * dtc_n) {
+        return false;
+    }
+
+    memset((void*)parser, 0, DTC_PARSER_STATE_SIZE);
+    parser->candidate_dtcs = storage->candidate_dtcs;
+    parser->max_candidate_dtcs = storage->max_candidate_dtcs;
+    parser->active_dtcs = storage->active_dtcs;
+    parser->max_active_dtcs = storage->max_active_dtcs;
+    parser->candidate_keys = storage->candidate_keys;
+    parser->active_keys = storage->active_keys;
+    parser->candidate_index_slots = storage->candidate_index_slots;
+    parser->active_index_slots = storage->active_index_slots;
+    parser->snapshot_dtcs[0] = storage->snapshot_dtcs;
+    parser->snapshot_dtcs[1] = storage->snapshot_dtcs + storage->max_active_dtcs;
+    parser->multi_frame_messages = storage->multi_frame_messages;
+    parser->max_multi_frame = storage->max_multi_frame;
+    parser->max_multi_frame_data_size = storage->max_multi_frame_data_size;
+    parser->multi_frame_pool = storage->multi_frame_pool;
+    parser->multi_frame_pool_map = storage->multi_frame_pool_map;
+    parser->multi_frame_pool_chunks = storage->multi_frame_pool_chunks;
+    parser->index_keys = storage->index_keys;
+    parser->index_refs = storage->index_refs;
+    parser->index_mask = (uint32_t)(storage->index_size - 1);
+    parser->timer_heap = storage->timer_heap;
+    parser->timer_heap_size = dtc_n + storage->max_multi_frame;
+
+    memset((void*)parser->candidate_dtcs, 0, storage->max_candidate_dtcs * sizeof(DTC_Info_t));
+    memset((void*)parser->active_dtcs, 0, storage->max_active_dtcs * sizeof(DTC_Info_t));
+    memset((void*)parser->index_refs, 0, storage->index_size * sizeof(uint16_t));
+    memset((void*)parser->multi_frame_messages, 0, storage->max_multi_frame * sizeof(MultiFrameMessage));
+    for (size_t i = 0; i < storage->max_multi_frame; i++) { // Free list of the slots, in order
+        parser->multi_frame_messages[i].next_session = (i + 1 < storage->max_multi_frame) ? (uint8_t)(i + 2) : 0;
+    }
+    parser->multi_frame_free = storage->max_multi_frame > 0 ? 1 : 0;
+    memset((void*)parser->multi_frame_pool_map, 0, ((storage->multi_frame_pool_chunks + 31) / 32) * sizeof(uint32_t));
+
+    parser->dtcParseCfg = default_dtc_parse_cfg;
+    parser->ticks_per_second = 1;
+    parser->options = DTC_PARSER_DEFAULT_OPTIONS;
+    return true;
+}
+
+bool set_dtc_parser_options(DtcParser_t* parser, uint32_t options) {
+    if(take_dtc_mutex(parser)) {
+        if (options & DTC_OPT_TIMER_HEAP) options |= DTC_OPT_HASH_INDEX; // Timers find their DTC by key
+        parser->options = options;
+        rebuild_dtc_index(parser);
+        rebuild_timer_heap(parser);
+        give_dtc_mutex(parser);
+        return true;
+    }
+    return false;
+}
+
+bool take_dtc_mutex(DtcParser_t* parser) {
+    return dtc_atomic_cas_acquire(&parser->dtc_mutex, 0, 1);
+}
+
+void give_dtc_mutex(DtcParser_t* parser) {
+    dtc_atomic_store_release(&parser->dtc_mutex, 0);
+}
+
+void set_dtc_filtering(DtcParser_t* parser, uint32_t _dtc_active_read_count_, uint32_t _dtc_active_time_window_, uint32_t _debounce_dtc_inactive_time_, uint32_t _timeout_multi_frame_) {
+    uint32_t tps = parser->ticks_per_second;
+    set_dtc_filtering_ticks(parser, _dtc_active_read_count_, scale_ticks(_dtc_active_time_window_, tps, 1), scale_ticks(_debounce_dtc_inactive_time_, tps, 1), scale_ticks(_timeout_multi_frame_, tps, 1));
+}
+
+void set_dtc_filtering_ticks(DtcParser_t* parser, uint32_t _dtc_active_read_count_, uint32_t _dtc_active_time_window_, uint32_t _debounce_dtc_inactive_time_, uint32_t _timeout_multi_frame_) {
+    if(_dtc_active_read_count_ > 0) parser->dtcParseCfg.dtc_active_read_count = _dtc_active_read_count_;
+    if(_dtc_active_time_window_ > 0) parser->dtcParseCfg.dtc_active_time_window = _dtc_active_time_window_;
+    if(_debounce_dtc_inactive_time_ > 0) parser->dtcParseCfg.debounce_dtc_inactive_time = _debounce_dtc_inactive_time_;
+    if(_timeout_multi_frame_ > 0) parser->dtcParseCfg.timeout_multi_frame = _timeout_multi_frame_;
+    parser->timer_rebuild_pending = true; // Deadlines are re-armed with the new times on the next 'check_dtcs'
+}
+
+bool set_dtc_time_base(DtcParser_t* parser, uint32_t ticks_per_second) {
+    if (ticks_per_second == 0) return false;
+    // The configured times keep their duration in the new unit
+    DtcParseConfig_t* cfg = &parser->dtcParseCfg;
+    uint32_t old_tps = parser->ticks_per_second;
+    cfg->dtc_active_time_window = scale_ticks(cfg->dtc_active_time_window, ticks_per_second, old_tps);
+    cfg->debounce_dtc_inactive_time = scale_ticks(cfg->debounce_dtc_inactive_time, ticks_per_second, old_tps);
+    cfg->timeout_multi_frame = scale_ticks(cfg->timeout_multi_frame, ticks_per_second, old_tps);
+    parser->notify_min_interval = scale_ticks(parser->notify_min_interval, ticks_per_second, old_tps);
+    parser->ticks_per_second = ticks_per_second;
+    parser->timer_rebuild_pending = true;
     return true;
 }
 
-void give_dtc_mutex() {
-    dtc_mutex_taken = false;
+void register_dtc_updated_callback(DtcParser_t* parser, UpdatedActiveDTCsCallback callback, void* user_data) {
+    parser->updated_active_dtcs_callback = callback;
+    parser->updated_active_dtcs_user_data = user_data;
 }
 
-void set_dtc_filtering(uint32_t _dtc_active_read_count_, uint32_t _dtc_active_time_window_, uint32_t _debounce_dtc_inactive_time_, uint32_t _timeout_multi_frame_) {
-    if(_dtc_active_read_count_ > 0) dtcParseCfg.dtc_active_read_count = _dtc_active_read_count_;
-    if(_dtc_active_time_window_ > 0) dtcParseCfg.dtc_active_time_window = _dtc_active_time_window_;
-    if(_debounce_dtc_inactive_time_ > 0) dtcParseCfg.debounce_dtc_inactive_time = _debounce_dtc_inactive_time_;
-    if(_timeout_multi_frame_ > 0) dtcParseCfg.timeout_multi_frame = _timeout_multi_frame_;
+bool set_dtc_notify_policy(DtcParser_t* parser, uint32_t min_interval, uint32_t flags) {
+    if(take_dtc_mutex(parser)) {
+        parser->notify_min_interval = min_interval;
+        parser->notify_flags = flags;
+        give_dtc_mutex(parser);
+        return true;
+    }
+    return false;
 }
 
-void register_dtc_updated_callback(UpdatedActiveDTCsCallback callback) {
-    updated_active_dtcs_callback = callback;
+void register_tp_message_callback(DtcParser_t* parser, TpMessageCallback callback, void* user_data) {
+    parser->tp_message_callback = callback;
+    parser->tp_message_user_data = user_data;
 }
 
-void process_dtc_frame(uint32_t can_id, uint8_t data[8], uint32_t timestamp) {
-    if(take_dtc_mutex()) {
-        if ((can_id & 0x00FFFF00) == 0x00FECA00) { // single frame DM1 message
-            #if PRINT_DM1_FRAME
-            printf("[%u] DM1_FRAME -> ID: %08X, Data: %02X %02X %02X %02X %02X %02X %02X %02X\n",
-                timestamp,
-                can_id, 
-                data[0], data[1], data[2], data[3], data[4], data[5], data[6], data[7]);
-            #endif
-            process_dm1_message(can_id, data, 8, timestamp);
-        } 
-        else if ((can_id & 0x00FF0000) == 0x00EC0000) { // multi frame message
-            uint32_t pgn = (data[7] << 16) | (data[6] << 8) | data[5];
-            if(pgn == 0xFECA) { // if is DTC multiframe
-                uint8_t control_byte = data[0];
-                if (control_byte == 0x20) { // BAM message
-                    handle_tp_cm_message(can_id, data, timestamp);
-                }
-            }
-        } 
-        else if ((can_id & 0x00FF0000) == 0x00EB0000) { // multi frame data
-            handle_tp_dt_message(can_id, data, timestamp);  
+void process_dtc_frame(DtcParser_t* parser, uint32_t can_id, uint8_t data[8], uint32_t timestamp) {
+    DTC_STAT_CYCLES_START(start);
+    DTC_STAT_ADD_ATOMIC(parser, frames_seen, 1);
+    if(take_dtc_mutex(parser)) {
+        handle_dtc_frame(parser, can_id, data, timestamp);
+        DTC_STAT_CYCLES_END(parser, process_frame_cycles, process_frame_max_cycles, start);
+        give_dtc_mutex(parser);
+    } else if (is_dtc_frame(can_id)) {
+        DTC_STAT_ADD_ATOMIC(parser, frames_dropped_locked, 1);
+    }
+}
+
+size_t filter_dtc_frames(const CanFrame_t* frames, size_t frame_count, uint32_t* dtc_indexes) {
+    size_t n = 0;
+    size_t i = 0;
+
+#if DTC_FILTER_AVX2
+    const __m256i stride = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28); // 'can_id' of 8 consecutive frames, in words
+    const __m256i dm1_mask = _mm256_set1_epi32(0x00FFFF00);
+    const __m256i dm1_pgn = _mm256_set1_epi32(0x00FECA00);
+    const __m256i pf_mask = _mm256_set1_epi32(0x00FF0000);
+    const __m256i tp_cm = _mm256_set1_epi32(0x00EC0000);
+    const __m256i tp_dt = _mm256_set1_epi32(0x00EB0000);
+    for (; i + 8 <= frame_count; i += 8) {
+        __m256i ids = _mm256_i32gather_epi32((const int*)&frames[i], stride, 4);
+        __m256i pf = _mm256_and_si256(ids, pf_mask);
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi32(_mm256_and_si256(ids, dm1_mask), dm1_pgn),
+                      _mm256_or_si256(_mm256_cmpeq_epi32(pf, tp_cm), _mm256_cmpeq_epi32(pf, tp_dt)));
+        uint32_t bits = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(hit));
+        while (bits) {
+            dtc_indexes[n++] = (uint32_t)i + lowest_bit_index(bits);
+            bits &= bits - 1;
+        }
+    }
+#elif DTC_FILTER_SSE2
+    const __m128i dm1_mask = _mm_set1_epi32(0x00FFFF00);
+    const __m128i dm1_pgn = _mm_set1_epi32(0x00FECA00);
+    const __m128i pf_mask = _mm_set1_epi32(0x00FF0000);
+    const __m128i tp_cm = _mm_set1_epi32(0x00EC0000);
+    const __m128i tp_dt = _mm_set1_epi32(0x00EB0000);
+    for (; i + 4 <= frame_count; i += 4) {
+        // One frame per register, then transpose the first word of each one: (id0, id1, id2, id3)
+        __m128i f0 = _mm_loadu_si128((const __m128i*)&frames[i]);
+        __m128i f1 = _mm_loadu_si128((const __m128i*)&frames[i + 1]);
+        __m128i f2 = _mm_loadu_si128((const __m128i*)&frames[i + 2]);
+        __m128i f3 = _mm_loadu_si128((const __m128i*)&frames[i + 3]);
+        __m128i ids = _mm_unpacklo_epi64(_mm_unpacklo_epi32(f0, f1), _mm_unpacklo_epi32(f2, f3));
+        __m128i pf = _mm_and_si128(ids, pf_mask);
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi32(_mm_and_si128(ids, dm1_mask), dm1_pgn),
+                      _mm_or_si128(_mm_cmpeq_epi32(pf, tp_cm), _mm_cmpeq_epi32(pf, tp_dt)));
+        uint32_t bits = (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(hit));
+        while (bits) {
+            dtc_indexes[n++] = (uint32_t)i + lowest_bit_index(bits);
+            bits &= bits - 1;
         }
-        give_dtc_mutex();
     }
+#elif DTC_FILTER_NEON
+    const uint32x4_t dm1_mask = vdupq_n_u32(0x00FFFF00);
+    const uint32x4_t dm1_pgn = vdupq_n_u32(0x00FECA00);
+    const uint32x4_t pf_mask = vdupq_n_u32(0x00FF0000);
+    const uint32x4_t tp_cm = vdupq_n_u32(0x00EC0000);
+    const uint32x4_t tp_dt = vdupq_n_u32(0x00EB0000);
+    const uint32x4_t lane_bits = { 1, 2, 4, 8 };
+    for (; i + 4 <= frame_count; i += 4) {
+        // De-interleaving load, val[0] holds the first word (can_id) of the 4 frames
+        uint32x4x4_t f = vld4q_u32((const uint32_t*)&frames[i]);
+        uint32x4_t ids = f.val[0];
+        uint32x4_t pf = vandq_u32(ids, pf_mask);
+        uint32x4_t hit = vorrq_u32(vceqq_u32(vandq_u32(ids, dm1_mask), dm1_pgn),
+                         vorrq_u32(vceqq_u32(pf, tp_cm), vceqq_u32(pf, tp_dt)));
+        uint32_t bits = vaddvq_u32(vandq_u32(hit, lane_bits));
+        while (bits) {
+            dtc_indexes[n++] = (uint32_t)i + lowest_bit_index(bits);
+            bits &= bits - 1;
+        }
+    }
+#endif
+
+    // Scalar fallback and tail of the vectorized loops
+    for (; i < frame_count; i++) {
+        dtc_indexes[n] = (uint32_t)i;
+        n += is_dtc_frame(frames[i].can_id);
+    }
+    return n;
+}
+
+size_t process_dtc_frames(DtcParser_t* parser, const CanFrame_t* frames, size_t frame_count, size_t* dropped) {
+    uint32_t dtc_indexes[DTC_FILTER_CHUNK];
+    size_t parsed = 0;
+    size_t lost = 0;
+    int locked = 0; // 0: not taken yet, 1: taken, -1: occupied
+
+    for (size_t base = 0; base < frame_count; base += DTC_FILTER_CHUNK) {
+        size_t chunk = frame_count - base;
+        if (chunk > DTC_FILTER_CHUNK) chunk = DTC_FILTER_CHUNK;
+
+        size_t n = filter_dtc_frames(&frames[base], chunk, dtc_indexes);
+        if (n == 0) continue; // Most chunks have no DTC frame at all, the mutex is only taken when needed
+
+        if (locked == 0) locked = take_dtc_mutex(parser) ? 1 : -1;
+        if (locked < 0) {
+            lost += n;
+            continue;
+        }
+        for (size_t k = 0; k < n; k++) {
+            const CanFrame_t* frame = &frames[base + dtc_indexes[k]];
+            handle_dtc_frame(parser, frame->can_id, frame->data, frame->timestamp);
+        }
+        parsed += n;
+    }
+    if (locked > 0) give_dtc_mutex(parser);
+
+    DTC_STAT_ADD_ATOMIC(parser, frames_seen, frame_count);
+    if (lost > 0) DTC_STAT_ADD_ATOMIC(parser, frames_dropped_locked, lost);
+    if (dropped) *dropped = lost;
+    return parsed;
+}
+
+bool enqueue_dtc_frame(DtcParser_t* parser, uint32_t can_id, const uint8_t data[8], uint32_t timestamp) {
+    DTC_STAT_ADD_ATOMIC(parser, frames_seen, 1);
+    if (!is_dtc_frame(can_id)) return true; // Not a DTC related frame, nothing to buffer
+
+    // Single producer: only the ISR writes 'frame_ring_head'
+    uint32_t head = dtc_atomic_load_relaxed(&parser->frame_ring_head);
+    uint32_t tail = dtc_atomic_load_acquire(&parser->frame_ring_tail);
+    if ((head - tail) >= DTC_FRAME_RING_SIZE) {
+        dtc_atomic_fetch_add_relaxed(&parser->frame_ring_overflows, 1);
+        return false;
+    }
+
+    CanFrame_t* frame = &parser->frame_ring[head & (DTC_FRAME_RING_SIZE - 1)];
+    frame->can_id = can_id;
+    memcpy(frame->data, data, 8);
+    frame->timestamp = timestamp;
+    dtc_atomic_store_release(&parser->frame_ring_head, head + 1);
+    return true;
+}
+
+size_t drain_dtc_frames(DtcParser_t* parser) {
+    size_t drained = 0;
+    if(take_dtc_mutex(parser)) {
+        // Single consumer: only the parsing task writes 'frame_ring_tail'
+        uint32_t tail = dtc_atomic_load_relaxed(&parser->frame_ring_tail);
+        uint32_t head = dtc_atomic_load_acquire(&parser->frame_ring_head);
+        while (tail != head) {
+            CanFrame_t* frame = &parser->frame_ring[tail & (DTC_FRAME_RING_SIZE - 1)];
+            handle_dtc_frame(parser, frame->can_id, frame->data, frame->timestamp);
+            tail++;
+            drained++;
+            dtc_atomic_store_release(&parser->frame_ring_tail, tail);
+        }
+        give_dtc_mutex(parser);
+    }
+    return drained;
+}
+
+uint32_t get_dtc_frame_ring_overflows(DtcParser_t* parser) {
+    return dtc_atomic_load_relaxed(&parser->frame_ring_overflows);
+}
+
+size_t read_dtc_events(DtcParser_t* parser, DtcEvent_t* events, size_t max_events) {
+    // Single consumer: only the reader writes 'event_ring_tail'
+    uint32_t tail = dtc_atomic_load_relaxed(&parser->event_ring_tail);
+    uint32_t head = dtc_atomic_load_acquire(&parser->event_ring_head);
+    size_t n = 0;
+    while (tail != head && n < max_events) {
+        events[n++] = parser->event_ring[tail & (DTC_EVENT_RING_SIZE - 1)];
+        tail++;
+    }
+    dtc_atomic_store_release(&parser->event_ring_tail, tail);
+    return n;
+}
+
+uint32_t get_dtc_event_overflows(DtcParser_t* parser) {
+    return dtc_atomic_load_relaxed(&parser->event_ring_overflows);
+}
+
+bool set_dtc_trace_mask(DtcParser_t* parser, uint32_t mask) {
+    #if DTC_PARSER_USE_TRACE
+    if(take_dtc_mutex(parser)) {
+        parser->trace_mask = mask;
+        give_dtc_mutex(parser);
+        return true;
+    }
+    #else
+    (void)parser;
+    (void)mask;
+    #endif
+    return false;
+}
+
+size_t read_dtc_trace(DtcParser_t* parser, DtcTraceRecord_t* records, size_t max_records) {
+    size_t n = 0;
+    #if DTC_PARSER_USE_TRACE
+    // Single consumer: only the reader writes 'trace_ring_tail'
+    uint32_t tail = dtc_atomic_load_relaxed(&parser->trace_ring_tail);
+    uint32_t head = dtc_atomic_load_acquire(&parser->trace_ring_head);
+    while (tail != head && n < max_records) {
+        records[n++] = parser->trace_ring[tail & (DTC_TRACE_RING_SIZE - 1)];
+        tail++;
+    }
+    dtc_atomic_store_release(&parser->trace_ring_tail, tail);
+    #else
+    (void)parser;
+    (void)records;
+    (void)max_records;
+    #endif
+    return n;
+}
+
+uint32_t get_dtc_trace_overflows(DtcParser_t* parser) {
+    #if DTC_PARSER_USE_TRACE
+    return dtc_atomic_load_relaxed(&parser->trace_ring_overflows);
+    #else
+    (void)parser;
+    return 0;
+    #endif
+}
+
+bool get_dtc_parser_stats(DtcParser_t* parser, DtcParserStats_t* stats) {
+    #if DTC_PARSER_USE_STATS
+    if(take_dtc_mutex(parser)) {
+        *stats = parser->stats;
+        stats->frames_seen = dtc_atomic_load_relaxed(&parser->frames_seen);
+        stats->frames_dropped_locked = dtc_atomic_load_relaxed(&parser->frames_dropped_locked);
+        stats->frames_dropped_ring = dtc_atomic_load_relaxed(&parser->frame_ring_overflows);
+        give_dtc_mutex(parser);
+        return true;
+    }
+    #else
+    (void)parser;
+    #endif
+    memset((void*)stats, 0, sizeof(DtcParserStats_t));
+    return false;
+}
+
+bool reset_dtc_parser_stats(DtcParser_t* parser) {
+    #if DTC_PARSER_USE_STATS
+    if(take_dtc_mutex(parser)) {
+        memset((void*)&parser->stats, 0, sizeof(DtcParserStats_t));
+        dtc_atomic_store_relaxed(&parser->frames_seen, 0);
+        dtc_atomic_store_relaxed(&parser->frames_dropped_locked, 0);
+        give_dtc_mutex(parser);
+        return true;
+    }
+    #else
+    (void)parser;
+    #endif
+    return false;
 }
 
 void print_dtcs(const DTC_Info_t* list, const size_t count) {
@@ -439,64 +1569,195 @@ void print_dtcs(const DTC_Info_t* list, const size_t count) {
     }
 }
 
-bool check_dtcs(uint32_t timestamp) {
+bool check_dtcs(DtcParser_t* parser, uint32_t timestamp) {
     bool ret = false; 
-    if(take_dtc_mutex()) {
-        remove_inactive_dtcs(timestamp);
-        remove_incomplete_multi_frame_message(timestamp);
+    DTC_STAT_CYCLES_START(start);
+    if(take_dtc_mutex(parser)) {
+        begin_active_dtcs_write(parser);
+        remove_inactive_dtcs(parser, timestamp);
+        end_active_dtcs_write(parser);
+        remove_incomplete_multi_frame_message(parser, timestamp);
         
-        if(changed_dtc_list) {
-            // Notify if configured callback function
-            if (updated_active_dtcs_callback != NULL) {
-                updated_active_dtcs_callback(active_dtcs, active_dtcs_count);
-            }
-            changed_dtc_list = false;
-            ret = true;
+        if(parser->changed_dtc_list) {
+            parser->changed_dtc_list = false;
+            parser->snapshot_pending = true;
+            parser->notify_pending = true;
+        }
+        if(parser->snapshot_pending) {
+            publish_dtc_snapshot(parser);
+        }
+        // Notified once published, the callback is given the snapshot; the interval is wrap-safe
+        if(parser->notify_pending && !parser->snapshot_pending &&
+           (parser->notify_min_interval == 0 || parser->notify_urgent || !parser->notified ||
+            (timestamp - parser->last_notify) >= parser->notify_min_interval)) {
+            ret = take_notification(parser, timestamp);
         }
-        give_dtc_mutex();
+        DTC_STAT_CYCLES_END(parser, check_dtcs_cycles, check_dtcs_max_cycles, start);
+        give_dtc_mutex(parser);
+    }
+
+    // Notify if configured callback function, outside the lock so frames are not dropped meanwhile
+    if (ret && parser->updated_active_dtcs_callback != NULL) {
+        size_t dtc_count;
+        uint32_t generation;
+        const DTC_Info_t* dtcs = acquire_dtc_snapshot(parser, &dtc_count, &generation);
+        parser->updated_active_dtcs_callback(parser->updated_active_dtcs_user_data, dtcs, dtc_count);
+        release_dtc_snapshot(parser, generation);
     }
     return ret;
 }
 
-void clear_dtcs() {
-    if(take_dtc_mutex()) {
-        candidate_dtcs_count = 0;
-        active_dtcs_count = 0;
-        memset((void*)candidate_dtcs, 0, sizeof(candidate_dtcs));
-        memset((void*)active_dtcs, 0, sizeof(active_dtcs));
-        memset((void*)multi_frame_messages, 0, sizeof(multi_frame_messages));
-        give_dtc_mutex();
+void clear_dtcs(DtcParser_t* parser) {
+    if(take_dtc_mutex(parser)) {
+        // The DTCs are removed without a 'check_dtcs' timestamp, their last_seen is reported instead
+        for (size_t i = 0; i < parser->active_dtcs_count; ++i) {
+            push_dtc_event(parser, DTC_EVENT_REMOVED, &parser->active_dtcs[i].dtc, parser->active_dtcs[i].last_seen);
+        }
+        begin_active_dtcs_write(parser);
+        parser->candidate_dtcs_count = 0;
+        parser->active_dtcs_count = 0;
+        parser->active_layout_generation++;
+        memset((void*)parser->candidate_dtcs, 0, parser->max_candidate_dtcs * sizeof(DTC_Info_t));
+        memset((void*)parser->active_dtcs, 0, parser->max_active_dtcs * sizeof(DTC_Info_t));
+        #if DTC_PARSER_USE_SOURCE_QUOTA
+        memset(parser->candidate_count_by_src, 0, sizeof(parser->candidate_count_by_src));
+        memset(parser->active_count_by_src, 0, sizeof(parser->active_count_by_src));
+        #endif
+        for (size_t i = 0; i < parser->max_multi_frame; i++) {
+            if (parser->multi_frame_messages[i].message_id) free_multi_frame_slot(parser, &parser->multi_frame_messages[i]);
+        }
+        rebuild_dtc_index(parser);
+        rebuild_timer_heap(parser);
+        end_active_dtcs_write(parser);
+        publish_dtc_snapshot(parser);
+        give_dtc_mutex(parser);
     }
 }
 
-bool copy_dtcs(DTC_Info_t* buf_dtc_list, uint16_t buf_size, uint8_t* dtc_count) {
-    if(take_dtc_mutex()) {
-        uint16_t dtcRequiredBufSize = active_dtcs_count * sizeof(DTC_Info_t);
-        if(buf_size >= dtcRequiredBufSize) {
-            memcpy((void*)buf_dtc_list, (void*)active_dtcs, dtcRequiredBufSize);
-            *dtc_count = active_dtcs_count;
-            give_dtc_mutex();
-            return true;
+bool clear_source_dtcs(DtcParser_t* parser, uint8_t src) {
+    if(!take_dtc_mutex(parser)) return false;
+
+    // Both lists are compacted keeping their order, the stale timers of the removed DTCs are ignored when they fire
+    begin_active_dtcs_write(parser);
+    size_t kept = 0;
+    for (size_t i = 0; i < parser->candidate_dtcs_count; ++i) {
+        if ((parser->candidate_keys[i] >> 24) == src) {
+            if (parser->options & DTC_OPT_HASH_INDEX) index_remove_slot(parser, parser->candidate_index_slots[i]);
+            continue;
+        }
+        if (kept != i) {
+            parser->candidate_dtcs[kept] = parser->candidate_dtcs[i];
+            parser->candidate_keys[kept] = parser->candidate_keys[i];
+            if (parser->options & DTC_OPT_HASH_INDEX) index_move(parser, parser->candidate_index_slots[i], CANDIDATE_REF(kept));
         }
+        kept++;
     }
-    return false;
-}
+    parser->candidate_dtcs_count = kept;
 
-bool dynamic_copy_dtcs(DTC_Info_t **buf_dtc_list, uint8_t* dtc_count) {
-    if(take_dtc_mutex()) {
-        *buf_dtc_list = (DTC_Info_t*)malloc(active_dtcs_count * sizeof(DTC_Info_t));
-        if(*buf_dtc_list != NULL) {
-            memcpy((void*)*buf_dtc_list, (void*)active_dtcs, active_dtcs_count * sizeof(DTC_Info_t));
-            *dtc_count = active_dtcs_count;
-            give_dtc_mutex();
-            return true;
+    kept = 0;
+    for (size_t i = 0; i < parser->active_dtcs_count; ++i) {
+        DTC_Info_t* f = &parser->active_dtcs[i];
+        if ((parser->active_keys[i] >> 24) == src) {
+            if (parser->options & DTC_OPT_HASH_INDEX) index_remove_slot(parser, parser->active_index_slots[i]);
+            push_dtc_event(parser, DTC_EVENT_REMOVED, &f->dtc, f->last_seen);
+            parser->changed_dtc_list = true;
+            continue;
+        }
+        if (kept != i) {
+            parser->active_dtcs[kept] = *f;
+            parser->active_keys[kept] = parser->active_keys[i];
+            if (parser->options & DTC_OPT_HASH_INDEX) index_move(parser, parser->active_index_slots[i], ACTIVE_REF(kept));
         }
-        give_dtc_mutex();
+        kept++;
+    }
+    if (kept != parser->active_dtcs_count) parser->active_layout_generation++;
+    parser->active_dtcs_count = kept;
+    end_active_dtcs_write(parser);
+
+    #if DTC_PARSER_USE_SOURCE_QUOTA
+    parser->candidate_count_by_src[src] = 0;
+    parser->active_count_by_src[src] = 0;
+    #endif
+    give_dtc_mutex(parser);
+    return true;
+}
+
+bool set_dtc_source_quota(DtcParser_t* parser, size_t max_candidate_dtcs, size_t max_active_dtcs) {
+    #if DTC_PARSER_USE_SOURCE_QUOTA
+    if(take_dtc_mutex(parser)) {
+        parser->max_candidate_per_src = max_candidate_dtcs;
+        parser->max_active_per_src = max_active_dtcs;
+        give_dtc_mutex(parser);
+        return true;
     }
+    #else
+    (void)parser;
+    (void)max_candidate_dtcs;
+    (void)max_active_dtcs;
+    #endif
     return false;
 }
 
-const DTC_Info_t* get_reference_to_dtcs(uint8_t* dtc_count) {
-    *dtc_count = active_dtcs_count;
-    return (const DTC_Info_t*)active_dtcs;
-}
\ No newline at end of file
+bool copy_dtcs(DtcParser_t* parser, DTC_Info_t* buf_dtc_list, size_t buf_size, size_t* dtc_count) {
+    bool ret = false;
+    size_t count = 0;
+    uint32_t generation = 0;
+    const DTC_Info_t* snapshot = acquire_dtc_snapshot(parser, &count, &generation);
+    size_t dtcRequiredBufSize = count * sizeof(DTC_Info_t);
+    if(buf_size >= dtcRequiredBufSize) {
+        memcpy((void*)buf_dtc_list, (void*)snapshot, dtcRequiredBufSize);
+        *dtc_count = count;
+        ret = true;
+    }
+    release_dtc_snapshot(parser, generation);
+    return ret;
+}
+
+bool dynamic_copy_dtcs(DtcParser_t* parser, DTC_Info_t **buf_dtc_list, size_t* dtc_count) {
+    // Allocate for the worst case before acquiring, so no allocation is done while holding the snapshot
+    *buf_dtc_list = (DTC_Info_t*)malloc(parser->max_active_dtcs * sizeof(DTC_Info_t));
+    if(*buf_dtc_list == NULL) return false;
+
+    size_t count = 0;
+    uint32_t generation = 0;
+    const DTC_Info_t* snapshot = acquire_dtc_snapshot(parser, &count, &generation);
+    memcpy((void*)*buf_dtc_list, (void*)snapshot, count * sizeof(DTC_Info_t));
+    *dtc_count = count;
+    release_dtc_snapshot(parser, generation);
+    return true;
+}
+
+const DTC_Info_t* acquire_dtc_snapshot(DtcParser_t* parser, size_t* dtc_count, uint32_t* generation) {
+    uint32_t g;
+    while (true) {
+        g = dtc_atomic_load(&parser->snapshot_generation);
+        dtc_atomic_fetch_add(&parser->snapshot_readers[g & 1], 1);
+        // Still published after registering as reader, so the library won't overwrite it until released
+        if (dtc_atomic_load(&parser->snapshot_generation) == g) break;
+        dtc_atomic_fetch_sub(&parser->snapshot_readers[g & 1], 1);
+    }
+    *dtc_count = parser->snapshot_dtcs_count[g & 1];
+    *generation = g;
+    return (const DTC_Info_t*)parser->snapshot_dtcs[g & 1];
+}
+
+void release_dtc_snapshot(DtcParser_t* parser, uint32_t generation) {
+    dtc_atomic_fetch_sub(&parser->snapshot_readers[generation & 1], 1);
+}
+
+const DTC_Info_t* get_reference_to_dtcs(DtcParser_t* parser, size_t* dtc_count) {
+    *dtc_count = parser->active_dtcs_count;
+    return (const DTC_Info_t*)parser->active_dtcs;
+}
+
+#if DTC_PARSER_USE_SEQLOCK
+uint32_t read_dtcs_begin(DtcParser_t* parser) {
+    return dtc_atomic_load_acquire(&parser->active_dtcs_seq);
+}
+
+bool read_dtcs_retry(DtcParser_t* parser, uint32_t seq) {
+    // Keep the list reads before the second sequence load
+    dtc_atomic_fence_acquire();
+    return (seq & 1) || (dtc_atomic_load_relaxed(&parser->active_dtcs_seq) != seq);
+}
+#endif
@@ -5,7 +5,7 @@
  * This library is designed to parse J1939 Diagnostic Trouble Code (DTC) messages from CAN frames.
  * It manages the detection and tracking of DTCs by maintaining lists of candidate 
  * and active DTCs. The library can handle both single-frame and 
- * multi-frame DTC messages (using the BAM transport protocol). It is optimized for use within 
+ * multi-frame DTC messages (using the BAM and RTS/CTS transport protocol). It is optimized for use within
  * a CAN interrupt handler, with built-in mutex protection to ensure safe concurrent access 
  * to the DTC list. If the DTC list is being accessed when a new CAN frame arrives, the 
  * library will skip processing that frame to avoid concurrency issues, accepting the possibility 
@@ -18,6 +18,8 @@
  * - Debouncing mechanism to handle DTC transition from 'candidate' to 'active'.
  * - Debouncing mechanism to handle DTC removal once it is considered 'inactive'.
  * - Customizable DTC handling with user-defined callback functions.
+ * - Independent parser instances (one `DtcParser_t` context per CAN bus), no shared state.
+ * - Per-instance table capacities with caller-provided storage (`init_dtc_parser_with_storage`).
  *
  * @authored by Roger da Silva Moschiel
  * @date 1 August 2024
@@ -29,11 +31,88 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include "dtc_parser_port.h"
 
-#define MAX_CONCURRENT_MULTIFRAME 4    // Maximum concurrent multi-frame messages
+#define DTC_PARSER_EMBEDDED_STORAGE 1 // 'DtcParser_t' embeds tables sized by the MAX_* macros below for 'init_dtc_parser', 0 leaves only 'init_dtc_parser_with_storage'
+#define MAX_CONCURRENT_MULTIFRAME 4    // Maximum concurrent multi-frame messages (at most 255)
 #define MAX_MULTIFRAME_DATA_SIZE 256   // Maximum data size for multi-frame messages
+#define DTC_MULTIFRAME_CHUNK_SIZE 7    // Payload bytes of a TP.DT packet, granularity of the multi-frame reassembly pool
 #define MAX_CANDIDATE_DTCS 40        // Maximum number of candidate DTCs
 #define MAX_ACTIVE_DTCS 20           // Maximum number of active DTCs
+#define DTC_FRAME_RING_SIZE 64       // Frames buffered between 'enqueue_dtc_frame' and 'drain_dtc_frames' (must be a power of 2)
+#define DTC_EVENT_RING_SIZE 32       // Events buffered between the parser and 'read_dtc_events' (must be a power of 2)
+#define DTC_INDEX_SIZE 128           // Slots of the DTC lookup hash index (power of 2, at least 2x MAX_ACTIVE_DTCS + MAX_CANDIDATE_DTCS, see 'DTC_INDEX_SIZE_FOR')
+#define DTC_DM1_CACHE_SIZE 8         // Source addresses kept by the DM1 repeat cache (at most 255, any source in any entry, least recently used replaced)
+#define DTC_DM1_CACHE_BYTES 32       // Largest DM1 payload kept by the repeat cache (2 lamp bytes + 4 bytes per DTC)
+#define DTC_PARSER_USE_SEQLOCK 1     // Enables lock-free readers of the active DTC list ('read_dtcs_begin'/'read_dtcs_retry')
+#define DTC_PARSER_USE_SIMD 1        // Vectorized frame pre-filter of 'filter_dtc_frames' (AVX2/SSE2/NEON when targeted by the compiler, scalar otherwise)
+#define DTC_PARSER_USE_STATS 1       // Hot path counters and cycle histograms read with 'get_dtc_parser_stats', 0 removes them from the code
+#define DTC_PARSER_USE_TRACE 1       // Binary trace ring of the parser decisions ('set_dtc_trace_mask'/'read_dtc_trace'), 0 removes it from the code
+#define DTC_PARSER_USE_SOURCE_QUOTA 1 // Per source address DTC counters and quotas ('set_dtc_source_quota'), 0 removes them from the code
+#define DTC_TRACE_RING_SIZE 64       // Records buffered between the parser and 'read_dtc_trace' (must be a power of 2)
+#define DTC_STATS_HISTOGRAM_BINS 20  // Log2 bins of the cycle histograms: bin i counts the calls of [2^i, 2^(i+1)) cycles, the last one also the longer ones
+
+#if (DTC_FRAME_RING_SIZE == 0) || ((DTC_FRAME_RING_SIZE & (DTC_FRAME_RING_SIZE - 1)) != 0)
+#error "DTC_FRAME_RING_SIZE must be a power of 2"
+#endif
+#if ((DTC_INDEX_SIZE & (DTC_INDEX_SIZE - 1)) != 0) || (DTC_INDEX_SIZE < 2 * (MAX_ACTIVE_DTCS + MAX_CANDIDATE_DTCS))
+#error "DTC_INDEX_SIZE must be a power of 2 and at least 2x (MAX_ACTIVE_DTCS + MAX_CANDIDATE_DTCS)"
+#endif
+#if (DTC_DM1_CACHE_SIZE == 0) || (DTC_DM1_CACHE_SIZE > 255) || (DTC_DM1_CACHE_BYTES < 8)
+#error "DTC_DM1_CACHE_SIZE must be between 1 and 255 and DTC_DM1_CACHE_BYTES at least 8 (single frame DM1)"
+#endif
+#if (MAX_ACTIVE_DTCS >= 0x7FFF) || (MAX_CANDIDATE_DTCS >= 0x7FFF)
+#error "MAX_ACTIVE_DTCS and MAX_CANDIDATE_DTCS must be lower than 32767"
+#endif
+
+// Pool chunks holding a multi-frame message of 'data_size' bytes
+#define DTC_MULTIFRAME_CHUNKS_FOR(data_size) (((data_size) + DTC_MULTIFRAME_CHUNK_SIZE - 1) / DTC_MULTIFRAME_CHUNK_SIZE)
+
+// Smallest valid hash index size for a total of 'dtc_n' active and candidate DTCs (power of 2, at least 2x 'dtc_n')
+#define DTC_INDEX_SIZE_FOR(dtc_n) \
+    ((2 * (dtc_n)) <= 8 ? 8 : (2 * (dtc_n)) <= 16 ? 16 : (2 * (dtc_n)) <= 32 ? 32 : (2 * (dtc_n)) <= 64 ? 64 : \
+     (2 * (dtc_n)) <= 128 ? 128 : (2 * (dtc_n)) <= 256 ? 256 : (2 * (dtc_n)) <= 512 ? 512 : (2 * (dtc_n)) <= 1024 ? 1024 : \
+     (2 * (dtc_n)) <= 2048 ? 2048 : (2 * (dtc_n)) <= 4096 ? 4096 : (2 * (dtc_n)) <= 8192 ? 8192 : \
+     (2 * (dtc_n)) <= 16384 ? 16384 : 32768)
+
+/**
+ * @brief Optional engine features, selected per parser instance with `set_dtc_parser_options`
+ */
+#define DTC_OPT_HASH_INDEX (1u << 0)  // O(1) DTC lookup through an open-addressing hash index instead of linear scans
+#define DTC_OPT_SWAP_REMOVE (1u << 1) // O(1) removal of promoted candidates by moving the last one into the hole (candidate order not kept)
+#define DTC_OPT_TIMER_HEAP (1u << 2)  // 'check_dtcs' only visits the DTCs and multi-frame sessions whose deadline has passed (min-heap), implies DTC_OPT_HASH_INDEX (not part of the defaults, slower than the linear pass on the 'bench' workloads)
+#define DTC_OPT_EVENT_RING (1u << 3)  // Active list changes are pushed as delta events to be read with 'read_dtc_events' (not part of the defaults)
+#define DTC_OPT_STREAM_DM1 (1u << 4)  // Multi-frame DM1 decoded packet by packet without reassembly buffer (not part of the defaults, see 'set_dtc_parser_options')
+#define DTC_OPT_DM1_REPEAT_CACHE (1u << 5) // A DM1 identical to the previous one of its source only refreshes its active DTCs, without decoding it
+#define DTC_PARSER_DEFAULT_OPTIONS (DTC_OPT_HASH_INDEX | DTC_OPT_SWAP_REMOVE | DTC_OPT_DM1_REPEAT_CACHE)
+
+// Trace categories of 'set_dtc_trace_mask'
+#define DTC_TRACE_DM1_FRAME (1u << 0)              // Raw single frame DM1 messages
+#define DTC_TRACE_DM1_PARSED (1u << 1)             // Lamp status and DTCs of every DM1 message
+#define DTC_TRACE_TP_CM_FRAME (1u << 2)            // Raw TP.CM frames opening a session
+#define DTC_TRACE_TP_CM_PARSED (1u << 3)           // Sessions announced (PGN, size, packets)
+#define DTC_TRACE_TP_DT_FRAME (1u << 4)            // Raw TP.DT frames of open sessions
+#define DTC_TRACE_TP_DT_PARSED (1u << 5)           // Packet number of the TP.DT frames of open sessions
+#define DTC_TRACE_TP_DT_INCORRECT_ORDER (1u << 6)  // Sessions aborted by a packet out of order
+#define DTC_TRACE_TP_CONCAT_MULTI_FRAME (1u << 7)  // Reassembled messages (identifier and size, the payload is in the TP.DT frames)
+#define DTC_TRACE_NEW_AND_REMOVED_DTC (1u << 8)    // DTCs added to or removed from the active list
+#define DTC_TRACE_WARNINGS (1u << 9)               // Table limits reached, sessions aborted or timed out
+#define DTC_TRACE_ALL 0x3FFu
+
+// Flags of 'set_dtc_notify_policy'
+#define DTC_NOTIFY_LAMP_BYPASS (1u << 0)           // A DTC added with its MIL or RSL on, or a MIL/RSL change of an active DTC, is notified without waiting for the interval
+
+// J1939 parameter group numbers handled by the parser
+#define DM1_PGN 0xFECA               // Active diagnostic trouble codes
+#define DM2_PGN 0xFECB               // Previously active diagnostic trouble codes, reassembled for 'register_tp_message_callback'
+
+// Transport protocol connection management (TP.CM) control bytes
+#define TP_CM_RTS 0x10               // Request to send, opens a connection mode (RTS/CTS) session
+#define TP_CM_CTS 0x11               // Clear to send, sent by the receiver
+#define TP_CM_EOMA 0x13              // End of message acknowledge, sent by the receiver
+#define TP_CM_BAM 0x20               // Broadcast announce message, opens a broadcast session
+#define TP_CM_ABORT 0xFF             // Connection abort, sent by either side
 
 /**
  * @brief Struct with DTC parameters (j1939 DM1 parameters)
@@ -60,34 +139,433 @@ typedef struct {
     uint16_t read_count;
 } __attribute__((packed)) DTC_Info_t; // (6 + 4 + 4 + 2 = 16 bytes)
 
+/**
+ * @brief Types of the active DTC list delta events
+ */
+typedef enum {
+    DTC_EVENT_ADDED = 0,    // DTC promoted to the active list
+    DTC_EVENT_REMOVED,      // Active DTC removed (inactive for 'debounce_dtc_inactive_time' or 'clear_dtcs')
+    DTC_EVENT_CHANGED,      // Occurrence counter or lamp status of an active DTC changed
+} DtcEventType_t;
+
+/**
+ * @brief Struct for an active DTC list delta event
+ */
+typedef struct {
+    uint8_t type;       // DtcEventType_t
+    DTC_t dtc;          // DTC after the change
+    uint32_t timestamp; // Timestamp (ticks, see 'set_dtc_time_base') of the frame or 'check_dtcs' call that made the change
+} __attribute__((packed)) DtcEvent_t; // (1 + 6 + 4 = 11 bytes)
+
+/**
+ * @brief Events of the binary trace, the arguments of each one are listed as `args[0], args[1], args[2]` / `arg16`
+ */
+typedef enum {
+    DTC_TRACE_EV_DM1_FRAME = 1,     // can_id, data[0..3], data[4..7] (little endian words)
+    DTC_TRACE_EV_DM1_PARSED,        // lamp status byte / src
+    DTC_TRACE_EV_DM1_DTC,           // spn, fmi | cm << 8 | oc << 16 / src
+    DTC_TRACE_EV_TP_CM_FRAME,       // can_id, data[0..3], data[4..7]
+    DTC_TRACE_EV_TP_CM_PARSED,      // can_id, pgn, total_size | num_packets << 16
+    DTC_TRACE_EV_TP_DT_FRAME,       // can_id, data[0..3], data[4..7]
+    DTC_TRACE_EV_TP_DT_PARSED,      // can_id, packet number, announced packets
+    DTC_TRACE_EV_TP_DT_ORDER,       // can_id, received packet, expected packet
+    DTC_TRACE_EV_TP_CONCAT,         // can_id of the TP.CM, pgn, total_size
+    DTC_TRACE_EV_NEW_DTC,           // spn, fmi / src
+    DTC_TRACE_EV_REMOVED_DTC,       // spn, fmi, last_seen / src
+    DTC_TRACE_EV_MAX_CANDIDATE,     // max_candidate_dtcs
+    DTC_TRACE_EV_MAX_ACTIVE,        // max_active_dtcs
+    DTC_TRACE_EV_MAX_DATA_SIZE,     // max_multi_frame_data_size, total_size
+    DTC_TRACE_EV_MAX_MULTI_FRAME,   // max_multi_frame
+    DTC_TRACE_EV_POOL_EXHAUSTED,    // chunks needed
+    DTC_TRACE_EV_TP_ABORTED,        // can_id of the TP.CM, abort reason
+    DTC_TRACE_EV_TP_TIMEOUT,        // can_id of the TP.CM, pgn, last_seen / ticks since first_seen
+    DTC_TRACE_EV_SOURCE_QUOTA,      // quota, 1 for the active list (0 candidate list) / src
+} DtcTraceEvent_t;
+
+/**
+ * @brief Struct for a binary trace record, formatted by `format_dtc_trace_record` (dtc_trace.h)
+ */
+typedef struct {
+    uint32_t cycles;    // 'dtc_port_cycle_count' when recorded, orders and times the records of a burst
+    uint32_t timestamp; // Timestamp (ticks) of the frame or 'check_dtcs' call being processed
+    uint16_t event;     // DtcTraceEvent_t
+    uint16_t arg16;
+    uint32_t args[3];
+} DtcTraceRecord_t; // (4 + 4 + 2 + 2 + 12 = 24 bytes)
+
 /**
  * @brief Struct for a multi-frame message
  */
 typedef struct {
-    uint32_t message_id;
-    uint32_t message_id_tp_dt;
+    uint32_t message_id;    // TP.CM identifier that opened the session, 0 if the slot is free
+    uint32_t pgn;           // Parameter group carried by the session (DM1_PGN or DM2_PGN)
+    uint8_t src;            // Originator address (source of the TP.DT frames)
+    uint8_t dst;            // Destination address of the TP.DT frames, 0xFF for BAM
+    uint8_t next_session;   // Next session of the same source (slot + 1), or next free slot if the slot is free, 0 if none
+    bool connection_mode;   // Opened by RTS (RTS/CTS session) instead of BAM
     uint32_t total_size;
     uint32_t num_packets;
     uint32_t received_packets;
     uint32_t first_seen;
     uint32_t last_seen;
-    uint8_t data[MAX_MULTIFRAME_DATA_SIZE];
+    uint16_t first_chunk;   // First chunk of the reassembly pool run holding the payload
+    uint16_t chunk_count;   // Chunks of the run, one per announced packet
+    uint8_t* data;          // Payload, 'chunk_count' x DTC_MULTIFRAME_CHUNK_SIZE bytes of the pool (NULL if streamed)
+    bool streamed;          // Decoded packet by packet ('DTC_OPT_STREAM_DM1' when announced)
+    bool stream_done;       // Streamed session: the remaining DTCs are ignored (first SPN 0 or past 'total_size')
+    uint8_t stream_lamps;   // Streamed session: lamp status byte of the DM1
+    uint8_t stream_dtc[4];  // Streamed session: bytes of the DTC being received
 } MultiFrameMessage;
 
+/**
+ * @brief Struct for a raw CAN frame
+ */
+typedef struct {
+    uint32_t can_id;
+    uint8_t data[8];
+    uint32_t timestamp;
+} CanFrame_t;
+
+/**
+ * @brief What an expiry timer is armed for
+ */
+typedef enum {
+    DTC_TIMER_CANDIDATE = 0,    // Time window of a candidate DTC
+    DTC_TIMER_ACTIVE = 1,       // Inactive time of an active DTC
+    DTC_TIMER_SESSION = 2,      // Timeout of a multi-frame session
+} DtcTimerKind_t;
+
+/**
+ * @brief Struct for an expiry timer (min-heap entry)
+ */
+typedef struct {
+    uint32_t deadline;  // First timestamp where the DTC or session may be expired
+    uint32_t key;       // Packed (src, spn, fmi) of the DTC, or slot of the session
+    uint16_t ref;       // List position of the DTC when armed, checked against the key before the index is probed
+    uint8_t kind;       // DtcTimerKind_t, a DTC timer of the list it is no longer in is ignored
+} DtcTimer_t;
+
+/**
+ * @brief Struct for an entry of the DM1 repeat cache (`DTC_OPT_DM1_REPEAT_CACHE`)
+ *
+ * Kept only when every DTC of the payload ended up in the active list, with the positions of those
+ * DTCs. A repeat of the same bytes would only refresh their last_seen, which is all the cache does.
+ */
+typedef struct {
+    uint8_t payload[DTC_DM1_CACHE_BYTES]; // Raw DM1 bytes (lamps and DTCs) last processed for the source
+    uint16_t length;                      // Bytes of 'payload', 0 if the entry is empty
+    uint8_t src;                          // Source address of the entry
+    uint8_t dtc_count;                    // DTCs of the payload
+    uint32_t generation;                  // 'active_layout_generation' when cached, the positions are stale once it changes
+    uint32_t last_use;                    // 'dm1_cache_clock' of the last store or hit, the oldest entry is replaced
+    uint16_t active_index[(DTC_DM1_CACHE_BYTES - 2) / 4]; // Position of each DTC of the payload in the active list
+} Dm1RepeatCache_t;
+
+/**
+ * @brief Struct for the instrumentation counters of a parser instance (see `get_dtc_parser_stats`)
+ *
+ * The counters wrap around at 2^32, readers use differences between two snapshots for long runs.
+ */
+typedef struct {
+    uint32_t frames_seen;                   // Frames given to the parser ('process_dtc_frame', 'process_dtc_frames', 'enqueue_dtc_frame')
+    uint32_t frames_dropped_locked;         // DTC frames not processed because the mutex was taken
+    uint32_t frames_dropped_ring;           // Frames lost because the ISR frame ring was full
+    uint32_t frames_dm1;                    // Single frame DM1 messages processed
+    uint32_t frames_tp_cm;                  // TP.CM frames processed
+    uint32_t frames_tp_dt;                  // TP.DT frames processed
+    uint32_t frames_tp_dt_unmatched;        // TP.DT frames without an open session (other transfers on the bus)
+    uint32_t dm1_repeats;                   // DM1 messages identical to the previous one of their source, applied by the repeat cache
+    uint32_t notifications;                 // Updated callbacks made by 'check_dtcs' (changes reported)
+    uint32_t notifications_coalesced;       // Pending changes dropped because the list was back to the last one notified
+    uint32_t tp_sessions_started;
+    uint32_t tp_sessions_completed;
+    uint32_t tp_sessions_aborted_order;     // Packet out of order
+    uint32_t tp_sessions_aborted_timeout;   // Not completed within 'timeout_multi_frame'
+    uint32_t tp_sessions_aborted_remote;    // Connection abort, or superseded by a new announcement on the same addresses
+    uint32_t candidate_overflows;           // New candidates lost because 'max_candidate_dtcs' was reached
+    uint32_t active_overflows;              // Promotions lost because 'max_active_dtcs' was reached
+    uint32_t candidate_quota_overflows;     // New candidates lost because their source reached its candidate quota
+    uint32_t active_quota_overflows;        // Promotions lost because their source reached its active quota
+    uint32_t multi_frame_slot_overflows;    // Sessions not opened because 'max_multi_frame' sessions were open
+    uint32_t multi_frame_size_overflows;    // Sessions not opened because of 'max_multi_frame_data_size'
+    uint32_t multi_frame_pool_overflows;    // Sessions not opened because the reassembly pool had no room
+    uint32_t candidate_peak;                // Highest number of candidates since the last reset
+    uint32_t active_peak;                   // Highest number of active DTCs since the last reset
+    uint32_t multi_frame_peak;              // Highest number of concurrent multi-frame sessions since the last reset
+    uint32_t process_frame_cycles[DTC_STATS_HISTOGRAM_BINS]; // Duration of 'process_dtc_frame' calls ('dtc_port_cycle_count' units)
+    uint32_t process_frame_max_cycles;
+    uint32_t check_dtcs_cycles[DTC_STATS_HISTOGRAM_BINS];    // Duration of 'check_dtcs' calls, excluding the updated callback
+    uint32_t check_dtcs_max_cycles;
+} DtcParserStats_t;
+
 /**
  * @brief Struct for debounces logic
+ *
+ * The times are in ticks of the parser time base (`set_dtc_time_base`), seconds by default.
  */
 typedef struct  {
     uint32_t dtc_active_read_count;       // Number of read_count that must occur within a time window for a DTC to become active
-    uint32_t dtc_active_time_window;      // Time window for a DTC to become active (in seconds)
-    uint32_t debounce_dtc_inactive_time;  // Remove DTCs that have not been updated by this amount of time (seconds)
+    uint32_t dtc_active_time_window;      // Time window for a DTC to become active (in ticks)
+    uint32_t debounce_dtc_inactive_time;  // Remove DTCs that have not been updated by this amount of time (ticks)
     uint32_t timeout_multi_frame;           // Maximum time to receive a complete multiframe message, otherwise discards the message
 } DtcParseConfig_t;
 
 /**
  * @brief Callback type for active DTCs updated
+ *
+ * `user_data` is the pointer given to `register_dtc_updated_callback`, it allows the user
+ * to know which parser instance (e.g. which CAN bus or vehicle) is notifying.
+ */
+typedef void (*UpdatedActiveDTCsCallback)(void* user_data, const DTC_Info_t* active_dtcs, const size_t active_dtcs_count);
+
+/**
+ * @brief Callback type for multi-frame messages of other PGNs than DM1 (see `register_tp_message_callback`)
+ *
+ * `data` holds the `length` bytes of the reassembled message, it is only valid during the call.
  */
-typedef void (*UpdatedActiveDTCsCallback)(const DTC_Info_t* active_dtcs, const size_t active_dtcs_count);
+typedef void (*TpMessageCallback)(void* user_data, uint32_t pgn, uint8_t src, uint8_t dst, const uint8_t* data, size_t length, uint32_t timestamp);
+
+/**
+ * @brief Struct describing the tables of a parser instance, provided by the caller
+ *
+ * Usually filled by `DTC_PARSER_STORAGE` from buffers declared with `DTC_PARSER_BUFFERS`, so
+ * every size is derived from the array sizes at compile time.
+ */
+typedef struct {
+    DTC_Info_t* candidate_dtcs;              // 'max_candidate_dtcs' entries
+    DTC_Info_t* active_dtcs;                 // 'max_active_dtcs' entries
+    uint32_t* candidate_keys;                // 'max_candidate_dtcs' entries
+    uint32_t* active_keys;                   // 'max_active_dtcs' entries
+    uint16_t* candidate_index_slots;         // 'max_candidate_dtcs' entries
+    uint16_t* active_index_slots;            // 'max_active_dtcs' entries
+    DTC_Info_t* snapshot_dtcs;               // 2x 'max_active_dtcs' entries
+    MultiFrameMessage* multi_frame_messages; // 'max_multi_frame' entries (at most 255)
+    uint8_t* multi_frame_pool;               // 'multi_frame_pool_chunks' x DTC_MULTIFRAME_CHUNK_SIZE bytes shared by all the slots
+    uint32_t* multi_frame_pool_map;          // One bit per pool chunk, set while in use
+    uint32_t* index_keys;                    // 'index_size' entries
+    uint16_t* index_refs;                    // 'index_size' entries
+    DtcTimer_t* timer_heap;                  // 'max_candidate_dtcs' + 'max_active_dtcs' + 'max_multi_frame' entries
+    size_t max_candidate_dtcs;
+    size_t max_active_dtcs;
+    size_t max_multi_frame;                  // Concurrent multi-frame messages (at most 255)
+    size_t multi_frame_pool_chunks;          // Chunks of the reassembly pool (at most 65535)
+    size_t max_multi_frame_data_size;        // Maximum data size of a multi-frame message, bigger messages are discarded
+    size_t index_size;                       // Power of 2, at least 2x ('max_candidate_dtcs' + 'max_active_dtcs')
+} DtcParserStorage_t;
+
+/**
+ * @brief Declares the struct type of the tables of a parser instance with the given capacities
+ *
+ * The multi-frame slots share a pool of `chunk_n` chunks of 7 bytes: a session only takes the
+ * chunks of its announced packets, so many slots can be configured for buses where many ECUs
+ * broadcast DM1 at the same time without reserving the maximum message size for each of them.
+ *
+ * @code
+ * static DTC_PARSER_BUFFERS(4, 8, 2, DTC_MULTIFRAME_CHUNKS_FOR(64), DTC_INDEX_SIZE_FOR(4 + 8)) body_buffers; // 944 bytes
+ * @endcode
+ */
+#define DTC_PARSER_BUFFERS(active_n, candidate_n, multi_frame_n, chunk_n, index_n) struct { \
+    DTC_Info_t candidate_dtcs[candidate_n];                      \
+    DTC_Info_t active_dtcs[active_n];                            \
+    uint32_t candidate_keys[candidate_n];                        \
+    uint32_t active_keys[active_n];                              \
+    uint16_t candidate_index_slots[candidate_n];                 \
+    uint16_t active_index_slots[active_n];                       \
+    DTC_Info_t snapshot_dtcs[2 * (active_n)];                    \
+    MultiFrameMessage multi_frame_messages[multi_frame_n];       \
+    uint8_t multi_frame_pool[(chunk_n) * DTC_MULTIFRAME_CHUNK_SIZE]; \
+    uint32_t multi_frame_pool_map[((chunk_n) + 31) / 32];        \
+    uint32_t index_keys[index_n];                                \
+    uint16_t index_refs[index_n];                                \
+    DtcTimer_t timer_heap[(active_n) + (candidate_n) + (multi_frame_n)]; \
+}
+
+/**
+ * @brief Builds the `DtcParserStorage_t` of buffers declared with `DTC_PARSER_BUFFERS`
+ *
+ * The maximum multi-frame data size is the whole pool (at most the 1785 bytes of J1939), it can
+ * be lowered in the returned descriptor.
+ */
+#define DTC_PARSER_STORAGE(buffers) ((DtcParserStorage_t){                                                          \
+    .candidate_dtcs = (buffers).candidate_dtcs,                                                                      \
+    .active_dtcs = (buffers).active_dtcs,                                                                            \
+    .candidate_keys = (buffers).candidate_keys,                                                                      \
+    .active_keys = (buffers).active_keys,                                                                            \
+    .candidate_index_slots = (buffers).candidate_index_slots,                                                        \
+    .active_index_slots = (buffers).active_index_slots,                                                              \
+    .snapshot_dtcs = (buffers).snapshot_dtcs,                                                                        \
+    .multi_frame_messages = (buffers).multi_frame_messages,                                                          \
+    .multi_frame_pool = (buffers).multi_frame_pool,                                                                  \
+    .multi_frame_pool_map = (buffers).multi_frame_pool_map,                                                          \
+    .index_keys = (buffers).index_keys,                                                                              \
+    .index_refs = (buffers).index_refs,                                                                              \
+    .timer_heap = (buffers).timer_heap,                                                                              \
+    .max_candidate_dtcs = sizeof((buffers).candidate_dtcs) / sizeof(DTC_Info_t),                                     \
+    .max_active_dtcs = sizeof((buffers).active_dtcs) / sizeof(DTC_Info_t),                                           \
+    .max_multi_frame = sizeof((buffers).multi_frame_messages) / sizeof(MultiFrameMessage),                           \
+    .multi_frame_pool_chunks = sizeof((buffers).multi_frame_pool) / DTC_MULTIFRAME_CHUNK_SIZE,                        \
+    .max_multi_frame_data_size = sizeof((buffers).multi_frame_pool) < 1785 ? sizeof((buffers).multi_frame_pool) : 1785, \
+    .index_size = sizeof((buffers).index_refs) / sizeof(uint16_t),                                                   \
+})
+
+/**
+ * @brief Parser context, holds the whole state of one DTC parser instance
+ *
+ * The user allocates one context per CAN bus (statically or from a pool), initializes it
+ * with `init_dtc_parser` and passes it as handle to every library function. Instances don't
+ * share any state, so different instances can be used concurrently from different threads.
+ * The members are private to the library and must not be accessed directly.
+ */
+typedef struct {
+    DTC_Info_t* candidate_dtcs;
+    size_t candidate_dtcs_count;
+    size_t max_candidate_dtcs;
+    DTC_Info_t* active_dtcs;
+    size_t active_dtcs_count;
+    size_t max_active_dtcs;
+    uint32_t* candidate_keys;                    // Packed (src, spn, fmi) of each candidate, contiguous for the key scans
+    uint32_t* active_keys;                       // Packed (src, spn, fmi) of each active DTC
+    uint16_t* candidate_index_slots;             // Hash index slot of each candidate, moved entries are re-pointed without a probe
+    uint16_t* active_index_slots;                // Hash index slot of each active DTC
+    MultiFrameMessage* multi_frame_messages;
+    size_t multi_frame_count;                    // Slots of 'multi_frame_messages' in use
+    size_t max_multi_frame;
+    size_t max_multi_frame_data_size;
+    uint8_t* multi_frame_pool;                   // Reassembly chunks shared by the multi-frame slots
+    uint32_t* multi_frame_pool_map;              // Pool chunks in use, one bit each
+    size_t multi_frame_pool_chunks;
+    uint8_t multi_frame_free;                    // First free multi-frame slot (slot + 1), 0 if all are in use
+    uint8_t session_by_src[256];                 // First multi-frame session of each source address (slot + 1), 0 if none
+    #if DTC_PARSER_USE_SOURCE_QUOTA
+    uint16_t candidate_count_by_src[256];        // Candidates of each source address
+    uint16_t active_count_by_src[256];           // Active DTCs of each source address
+    size_t max_candidate_per_src;                // Candidate quota of each source address, 0 if none ('set_dtc_source_quota')
+    size_t max_active_per_src;                   // Active DTC quota of each source address, 0 if none
+    #endif
+    UpdatedActiveDTCsCallback updated_active_dtcs_callback;
+    void* updated_active_dtcs_user_data;
+    TpMessageCallback tp_message_callback;
+    void* tp_message_user_data;
+    bool changed_dtc_list;
+    dtc_atomic_u32_t dtc_mutex;                  // Try-lock word: 0 free, 1 taken
+    #if DTC_PARSER_USE_SEQLOCK
+    dtc_atomic_u32_t active_dtcs_seq;            // Seqlock counter, odd while the active list is being written
+    #endif
+    DTC_Info_t* snapshot_dtcs[2];                // Double buffered copy of the active list for lock-free readers
+    size_t snapshot_dtcs_count[2];
+    dtc_atomic_u32_t snapshot_generation;        // Generation of the published snapshot, buffer index is 'generation & 1'
+    dtc_atomic_u32_t snapshot_readers[2];        // Readers currently holding each snapshot buffer
+    bool snapshot_pending;                       // Active list changed but could not be published yet
+    uint32_t notify_min_interval;                // Minimum ticks between two updated callbacks, 0 for every change ('set_dtc_notify_policy')
+    uint32_t notify_flags;                       // DTC_NOTIFY_* flags
+    bool notify_pending;                         // Change not notified yet (interval running or snapshot not published)
+    bool notify_urgent;                          // The pending change bypasses the interval (MIL/RSL lamp)
+    bool notified;                               // A notification was made, 'last_notify' and 'notified_signature' are valid
+    uint32_t last_notify;                        // Timestamp of the last notification
+    uint64_t notified_signature;                 // Signature of the active list last notified, for coalescing
+    DtcParseConfig_t dtcParseCfg;
+    uint32_t ticks_per_second;                   // Unit of the timestamps given to the parser ('set_dtc_time_base')
+    uint32_t options;                            // DTC_OPT_* flags
+    uint32_t* index_keys;                        // Hash index: packed (src, spn, fmi) keys
+    uint16_t* index_refs;                        // Hash index: position in the candidate/active list, 0 if empty
+    uint32_t index_mask;                         // Hash index size - 1
+    DtcTimer_t* timer_heap;                      // Expiry timers ordered by deadline (binary min-heap)
+    size_t timer_heap_count;
+    size_t timer_heap_size;
+    bool timer_rebuild_pending;                  // Debounce times changed, timers must be re-armed
+    uint32_t session_timer_map[8];               // Multi-frame slots with a timer in the heap, one bit each (at most one per slot)
+    Dm1RepeatCache_t dm1_cache[DTC_DM1_CACHE_SIZE]; // Last DM1 of the sources whose DTCs are all active ('DTC_OPT_DM1_REPEAT_CACHE')
+    uint8_t dm1_cache_by_src[256];               // Repeat cache entry of each source address (entry + 1), 0 if none
+    uint32_t dm1_cache_clock;                    // Incremented on every store or hit of the repeat cache
+    uint32_t active_layout_generation;           // Incremented whenever active DTCs are removed (positions move)
+    CanFrame_t frame_ring[DTC_FRAME_RING_SIZE];  // SPSC ring: ISR produces, parsing task consumes
+    dtc_atomic_u32_t frame_ring_head;            // Written only by the producer
+    dtc_atomic_u32_t frame_ring_tail;            // Written only by the consumer
+    dtc_atomic_u32_t frame_ring_overflows;       // Frames lost because the ring was full
+    DtcEvent_t event_ring[DTC_EVENT_RING_SIZE];  // SPSC ring of 'DTC_OPT_EVENT_RING': mutex holder produces, 'read_dtc_events' consumes
+    dtc_atomic_u32_t event_ring_head;            // Written only by the producer
+    dtc_atomic_u32_t event_ring_tail;            // Written only by the consumer
+    dtc_atomic_u32_t event_ring_overflows;       // Events lost because the ring was full
+    #if DTC_PARSER_USE_TRACE
+    uint32_t trace_mask;                         // DTC_TRACE_* categories recorded
+    DtcTraceRecord_t trace_ring[DTC_TRACE_RING_SIZE]; // SPSC ring: mutex holder produces, 'read_dtc_trace' consumes
+    dtc_atomic_u32_t trace_ring_head;            // Written only by the producer
+    dtc_atomic_u32_t trace_ring_tail;            // Written only by the consumer
+    dtc_atomic_u32_t trace_ring_overflows;       // Records lost because the ring was full
+    #endif
+    #if DTC_PARSER_USE_STATS
+    DtcParserStats_t stats;                      // Counters updated with the mutex held
+    dtc_atomic_u32_t frames_seen;                // Counters also updated without the mutex
+    dtc_atomic_u32_t frames_dropped_locked;
+    #endif
+    #if DTC_PARSER_EMBEDDED_STORAGE
+    DTC_PARSER_BUFFERS(MAX_ACTIVE_DTCS, MAX_CANDIDATE_DTCS, MAX_CONCURRENT_MULTIFRAME,
+        MAX_CONCURRENT_MULTIFRAME * DTC_MULTIFRAME_CHUNKS_FOR(MAX_MULTIFRAME_DATA_SIZE), DTC_INDEX_SIZE) embedded; // Tables of 'init_dtc_parser'
+    #endif
+} DtcParser_t;
+
+#if DTC_PARSER_EMBEDDED_STORAGE
+/**
+ * @brief Initializes a parser context
+ *
+ * Clears the DTC lists and applies the default debounce configuration and options
+ * (`DTC_PARSER_DEFAULT_OPTIONS`). It must be called once for each context before using it
+ * with any other function of the library. The tables are the ones embedded in the context,
+ * sized by `MAX_ACTIVE_DTCS`, `MAX_CANDIDATE_DTCS`, `MAX_CONCURRENT_MULTIFRAME` and
+ * `MAX_MULTIFRAME_DATA_SIZE`.
+ *
+ * @param parser Parser context to be initialized
+ */
+void init_dtc_parser(DtcParser_t* parser);
+#endif
+
+/**
+ * @brief Initializes a parser context with tables provided by the caller
+ *
+ * Same as `init_dtc_parser`, but the capacities are chosen per instance: a small ECU variant
+ * and a gateway can run the same library with different footprints. The storage must stay
+ * valid while the context is in use and must not be shared with another context.
+ * The counts of `copy_dtcs`, `dynamic_copy_dtcs` and `get_reference_to_dtcs` are `size_t`, so
+ * every read API reports the full list of instances with more than 255 active DTCs.
+ *
+ * Example usage:
+ * @code
+ * static DTC_PARSER_BUFFERS(4, 8, 2, DTC_MULTIFRAME_CHUNKS_FOR(64), DTC_INDEX_SIZE_FOR(4 + 8)) body_buffers;
+ * static DtcParser_t body_parser;
+ * init_dtc_parser_with_storage(&body_parser, &DTC_PARSER_STORAGE(body_buffers));
+ * @endcode
+ *
+ * @param parser Parser context to be initialized
+ * @param storage Tables of the instance, the descriptor itself is copied
+ * @return bool True on success, false if a table is missing or the sizes are not valid (see `DtcParserStorage_t`)
+ */
+bool init_dtc_parser_with_storage(DtcParser_t* parser, const DtcParserStorage_t* storage);
+
+/**
+ * @brief Selects the optional engine features of a parser instance, it has a built-in mutex protection
+ *
+ * The options can be changed at any time, the internal structures are rebuilt from the current
+ * DTC lists. Passing 0 selects the plain reference implementation (linear lists).
+ *
+ * With `DTC_OPT_STREAM_DM1` each DTC of a DM1 sent over BAM or RTS/CTS is processed as soon as the TP.DT
+ * packet carrying its last byte arrives, with the timestamp of that packet, instead of all of
+ * them at the last packet. No reassembly chunks are used (nor limited by
+ * `max_multi_frame_data_size`), only a few bytes of state per session. The DTCs received before
+ * a session is aborted (packet out of order or timeout) are kept. The option applies to the
+ * sessions announced after it is set.
+ *
+ * With `DTC_OPT_DM1_REPEAT_CACHE` (default) the last DM1 payload of up to `DTC_DM1_CACHE_SIZE`
+ * sources is kept as raw bytes when all its DTCs are active, any source address in any entry
+ * (the least recently used one is replaced). The periodic repeat of those bytes, the steady state of an
+ * ECU with standing faults, refreshes the last_seen of its DTCs in place, without decoding the
+ * DTCs or looking them up. It is bypassed while the `DTC_TRACE_DM1_PARSED` trace is enabled and
+ * for the streamed sessions of `DTC_OPT_STREAM_DM1`.
+ *
+ * @param parser Parser context
+ * @param options Bitwise OR of `DTC_OPT_*` flags
+ * @return bool True if the options were applied, false if the mutex was not available
+ */
+bool set_dtc_parser_options(DtcParser_t* parser, uint32_t options);
 
 /**
  * @brief Attempts to acquire the mutex protecting the DTC list.
@@ -97,51 +575,133 @@ typedef void (*UpdatedActiveDTCsCallback)(const DTC_Info_t* active_dtcs, const s
  * to the DTC list is not available. The user should always pair this function with 
  * `give_dtc_mutex` to ensure the mutex is properly released.
  *
+ * The mutex is a non-blocking try-lock implemented with an atomic compare-and-swap
+ * (see `dtc_parser_port.h`), so only one caller can win even when the parser is accessed
+ * from several cores or threads at the same time.
+ *
+ * @param parser Parser context
  * @return bool True if the mutex was successfully taken, false if the mutex is already occupied.
  */
-bool take_dtc_mutex(void);
+bool take_dtc_mutex(DtcParser_t* parser);
 
 /**
  * @brief Releases the mutex protecting the DTC list.
  *
  * This function releases the mutex, allowing other parts of the program to access the DTC list. 
  * It should always be called after a successful call to `take_dtc_mutex`.
+ *
+ * @param parser Parser context
  */
-void give_dtc_mutex(void);
+void give_dtc_mutex(DtcParser_t* parser);
 
 /**
  * @brief Sets the debounce times for DTCs
  *
+ * The times are converted to ticks of the parser time base, saturated to UINT32_MAX ticks
+ * (see `set_dtc_time_base`).
+ *
+ * @param parser Parser context
  * @param _dtc_active_read_count_ Number of read_count that must occur within a time window for a DTC to become active
  * @param _dtc_active_time_window_ Time window for a DTC to become active (in seconds)
  * @param _debounce_dtc_inactive_time_ Remove DTCs that have not been updated by this amount of time (seconds)
  * @param _timeout_multi_frame_ Maximum time to receive a complete multiframe message, otherwise discards the message
  */
-void set_dtc_filtering(uint32_t _dtc_active_read_count_, uint32_t _dtc_active_time_window_, uint32_t _debounce_dtc_inactive_time_, uint32_t _timeout_multi_frame_);
+void set_dtc_filtering(DtcParser_t* parser, uint32_t _dtc_active_read_count_, uint32_t _dtc_active_time_window_, uint32_t _debounce_dtc_inactive_time_, uint32_t _timeout_multi_frame_);
+
+/**
+ * @brief Sets the debounce times for DTCs in ticks of the parser time base
+ *
+ * Same as `set_dtc_filtering` for times that are not whole seconds, e.g. a 750 ms multi-frame
+ * timeout with a millisecond time base (`set_dtc_time_base`).
+ *
+ * @param parser Parser context
+ * @param _dtc_active_read_count_ Number of read_count that must occur within a time window for a DTC to become active
+ * @param _dtc_active_time_window_ Time window for a DTC to become active (in ticks)
+ * @param _debounce_dtc_inactive_time_ Remove DTCs that have not been updated by this amount of time (ticks)
+ * @param _timeout_multi_frame_ Maximum time to receive a complete multiframe message (ticks)
+ */
+void set_dtc_filtering_ticks(DtcParser_t* parser, uint32_t _dtc_active_read_count_, uint32_t _dtc_active_time_window_, uint32_t _debounce_dtc_inactive_time_, uint32_t _timeout_multi_frame_);
+
+/**
+ * @brief Sets the unit of every timestamp given to and kept by the parser
+ *
+ * By default the timestamps of the frames and of `check_dtcs` are in seconds. With a finer time
+ * base (e.g. 1000 for milliseconds, 1000000 for microseconds) the debounce times are measured to
+ * the tick, and `check_dtcs` can run at any rate, so a promoted DTC is reported within one
+ * `check_dtcs` period instead of up to a second later. `first_seen`, `last_seen` and the event
+ * and trace timestamps are then in the same ticks.
+ *
+ * The timestamps are free running 32-bit counters, the comparisons are wrap-safe as long as the
+ * debounce times and the `check_dtcs` period stay below 2^31 ticks (about 24 days in milliseconds,
+ * 35 minutes in microseconds). The debounce times already configured keep their duration, they
+ * are converted to the new unit. It must be called before the first frame, usually right after
+ * `init_dtc_parser`, since the timestamps already stored are not converted.
+ *
+ * A time that does not fit in 32 bits once converted to ticks, here or by `set_dtc_filtering`
+ * (above about 4294 s in microseconds), is saturated to UINT32_MAX ticks instead of wrapping.
+ *
+ * @param parser Parser context
+ * @param ticks_per_second Timestamp ticks per second, 1 for seconds
+ * @return bool True if the time base was applied, false if `ticks_per_second` is 0
+ */
+bool set_dtc_time_base(DtcParser_t* parser, uint32_t ticks_per_second);
 
 /**
- * @brief Registers a callback function to be notified when the active DTC list is updated, it has a built-in mutex protection
+ * @brief Registers a callback function to be notified when the active DTC list is updated
  *
  * This function allows the user to register a callback that will be invoked whenever the 
  * active DTC list changes (e.g., when a new DTC is added or an existing DTC is removed).
- * The callback function is called with a pointer to the current list of active DTCs and 
- * the number of active DTCs. The library ensures thread safety by managing the mutex 
- * internally: before invoking the callback, it acquires the mutex protecting the DTC list 
- * and releases it after the callback has returned.
+ * The callback is called by `check_dtcs`, with a pointer to the published snapshot of the
+ * active list (see `acquire_dtc_snapshot`) and the number of active DTCs, at most once per
+ * interval of `set_dtc_notify_policy`.
  *
- * The user does not need to manually handle mutexes when using this callback mechanism, as 
- * the library automatically handles concurrency to prevent race conditions.
- * 
- * While the callback is executing, the mutex is held. This means that if a CAN frame arrives 
- * during the callback execution (e.g., via `process_dtc_frame` in an CAN Interrupt Service Routine), the frame 
- * will be discarded because the mutex is occupied. Therefore, it's important minimize the time the callback is executed 
- * to avoid potential frame losses.
+ * The callback runs after `check_dtcs` has released the mutex, so the frames that arrive during
+ * its execution (e.g., via `process_dtc_frame` in an CAN Interrupt Service Routine) are processed
+ * instead of discarded, and the callback may call the other functions of the library. The list
+ * given to it stays valid and unchanged until the callback returns, it must not be kept after.
  *
+ * @param parser Parser context
  * @param callback The user-defined function to be called when the active DTC list is updated. 
- *                 The callback function should accept two parameters: a pointer to the active 
- *                 DTC list (`const DTC_Info_t*`) and the number of active DTCs (`size_t`).
+ *                 The callback function should accept three parameters: the registered `user_data`,
+ *                 a pointer to the active DTC list (`const DTC_Info_t*`) and the number of active DTCs (`size_t`).
+ * @param user_data User pointer passed back to the callback, can be NULL
+ */
+void register_dtc_updated_callback(DtcParser_t* parser, UpdatedActiveDTCsCallback callback, void* user_data);
+
+/**
+ * @brief Sets when the changes of the active list are notified to the updated callback
+ *
+ * By default every `check_dtcs` that finds the list changed calls the updated callback. During
+ * fault storms (e.g. low voltage while cranking) DTCs flap and the whole list would be reported
+ * on every call. With a minimum interval the changes are accumulated and notified at most once
+ * per interval, and a list that is back to the one last notified (a DTC added and then removed
+ * within the interval) is not notified at all (counted in `notifications_coalesced`). With
+ * `DTC_NOTIFY_LAMP_BYPASS` the changes of the MIL and RSL lamps are still notified on the next
+ * `check_dtcs`. The interval is in ticks of the time base and is converted by later calls to
+ * `set_dtc_time_base`.
+ *
+ * @param parser Parser context
+ * @param min_interval Minimum ticks between two notifications, 0 for every change (default)
+ * @param flags DTC_NOTIFY_* flags
+ * @return true If the policy was set
+ * @return false If the mutex was taken
+ */
+bool set_dtc_notify_policy(DtcParser_t* parser, uint32_t min_interval, uint32_t flags);
+
+/**
+ * @brief Registers a callback function for the DM2 messages received over the transport protocol
+ *
+ * DM1 multi-frame messages always feed the DTC lists. DM2 (previously active DTCs, usually a
+ * reply requested over RTS/CTS by a diagnostic tool) is reassembled only while a callback is
+ * registered, and given to it as raw bytes (same layout as DM1: lamp status, then 4 bytes per
+ * DTC). Single frame DM2 messages are not tracked by the parser. Unlike the DTC updated
+ * callback, it is called with the mutex held, from the context that processes the frames.
+ *
+ * @param parser Parser context
+ * @param callback The user-defined function to be called with each complete message, NULL to stop the DM2 reassembly
+ * @param user_data User pointer passed back to the callback, can be NULL
  */
-void register_dtc_updated_callback(UpdatedActiveDTCsCallback callback);
+void register_tp_message_callback(DtcParser_t* parser, TpMessageCallback callback, void* user_data);
 
 
 /**
@@ -154,29 +714,238 @@ void register_dtc_updated_callback(UpdatedActiveDTCsCallback callback);
  * be aware that skipping a CAN frame could result in missing a DTC frame, but it is 
  * necessary to maintain concurrence safety in a bare-metal environment.
  *
+ * Transport sessions are found through a 256-entry table by source address, chained by
+ * destination, so a TP.DT frame of a source without a session is rejected with one table read.
+ * RTS/CTS sessions are listened passively: a CTS keeps the session alive, a retransmitted packet
+ * is ignored and a connection abort from either side closes it.
+ *
  * @param can_id CAN message ID
  * @param data CAN message data
- * @param timestamp Timestamp of the message in seconds
+ * @param timestamp Timestamp of the message in ticks (seconds unless changed by `set_dtc_time_base`)
  */
 
-void process_dtc_frame(uint32_t can_id, uint8_t data[8], uint32_t timestamp);
+void process_dtc_frame(DtcParser_t* parser, uint32_t can_id, uint8_t data[8], uint32_t timestamp);
+
+/**
+ * @brief Selects the DTC related frames (DM1, TP.CM, TP.DT) of a frame buffer
+ *
+ * Classifies the CAN IDs several at a time (8 with AVX2, 4 with SSE2 or NEON, one by one
+ * otherwise, see `DTC_PARSER_USE_SIMD`) and writes the positions of the matching frames, in
+ * order, to `dtc_indexes`. It does not access any parser context, so it can run without the mutex.
+ *
+ * @param frames CAN frames
+ * @param frame_count Number of frames in `frames`
+ * @param dtc_indexes Output buffer of at least `frame_count` entries
+ * @return size_t Number of DTC related frames, written to the start of `dtc_indexes`
+ */
+size_t filter_dtc_frames(const CanFrame_t* frames, size_t frame_count, uint32_t* dtc_indexes);
+
+/**
+ * @brief Processes a batch of CAN frames and updates DTCs, it has a built-in mutex protection
+ *
+ * Batch version of `process_dtc_frame` for task context (e.g. frames read with `recvmmsg` on
+ * SocketCAN): the mutex is taken once for the whole batch, frames that are not DTC related
+ * (DM1, TP.CM, TP.DT) are skipped by `filter_dtc_frames` and only DTC frames are parsed, in order.
+ * If no frame of the batch is DTC related the mutex is not taken at all. If the mutex is
+ * occupied the DTC frames of the batch are discarded and reported through `dropped`.
+ *
+ * @param parser Parser context
+ * @param frames CAN frames, in reception order
+ * @param frame_count Number of frames in `frames`
+ * @param dropped Optional pointer where the number of DTC frames discarded because the mutex was occupied is stored, can be NULL
+ * @return size_t Number of DTC frames parsed (non DTC frames are not counted)
+ */
+size_t process_dtc_frames(DtcParser_t* parser, const CanFrame_t* frames, size_t frame_count, size_t* dropped);
+
+/**
+ * @brief Pushes a CAN frame into the parser frame ring, safe to be called from an ISR
+ *
+ * Alternative to `process_dtc_frame` for interrupt context: the frame is only copied into a
+ * fixed-size lock-free single-producer/single-consumer ring, it never waits for nor depends on
+ * the DTC list mutex, so frames are not discarded while the list is being accessed elsewhere.
+ * Frames that are not DTC related (DM1, TP.CM, TP.DT) are ignored without using ring space.
+ * The buffered frames are parsed later on task context by `drain_dtc_frames`.
+ *
+ * Only one producer (e.g. a single CAN ISR) may call this function for a given parser context.
+ *
+ * @param parser Parser context
+ * @param can_id CAN message ID
+ * @param data CAN message data
+ * @param timestamp Timestamp of the message in ticks (seconds unless changed by `set_dtc_time_base`)
+ * @return bool True if the frame was buffered (or ignored), false if the ring was full and the frame was lost
+ */
+bool enqueue_dtc_frame(DtcParser_t* parser, uint32_t can_id, const uint8_t data[8], uint32_t timestamp);
+
+/**
+ * @brief Parses every frame buffered by `enqueue_dtc_frame`, it has a built-in mutex protection
+ *
+ * Must be called from task context (single consumer), usually right before `check_dtcs`.
+ * If the mutex is occupied the frames stay in the ring and will be parsed on the next call.
+ *
+ * @param parser Parser context
+ * @return size_t Number of frames parsed
+ */
+size_t drain_dtc_frames(DtcParser_t* parser);
+
+/**
+ * @brief Returns how many frames were lost because the frame ring was full
+ *
+ * @param parser Parser context
+ * @return uint32_t Number of frames rejected by `enqueue_dtc_frame` since the parser initialization
+ */
+uint32_t get_dtc_frame_ring_overflows(DtcParser_t* parser);
+
+/**
+ * @brief Reads the delta events of the active DTC list, lock-free
+ *
+ * With the `DTC_OPT_EVENT_RING` option the library records every change of the active DTC list
+ * as a compact event (`DTC_EVENT_ADDED`, `DTC_EVENT_REMOVED`, `DTC_EVENT_CHANGED`) in a bounded
+ * lock-free single-producer/single-consumer ring, so an uplink sends only what changed instead of
+ * diffing the whole list given to the callback. The events are read without taking the mutex,
+ * so neither the parser nor `process_dtc_frame` are ever delayed by the consumer.
+ *
+ * Only one consumer may call this function for a given parser context. If the consumer is too slow
+ * and the ring gets full, the new events are lost and counted by `get_dtc_event_overflows`; the
+ * consumer should then resynchronize from a full copy of the list (e.g. `acquire_dtc_snapshot`).
+ *
+ * Example usage:
+ * @code
+ * DtcEvent_t events[16];
+ * size_t event_count;
+ * while ((event_count = read_dtc_events(&parser, events, 16)) > 0) {
+ *     // Send the events here, no lock is held
+ * }
+ * @endcode
+ *
+ * @param parser Parser context
+ * @param events Output buffer
+ * @param max_events Number of events that fit in `events`
+ * @return size_t Number of events stored in `events`, oldest first
+ */
+size_t read_dtc_events(DtcParser_t* parser, DtcEvent_t* events, size_t max_events);
+
+/**
+ * @brief Returns how many delta events were lost because the event ring was full
+ *
+ * @param parser Parser context
+ * @return uint32_t Number of events lost since the parser initialization
+ */
+uint32_t get_dtc_event_overflows(DtcParser_t* parser);
+
+/**
+ * @brief Copies the instrumentation counters and cycle histograms, it has a built-in mutex protection
+ *
+ * Meant to size the tables (`*_overflows`, `*_peak`) and to check the time budget of the CAN ISR on the
+ * target (`process_frame_cycles`) from a low priority task. With `DTC_PARSER_USE_STATS` set to 0
+ * the counters are not compiled at all and this function always fails.
+ *
+ * @param parser Parser context
+ * @param stats Output snapshot
+ * @return bool True if `stats` was filled, false if the mutex was not available or the stats are disabled
+ */
+bool get_dtc_parser_stats(DtcParser_t* parser, DtcParserStats_t* stats);
+
+/**
+ * @brief Clears the instrumentation counters and cycle histograms, it has a built-in mutex protection
+ *
+ * @param parser Parser context
+ * @return bool True if the counters were cleared, false if the mutex was not available or the stats are disabled
+ */
+bool reset_dtc_parser_stats(DtcParser_t* parser);
+
+/**
+ * @brief Selects the categories recorded in the binary trace, it has a built-in mutex protection
+ *
+ * The trace replaces `printf` debugging inside the CAN ISR: the parser only stores an event ID
+ * and its raw arguments (`DtcTraceRecord_t`) in a lock-free ring, a low priority task reads them
+ * with `read_dtc_trace` and formats them with `format_dtc_trace_record` (or stores them to be
+ * formatted offline). A disabled category costs one test, so the trace can stay compiled in
+ * production units. The mask is 0 (nothing recorded) after the initialization.
+ *
+ * @param parser Parser context
+ * @param mask Bitwise OR of `DTC_TRACE_*` categories
+ * @return bool True if the mask was applied, false if the mutex was not available or the trace is disabled
+ */
+bool set_dtc_trace_mask(DtcParser_t* parser, uint32_t mask);
+
+/**
+ * @brief Reads the binary trace records, lock-free
+ *
+ * Only one consumer may call this function for a given parser context. If the ring gets full
+ * the new records are lost and counted by `get_dtc_trace_overflows`.
+ *
+ * @param parser Parser context
+ * @param records Output buffer
+ * @param max_records Number of records that fit in `records`
+ * @return size_t Number of records stored in `records`, oldest first
+ */
+size_t read_dtc_trace(DtcParser_t* parser, DtcTraceRecord_t* records, size_t max_records);
+
+/**
+ * @brief Returns how many trace records were lost because the trace ring was full
+ *
+ * @param parser Parser context
+ * @return uint32_t Number of records lost since the parser initialization
+ */
+uint32_t get_dtc_trace_overflows(DtcParser_t* parser);
 
 /**
  * @brief Check DTCs, *MUST* be called once per second by the user's application
  *
  * This function removes any inactive DTC and checks for any changes in the DTC list. 
- * It returns `true` if the DTC list was updated, and `false` if there were no changes.
- * The function uses a mutex to ensure thread-safe access to the DTC list.
+ * It returns `true` if a DTC list update was notified, and `false` if there were no changes.
+ * The function uses a mutex to ensure thread-safe access to the DTC list, the updated callback
+ * is called after releasing it.
+ * With a time base finer than seconds (`set_dtc_time_base`) it may be called more often, the
+ * changes are reported by the first call after they happened, unless delayed by the notify
+ * policy (`set_dtc_notify_policy`) or by a reader still holding the previous snapshot.
  *
- * @param timestamp Current timestamp in seconds
- * @return bool True if the DTC list was updated, false if there were no changes
+ * @param parser Parser context
+ * @param timestamp Current timestamp in ticks (seconds unless changed by `set_dtc_time_base`)
+ * @return bool True if the DTC list update was notified, false if there were no changes to notify
  */
-bool check_dtcs(uint32_t timestamp);
+bool check_dtcs(DtcParser_t* parser, uint32_t timestamp);
 
 /**
  * @brief Clear DTCs
+ *
+ * @param parser Parser context
+ */
+void clear_dtcs(DtcParser_t* parser);
+
+/**
+ * @brief Clears the candidate and active DTCs of one source address
+ *
+ * The DTCs of the other ECUs and their debounce state are not touched, e.g. to drop the DTCs
+ * of an ECU as soon as it reports a DM1 without faults, or when it leaves the bus. The open
+ * multi-frame sessions of the source are kept, a DM1 being received completes normally. The
+ * active DTCs removed are reported as `DTC_EVENT_REMOVED` events with their last_seen, and the
+ * list change is notified by the next `check_dtcs`.
+ *
+ * @param parser Parser context
+ * @param src J1939 source address (`can_id & 0xFF`)
+ * @return true If the DTCs were cleared
+ * @return false If the mutex was taken, nothing is cleared
  */
-void clear_dtcs();
+bool clear_source_dtcs(DtcParser_t* parser, uint8_t src);
+
+/**
+ * @brief Limits the number of candidate and active DTCs of each source address
+ *
+ * All the ECUs of the bus share the candidate and active lists. Without quotas an ECU that
+ * reports many DTCs can fill `max_candidate_dtcs` and the new DTCs of every other ECU are lost.
+ * With a quota the DTCs of a source beyond it are dropped (and counted in
+ * `candidate_quota_overflows`/`active_quota_overflows`), leaving room for the other sources.
+ * DTCs already stored beyond a new quota are kept until they expire. Not available when
+ * `DTC_PARSER_USE_SOURCE_QUOTA` is 0.
+ *
+ * @param parser Parser context
+ * @param max_candidate_dtcs Candidates per source address, 0 for no quota (default)
+ * @param max_active_dtcs Active DTCs per source address, 0 for no quota (default)
+ * @return true If the quotas were set
+ * @return false If the mutex was taken or the quotas are compiled out
+ */
+bool set_dtc_source_quota(DtcParser_t* parser, size_t max_candidate_dtcs, size_t max_active_dtcs);
 
 /**
  * @brief Prints the DTC list
@@ -190,31 +959,36 @@ void print_dtcs(const DTC_Info_t* list, const size_t count);
  * @brief Copies the current active DTCs into a user-provided buffer.
  *
  * This function copies the list of active DTCs into a user-provided buffer. The buffer size 
- * is checked to ensure it is large enough to hold the active DTC data. The function uses a 
- * mutex to ensure thread-safe access to the DTC list.
+ * is checked to ensure it is large enough to hold the active DTC data. The copy is taken from
+ * the published snapshot (see `acquire_dtc_snapshot`), so the mutex is not taken and frames
+ * are never discarded because of this function. The OC and lamps are the ones of the last
+ * `check_dtcs` call, `last_seen` may be older (see `acquire_dtc_snapshot`).
  *
+ * @param parser Parser context
  * @param buf_dtc_list Pointer to the buffer where the DTC list will be copied
- * @param buf_size Size of the buffer provided by the user
+ * @param buf_size Size of the buffer provided by the user, in bytes
  * @param dtc_count Pointer to a variable where the number of copied DTCs will be stored
- * @return bool True if the DTCs were successfully copied, false if the buffer was too small or the mutex was not available
+ * @return bool True if the DTCs were successfully copied, false if the buffer was too small
  */
-bool copy_dtcs(DTC_Info_t* buf_dtc_list, uint16_t buf_size, uint8_t* dtc_count);
+bool copy_dtcs(DtcParser_t* parser, DTC_Info_t* buf_dtc_list, size_t buf_size, size_t* dtc_count);
 
 /**
  * @brief Dynamically allocates and copies the current active DTCs.
  *
  * This function dynamically allocates memory for the active DTC list and copies the 
- * current active DTCs into it. The function uses a mutex to ensure thread-safe access 
- * to the DTC list. The user is responsible for freeing the allocated memory.
+ * current active DTCs into it. Like `copy_dtcs`, the copy is taken from the published snapshot
+ * without taking the mutex, and the allocation is done before touching the snapshot.
+ * The user is responsible for freeing the allocated memory.
  *
  * Note: The function requires a pointer to a pointer (`DTC_Info_t**`) as the first argument
  * to allow the allocated memory to be returned to the caller.
  *
+ * @param parser Parser context
  * @param buf_dtc_list Pointer to a pointer that will point to the dynamically allocated buffer where the DTC list will be copied
  * @param dtc_count Pointer to a variable where the number of copied DTCs will be stored
- * @return bool True if the DTCs were successfully copied and memory was allocated, false if allocation failed or the mutex was not available
+ * @return bool True if the DTCs were successfully copied and memory was allocated, false if allocation failed
  */
-bool dynamic_copy_dtcs(DTC_Info_t **buf_dtc_list, uint8_t* dtc_count);
+bool dynamic_copy_dtcs(DtcParser_t* parser, DTC_Info_t **buf_dtc_list, size_t* dtc_count);
 
 /**
  * @brief Retrieves a constant pointer to the current list of active DTCs.
@@ -237,19 +1011,104 @@ bool dynamic_copy_dtcs(DTC_Info_t **buf_dtc_list, uint8_t* dtc_count);
  *
  * Example usage:
  * @code
- * if (take_dtc_mutex()) {
- *     uint8_t dtc_count = 0;
- *     const DTC_Info_t* active_dtcs = get_reference_to_dtcs(&dtc_count);
+ * if (take_dtc_mutex(&parser)) {
+ *     size_t dtc_count = 0;
+ *     const DTC_Info_t* active_dtcs = get_reference_to_dtcs(&parser, &dtc_count);
  *     // Write here your code to safely access the active_dtcs list
  *     // Don't take too long here, otherwise you may experience some CAN frame losses.
- *     give_dtc_mutex();
+ *     give_dtc_mutex(&parser);
  * }
  * @endcode
  * 
+ * @param parser Parser context
  * @param dtc_count Pointer to a variable where the number of active DTCs will be stored.
  * @return const DTC_Info_t* Pointer to the list of active DTCs.
  */
-const DTC_Info_t* get_reference_to_dtcs(uint8_t* dtc_count);
+const DTC_Info_t* get_reference_to_dtcs(DtcParser_t* parser, size_t* dtc_count);
+
+/**
+ * @brief Acquires the published snapshot of the active DTC list, zero-copy and lock-free
+ *
+ * The library keeps two copies of the active DTC list and publishes a new one each time
+ * `check_dtcs` detects that the list has changed, or that the OC or a lamp of an active DTC has
+ * changed. This function returns a stable pointer to the
+ * last published copy, which can be read without holding the mutex and without copying it.
+ * The snapshot is never modified while it is acquired: the library postpones a new publication
+ * to the next `check_dtcs` call if a reader still holds the buffer it would overwrite.
+ * Each acquired snapshot *MUST* be released with `release_dtc_snapshot`, and it should not be
+ * held for longer than necessary.
+ *
+ * Note that the snapshot reflects the active list as it was at the last `check_dtcs`: OC and
+ * lamp changes show up after the next call, while `last_seen` refreshes alone don't publish a new
+ * copy, so the `last_seen` of the snapshot may be older than the last DM1 of the DTC.
+ *
+ * Example usage:
+ * @code
+ * size_t dtc_count = 0;
+ * uint32_t generation = 0;
+ * const DTC_Info_t* active_dtcs = acquire_dtc_snapshot(&parser, &dtc_count, &generation);
+ * if (generation != last_sent_generation) {
+ *     // Read active_dtcs here, no lock is held and no frame is discarded meanwhile
+ *     last_sent_generation = generation;
+ * }
+ * release_dtc_snapshot(&parser, generation);
+ * @endcode
+ *
+ * @param parser Parser context
+ * @param dtc_count Pointer to a variable where the number of DTCs in the snapshot will be stored
+ * @param generation Pointer to a variable where the snapshot generation will be stored, it's incremented on every publication
+ * @return const DTC_Info_t* Pointer to the snapshot of the active DTC list
+ */
+const DTC_Info_t* acquire_dtc_snapshot(DtcParser_t* parser, size_t* dtc_count, uint32_t* generation);
+
+/**
+ * @brief Releases a snapshot acquired by `acquire_dtc_snapshot`
+ *
+ * @param parser Parser context
+ * @param generation Generation returned by the matching `acquire_dtc_snapshot`
+ */
+void release_dtc_snapshot(DtcParser_t* parser, uint32_t generation);
+
+#if DTC_PARSER_USE_SEQLOCK
+/**
+ * @brief Starts a lock-free read of the active DTC list (seqlock)
+ *
+ * Readers that only need to look at the active DTC list can use the seqlock instead of
+ * `take_dtc_mutex`, so they never block each other nor make `process_dtc_frame` discard frames.
+ * The writer (the library) is never delayed by readers, instead a reader detects that the list
+ * was modified while it was being read and must read it again.
+ * Data read between `read_dtcs_begin` and `read_dtcs_retry` may be inconsistent and must only
+ * be used once `read_dtcs_retry` returns `false`, so it is usually copied to a local buffer.
+ *
+ * Don't use it from a context that can preempt the writer (e.g. a higher priority task than the
+ * one calling `check_dtcs`), since the retry would never succeed while the writer is suspended.
+ *
+ * Example usage:
+ * @code
+ * DTC_Info_t local[MAX_ACTIVE_DTCS];
+ * size_t dtc_count = 0;
+ * uint32_t seq;
+ * do {
+ *     seq = read_dtcs_begin(&parser);
+ *     const DTC_Info_t* active_dtcs = get_reference_to_dtcs(&parser, &dtc_count);
+ *     memcpy(local, active_dtcs, dtc_count * sizeof(DTC_Info_t));
+ * } while (read_dtcs_retry(&parser, seq));
+ * @endcode
+ *
+ * @param parser Parser context
+ * @return uint32_t Sequence to be given to `read_dtcs_retry`
+ */
+uint32_t read_dtcs_begin(DtcParser_t* parser);
+
+/**
+ * @brief Finishes a lock-free read of the active DTC list (seqlock)
+ *
+ * @param parser Parser context
+ * @param seq Sequence returned by `read_dtcs_begin`
+ * @return bool True if the list was modified during the read and it must be read again
+ */
+bool read_dtcs_retry(DtcParser_t* parser, uint32_t seq);
+#endif
 
 
 #endif // DTC_PARSER_H
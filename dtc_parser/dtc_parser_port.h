@@ -0,0 +1,245 @@
+/**
+ * @file dtc_parser_port.h
+ * @brief Platform port layer for the DTC parser library
+ *
+ * The library needs a few atomic operations on 32-bit words: the compare-and-swap try-lock
+ * behind `take_dtc_mutex`, the lock-free frame ring indexes, the seqlock counter used by
+ * lock-free readers and the published generation / reader counters of the DTC snapshots.
+ * By default they are implemented with C11 `<stdatomic.h>`.
+ *
+ * Toolchains without C11 atomics (e.g. old compilers for single core microcontrollers) must
+ * set `DTC_PORT_USE_C11_ATOMICS` to 0 and implement `dtc_port_enter_critical` and
+ * `dtc_port_exit_critical`, usually by disabling and restoring the interrupts:
+ * @code
+ * uint32_t dtc_port_enter_critical(void) {
+ *     uint32_t primask = __get_PRIMASK();
+ *     __disable_irq();
+ *     return primask;
+ * }
+ * void dtc_port_exit_critical(uint32_t state) {
+ *     __set_PRIMASK(state);
+ * }
+ * @endcode
+ *
+ * The instrumentation of `DTC_PARSER_USE_STATS` reads a free running cycle counter through
+ * `dtc_port_cycle_count`: the time stamp counter on x86, the virtual counter on AArch64 and
+ * `DWT->CYCCNT` on Cortex-M3/M4/M7/M33 (enabled by the application). Targets without any of
+ * them define `DTC_PORT_USER_CYCLE_COUNTER` and implement the function.
+ *
+ * @authored by Roger da Silva Moschiel
+ * @date 1 August 2024
+ */
+
+#ifndef DTC_PARSER_PORT_H
+#define DTC_PARSER_PORT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef DTC_PORT_USE_C11_ATOMICS
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_ATOMICS__)
+#define DTC_PORT_USE_C11_ATOMICS 1
+#else
+#define DTC_PORT_USE_C11_ATOMICS 0
+#endif
+#endif
+
+#if DTC_PORT_USE_C11_ATOMICS
+
+#include <stdatomic.h>
+
+typedef atomic_uint_fast32_t dtc_atomic_u32_t;
+
+static inline uint32_t dtc_atomic_load_relaxed(dtc_atomic_u32_t* a) {
+    return (uint32_t)atomic_load_explicit(a, memory_order_relaxed);
+}
+
+static inline uint32_t dtc_atomic_load_acquire(dtc_atomic_u32_t* a) {
+    return (uint32_t)atomic_load_explicit(a, memory_order_acquire);
+}
+
+static inline void dtc_atomic_store_relaxed(dtc_atomic_u32_t* a, uint32_t v) {
+    atomic_store_explicit(a, v, memory_order_relaxed);
+}
+
+static inline void dtc_atomic_store_release(dtc_atomic_u32_t* a, uint32_t v) {
+    atomic_store_explicit(a, v, memory_order_release);
+}
+
+static inline uint32_t dtc_atomic_fetch_add_relaxed(dtc_atomic_u32_t* a, uint32_t v) {
+    return (uint32_t)atomic_fetch_add_explicit(a, v, memory_order_relaxed);
+}
+
+// Sequentially consistent versions, needed when a store must be ordered before a later load
+static inline uint32_t dtc_atomic_load(dtc_atomic_u32_t* a) {
+    return (uint32_t)atomic_load(a);
+}
+
+static inline void dtc_atomic_store(dtc_atomic_u32_t* a, uint32_t v) {
+    atomic_store(a, v);
+}
+
+static inline uint32_t dtc_atomic_fetch_add(dtc_atomic_u32_t* a, uint32_t v) {
+    return (uint32_t)atomic_fetch_add(a, v);
+}
+
+static inline uint32_t dtc_atomic_fetch_sub(dtc_atomic_u32_t* a, uint32_t v) {
+    return (uint32_t)atomic_fetch_sub(a, v);
+}
+
+// Sets '*a' to 'desired' only if it is equal to 'expected', returns true on success
+static inline bool dtc_atomic_cas_acquire(dtc_atomic_u32_t* a, uint32_t expected, uint32_t desired) {
+    uint_fast32_t e = expected;
+    return atomic_compare_exchange_strong_explicit(a, &e, desired, memory_order_acquire, memory_order_relaxed);
+}
+
+static inline void dtc_atomic_fence_acquire(void) {
+    atomic_thread_fence(memory_order_acquire);
+}
+
+static inline void dtc_atomic_fence_release(void) {
+    atomic_thread_fence(memory_order_release);
+}
+
+#else // !DTC_PORT_USE_C11_ATOMICS
+
+/**
+ * @brief Enters a critical section (e.g. disables interrupts), implemented by the user
+ *
+ * @return uint32_t State to be restored by `dtc_port_exit_critical`
+ */
+uint32_t dtc_port_enter_critical(void);
+
+/**
+ * @brief Leaves a critical section entered by `dtc_port_enter_critical`, implemented by the user
+ *
+ * @param state Value returned by the matching `dtc_port_enter_critical`
+ */
+void dtc_port_exit_critical(uint32_t state);
+
+typedef volatile uint32_t dtc_atomic_u32_t;
+
+// Compiler barrier, the critical section is expected to act as the hardware barrier
+#if defined(__GNUC__)
+#define DTC_PORT_BARRIER() __asm__ __volatile__("" ::: "memory")
+#else
+#define DTC_PORT_BARRIER()
+#endif
+
+static inline uint32_t dtc_atomic_load_relaxed(dtc_atomic_u32_t* a) {
+    return *a;
+}
+
+static inline uint32_t dtc_atomic_load_acquire(dtc_atomic_u32_t* a) {
+    uint32_t v = *a;
+    DTC_PORT_BARRIER();
+    return v;
+}
+
+static inline void dtc_atomic_store_relaxed(dtc_atomic_u32_t* a, uint32_t v) {
+    *a = v;
+}
+
+static inline void dtc_atomic_store_release(dtc_atomic_u32_t* a, uint32_t v) {
+    DTC_PORT_BARRIER();
+    *a = v;
+}
+
+static inline uint32_t dtc_atomic_fetch_add_relaxed(dtc_atomic_u32_t* a, uint32_t v) {
+    uint32_t state = dtc_port_enter_critical();
+    uint32_t old = *a;
+    *a = old + v;
+    dtc_port_exit_critical(state);
+    return old;
+}
+
+static inline uint32_t dtc_atomic_load(dtc_atomic_u32_t* a) {
+    DTC_PORT_BARRIER();
+    uint32_t v = *a;
+    DTC_PORT_BARRIER();
+    return v;
+}
+
+static inline void dtc_atomic_store(dtc_atomic_u32_t* a, uint32_t v) {
+    DTC_PORT_BARRIER();
+    *a = v;
+    DTC_PORT_BARRIER();
+}
+
+static inline uint32_t dtc_atomic_fetch_add(dtc_atomic_u32_t* a, uint32_t v) {
+    DTC_PORT_BARRIER();
+    uint32_t old = dtc_atomic_fetch_add_relaxed(a, v);
+    DTC_PORT_BARRIER();
+    return old;
+}
+
+static inline uint32_t dtc_atomic_fetch_sub(dtc_atomic_u32_t* a, uint32_t v) {
+    return dtc_atomic_fetch_add(a, (uint32_t)(0u - v));
+}
+
+static inline bool dtc_atomic_cas_acquire(dtc_atomic_u32_t* a, uint32_t expected, uint32_t desired) {
+    bool ok = false;
+    uint32_t state = dtc_port_enter_critical();
+    if (*a == expected) {
+        *a = desired;
+        ok = true;
+    }
+    dtc_port_exit_critical(state);
+    DTC_PORT_BARRIER();
+    return ok;
+}
+
+static inline void dtc_atomic_fence_acquire(void) {
+    DTC_PORT_BARRIER();
+}
+
+static inline void dtc_atomic_fence_release(void) {
+    DTC_PORT_BARRIER();
+}
+
+#endif // DTC_PORT_USE_C11_ATOMICS
+
+#if defined(DTC_PORT_USER_CYCLE_COUNTER)
+
+/**
+ * @brief Reads a free running cycle counter, implemented by the user
+ *
+ * @return uint32_t Counter value, only differences between two reads are used (wrap-around is fine)
+ */
+uint32_t dtc_port_cycle_count(void);
+
+#elif defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+static inline uint32_t dtc_port_cycle_count(void) {
+    return (uint32_t)__rdtsc();
+}
+
+#elif defined(__aarch64__) && defined(__GNUC__)
+
+static inline uint32_t dtc_port_cycle_count(void) {
+    uint64_t ticks;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+    return (uint32_t)ticks; // Generic timer ticks, a fixed fraction of the core clock
+}
+
+#elif defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__) || defined(__ARM_ARCH_8M_MAIN__)
+
+static inline uint32_t dtc_port_cycle_count(void) {
+    return *(volatile uint32_t*)0xE0001004u; // DWT->CYCCNT, the application sets DWT->CTRL.CYCCNTENA
+}
+
+#else
+
+static inline uint32_t dtc_port_cycle_count(void) {
+    return 0; // No known counter: the histograms only count the calls (in the first bin)
+}
+
+#endif
+
+#endif // DTC_PARSER_PORT_H
@@ -0,0 +1,99 @@
+/**
+ * @file dtc_trace.c
+ * @brief Source file for the decoder of the DTC parser binary trace
+ *
+ * Each record is formatted as one line, starting with the timestamp of the frame or
+ * `check_dtcs` call that produced it.
+ *
+ * @authored by Roger da Silva Moschiel
+ * @date 1 August 2024
+ */
+
+#include "dtc_trace.h"
+#include <stdio.h>
+
+#define TRACE_READ_BATCH 16 // Records read per 'read_dtc_trace' call of 'print_dtc_trace'
+
+// Private function prototypes
+static int format_frame(const DtcTraceRecord_t* r, const char* name, char* buf, size_t size);
+
+// Private functions
+static int format_frame(const DtcTraceRecord_t* r, const char* name, char* buf, size_t size) {
+    uint32_t lo = r->args[1];
+    uint32_t hi = r->args[2];
+    return snprintf(buf, size, "[%u] %s -> ID: %08X, Data: %02X %02X %02X %02X %02X %02X %02X %02X",
+        r->timestamp, name, r->args[0],
+        lo & 0xFF, (lo >> 8) & 0xFF, (lo >> 16) & 0xFF, lo >> 24,
+        hi & 0xFF, (hi >> 8) & 0xFF, (hi >> 16) & 0xFF, hi >> 24);
+}
+
+// Public functions
+int format_dtc_trace_record(const DtcTraceRecord_t* r, char* buf, size_t size) {
+    const uint32_t* a = r->args;
+    uint32_t ts = r->timestamp;
+
+    switch (r->event) {
+        case DTC_TRACE_EV_DM1_FRAME:
+            return format_frame(r, "DM1_FRAME", buf, size);
+        case DTC_TRACE_EV_DM1_PARSED:
+            return snprintf(buf, size, "[%u] DM1_PARSED -> SRC: 0x%02X (%u), MIL: %u, RSL: %u, AWL: %u, PL: %u",
+                ts, r->arg16, r->arg16, (a[0] >> 6) & 0x03, (a[0] >> 4) & 0x03, (a[0] >> 2) & 0x03, a[0] & 0x03);
+        case DTC_TRACE_EV_DM1_DTC:
+            return snprintf(buf, size, "        DTC -> SPN: 0x%X (%u), FMI: %u, CM: %u, OC: %u",
+                a[0], a[0], a[1] & 0xFF, (a[1] >> 8) & 0xFF, (a[1] >> 16) & 0xFF);
+        case DTC_TRACE_EV_TP_CM_FRAME:
+            return format_frame(r, "TP_CM_FRAME", buf, size);
+        case DTC_TRACE_EV_TP_CM_PARSED:
+            return snprintf(buf, size, "[%u] TP_CM_PARSED -> ID: %08X, PGN: 0x%X, Total Size: %u bytes, Number of Packets: %u",
+                ts, a[0], a[1], a[2] & 0xFFFF, a[2] >> 16);
+        case DTC_TRACE_EV_TP_DT_FRAME:
+            return format_frame(r, "TP_DT_FRAME", buf, size);
+        case DTC_TRACE_EV_TP_DT_PARSED:
+            return snprintf(buf, size, "[%u] TP_DT_PARSED -> ID: %08X, Packet Number: %u of %u", ts, a[0], a[1], a[2]);
+        case DTC_TRACE_EV_TP_DT_ORDER:
+            return snprintf(buf, size, "[%u] Packet Order is Incorrect, ID: %08X, Received: %u, Expected: %u", ts, a[0] & 0x1FFFFFFF, a[1], a[2]);
+        case DTC_TRACE_EV_TP_CONCAT:
+            return snprintf(buf, size, "[%u] TP_CONCAT -> ID: %08X, PGN: 0x%X, Size: %u", ts, a[0], a[1], a[2]);
+        case DTC_TRACE_EV_NEW_DTC:
+            return snprintf(buf, size, "[%u] New DTC -> SRC: 0x%02X (%u), SPN: 0x%X (%u), FMI: %u", ts, r->arg16, r->arg16, a[0], a[0], a[1]);
+        case DTC_TRACE_EV_REMOVED_DTC:
+            return snprintf(buf, size, "[%u] Removed DTC -> SRC: 0x%02X (%u), SPN: 0x%X (%u), FMI: %u, LastSeen: %u",
+                ts, r->arg16, r->arg16, a[0], a[0], a[1], a[2]);
+        case DTC_TRACE_EV_MAX_CANDIDATE:
+            return snprintf(buf, size, "[%u] WARNING: Cannot exceed max candidate DTCs: %u", ts, a[0]);
+        case DTC_TRACE_EV_MAX_ACTIVE:
+            return snprintf(buf, size, "[%u] WARNING: Cannot exceed max active DTCs: %u", ts, a[0]);
+        case DTC_TRACE_EV_MAX_DATA_SIZE:
+            return snprintf(buf, size, "[%u] WARNING: Cannot exceed max multi-frame data size: %u (announced %u)", ts, a[0], a[1]);
+        case DTC_TRACE_EV_MAX_MULTI_FRAME:
+            return snprintf(buf, size, "[%u] WARNING: Cannot exceed max concurrent multi-frame messages: %u", ts, a[0]);
+        case DTC_TRACE_EV_POOL_EXHAUSTED:
+            return snprintf(buf, size, "[%u] WARNING: Multi-frame pool exhausted, %u chunks needed", ts, a[0]);
+        case DTC_TRACE_EV_TP_ABORTED:
+            return snprintf(buf, size, "[%u] WARNING: multiframe aborted, CM: 0x%X, Reason: %u", ts, a[0], a[1]);
+        case DTC_TRACE_EV_TP_TIMEOUT:
+            return snprintf(buf, size, "[%u] WARNING: discard incomplete multiframe, CM: 0x%X, PGN: 0x%X, FirstSeen: %u, LastSeen: %u",
+                ts, a[0], a[1], a[2] - r->arg16, a[2]);
+        case DTC_TRACE_EV_SOURCE_QUOTA:
+            return snprintf(buf, size, "[%u] WARNING: Cannot exceed %s DTCs quota of source 0x%02X: %u",
+                ts, a[1] ? "active" : "candidate", r->arg16, a[0]);
+        default:
+            return snprintf(buf, size, "[%u] Unknown trace event %u: %08X %08X %08X %04X", ts, r->event, a[0], a[1], a[2], r->arg16);
+    }
+}
+
+size_t print_dtc_trace(DtcParser_t* parser) {
+    DtcTraceRecord_t records[TRACE_READ_BATCH];
+    char line[160];
+    size_t total = 0;
+    size_t n;
+
+    while ((n = read_dtc_trace(parser, records, TRACE_READ_BATCH)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            format_dtc_trace_record(&records[i], line, sizeof(line));
+            printf("%s\n", line);
+        }
+        total += n;
+    }
+    return total;
+}
@@ -0,0 +1,42 @@
+/**
+ * @file dtc_trace.h
+ * @brief Header file for the decoder of the DTC parser binary trace
+ *
+ * The parser records `DtcTraceRecord_t` entries (event ID and raw arguments) in its trace ring,
+ * nothing is formatted in the context that processes the CAN frames. This decoder turns the
+ * records into text, from a low priority task of the target (`print_dtc_trace`) or offline
+ * from records stored as they were read (`format_dtc_trace_record`). It is the only part of
+ * the trace that needs `printf`, targets that decode offline do not link it.
+ *
+ * @authored by Roger da Silva Moschiel
+ * @date 1 August 2024
+ */
+
+#ifndef DTC_TRACE_H
+#define DTC_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "dtc_parser.h"
+
+/**
+ * @brief Formats a trace record as one line of text (without the line break)
+ *
+ * @param record Record read by `read_dtc_trace`
+ * @param buf Output buffer
+ * @param size Size of `buf`, the text is truncated if it does not fit
+ * @return int Length of the full text, as `snprintf`
+ */
+int format_dtc_trace_record(const DtcTraceRecord_t* record, char* buf, size_t size);
+
+/**
+ * @brief Reads every pending trace record of a parser and prints them to stdout
+ *
+ * The records lost because the ring was full are counted by `get_dtc_trace_overflows`.
+ *
+ * @param parser Parser context, this function is its single trace consumer
+ * @return size_t Number of records printed
+ */
+size_t print_dtc_trace(DtcParser_t* parser);
+
+#endif // DTC_TRACE_H
@@ -0,0 +1,88 @@
+/**
+ * @file file_map.c
+ * @brief Source file for the read-only file mapping used by the log readers
+ *
+ * @authored by Roger da Silva Moschiel
+ * @date 1 August 2024
+ */
+
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "file_map.h"
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Public functions
+bool file_map_open(FileMap_t* map, const char* file_path) {
+    memset((void*)map, 0, sizeof(FileMap_t));
+
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(file_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return false;
+    }
+    map->file_handle = file;
+    map->size = (size_t)size.QuadPart;
+    if (map->size == 0) return true; // Empty files cannot be mapped
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        file_map_close(map);
+        return false;
+    }
+    map->mapping_handle = mapping;
+    map->data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (map->data == NULL) {
+        file_map_close(map);
+        return false;
+    }
+#else
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    map->size = (size_t)st.st_size;
+    if (map->size > 0) {
+        void* data = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            map->size = 0;
+            return false;
+        }
+        posix_madvise(data, map->size, POSIX_MADV_SEQUENTIAL);
+        map->data = (const char*)data;
+    }
+    close(fd); // The mapping stays valid after closing the descriptor
+#endif
+
+    return true;
+}
+
+void file_map_close(FileMap_t* map) {
+#if defined(_WIN32)
+    if (map->data) UnmapViewOfFile(map->data);
+    if (map->mapping_handle) CloseHandle((HANDLE)map->mapping_handle);
+    if (map->file_handle) CloseHandle((HANDLE)map->file_handle);
+#else
+    if (map->data) munmap((void*)map->data, map->size);
+#endif
+    memset((void*)map, 0, sizeof(FileMap_t));
+}
@@ -0,0 +1,46 @@
+/**
+ * @file file_map.h
+ * @brief Header file for the read-only file mapping used by the log readers
+ *
+ * Maps a whole file in memory (mmap on POSIX systems, a file mapping on Windows), so the log
+ * readers can parse it in place without copies.
+ *
+ * @authored by Roger da Silva Moschiel
+ * @date 1 August 2024
+ */
+
+#ifndef FILE_MAP_H
+#define FILE_MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Struct for a mapped file
+ */
+typedef struct {
+    const char* data;       // Mapping of the whole file, NULL for empty files
+    size_t size;            // File size in bytes
+    #if defined(_WIN32)
+    void* file_handle;
+    void* mapping_handle;
+    #endif
+} FileMap_t;
+
+/**
+ * @brief Maps a file for reading
+ *
+ * @param map Mapping to be initialized
+ * @param file_path Path of the file
+ * @return bool True on success, false if the file could not be opened or mapped
+ */
+bool file_map_open(FileMap_t* map, const char* file_path);
+
+/**
+ * @brief Unmaps a file mapped by `file_map_open`
+ *
+ * @param map Mapping
+ */
+void file_map_close(FileMap_t* map);
+
+#endif // FILE_MAP_H
@@ -0,0 +1,203 @@
+/**
+ * @file log_index.c
+ * @brief Source file for the DTC-only sidecar index of CAN logs
+ *
+ * The indexer replays the transport protocol decisions of the parser without its limits: a
+ * TP.DT frame is indexed if the last BAM or RTS announced on its (source, destination) pair was
+ * for DM1. Every TP.CM frame for DM1 is indexed (CTS and abort also act on open sessions), as
+ * well as any other announcement on a pair whose last one was for DM1, since it closes the
+ * session in the parser. This is a superset of the frames any parser configuration acts on, so
+ * the index does not depend on `DtcParseConfig_t`.
+ *
+ * @authored by Roger da Silva Moschiel
+ * @date 1 August 2024
+ */
+
+#include "log_index.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INDEX_WRITE_ENTRIES 4096 // Entries buffered before each write of the sidecar
+#define TP_SESSION_SLOTS 65536   // One per (destination, source) pair of a TP identifier
+
+typedef char log_index_layout_check[(sizeof(LogIndexHeader_t) == 32 && sizeof(LogIndexEntry_t) == 16) ? 1 : -1];
+
+/**
+ * @brief Struct for the state of the indexer
+ */
+typedef struct {
+    FILE* file;
+    bool failed;
+    size_t buffered;
+    LogIndexEntry_t buffer[INDEX_WRITE_ENTRIES];
+    bool dm1_session[TP_SESSION_SLOTS];         // The last BAM/RTS of the (destination, source) pair was for DM1
+} LogIndexer_t;
+
+// Private function prototypes
+static bool is_parsed_frame(LogIndexer_t* indexer, const CanFrame_t* frame);
+static void add_entry(LogIndexer_t* indexer, LogIndexHeader_t* header, uint64_t offset, uint64_t timestamp_us);
+static void flush_entries(LogIndexer_t* indexer);
+
+// Private functions
+static bool is_parsed_frame(LogIndexer_t* indexer, const CanFrame_t* frame) {
+    uint32_t can_id = frame->can_id;
+    uint32_t slot = can_id & 0xFFFF;
+
+    if ((can_id & 0x00FFFF00) == 0x00FECA00) { // single frame DM1 message
+        return true;
+    }
+    if ((can_id & 0x00FF0000) == 0x00EC0000) { // multi frame message
+        uint32_t pgn = (frame->data[7] << 16) | (frame->data[6] << 8) | frame->data[5];
+        uint8_t control_byte = frame->data[0];
+        if (control_byte != TP_CM_BAM && control_byte != TP_CM_RTS) return pgn == DM1_PGN; // CTS, EOMA, abort
+        bool closes = indexer->dm1_session[slot]; // Same matching as the parser: one session per pair
+        indexer->dm1_session[slot] = pgn == DM1_PGN;
+        return closes || pgn == DM1_PGN;
+    }
+    if ((can_id & 0x00FF0000) == 0x00EB0000) { // multi frame data
+        return indexer->dm1_session[slot];
+    }
+    return false;
+}
+
+static void flush_entries(LogIndexer_t* indexer) {
+    if (indexer->buffered > 0 && fwrite(indexer->buffer, sizeof(LogIndexEntry_t), indexer->buffered, indexer->file) != indexer->buffered) {
+        indexer->failed = true;
+    }
+    indexer->buffered = 0;
+}
+
+static void add_entry(LogIndexer_t* indexer, LogIndexHeader_t* header, uint64_t offset, uint64_t timestamp_us) {
+    if (indexer->buffered == INDEX_WRITE_ENTRIES) flush_entries(indexer);
+    indexer->buffer[indexer->buffered].offset = offset;
+    indexer->buffer[indexer->buffered].timestamp_us = timestamp_us;
+    indexer->buffered++;
+    header->entry_count++;
+}
+
+// Public functions
+bool log_index_build(const char* log_path, const char* index_path, LogIndexHeader_t* header_out) {
+    CanBinReader_t bin;
+    AscReader_t asc;
+    bool binary = can_bin_reader_open(&bin, log_path, false);
+    if (!binary && !asc_reader_open(&asc, log_path)) return false;
+
+    LogIndexer_t* indexer = calloc(1, sizeof(LogIndexer_t));
+    LogIndexHeader_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LOG_INDEX_MAGIC, 4);
+    header.version = LOG_INDEX_VERSION;
+    header.flags = binary ? LOG_INDEX_FLAG_BINARY_LOG : 0;
+    header.log_size = binary ? bin.map.size : asc.map.size;
+
+    bool ok = indexer && (indexer->file = fopen(index_path, "wb")) != NULL;
+    if (ok) {
+        // Placeholder, rewritten with the final counts at the end
+        if (fwrite(&header, sizeof(header), 1, indexer->file) != 1) indexer->failed = true;
+
+        uint32_t second = 0;
+        for (;;) {
+            CanFrame_t frame;
+            size_t n;
+            uint64_t timestamp_us;
+            size_t pos;
+            // One frame at a time, or up to the first line of the next second if there is no frame before it
+            if (binary) {
+                if (can_bin_reader_eof(&bin)) break;
+                n = can_bin_read_frames(&bin, &frame, 1, second + 1);
+                timestamp_us = bin.timestamp_us;
+                pos = bin.record_pos;
+            } else {
+                if (asc_reader_eof(&asc)) break;
+                n = asc_reader_read_frames(&asc, &frame, 1, second + 1);
+                timestamp_us = asc.timestamp_us;
+                pos = asc.line_pos;
+            }
+            header.frame_count += n;
+
+            uint32_t timestamp = (uint32_t)(timestamp_us / 1000000u);
+            if (n == 1 && is_parsed_frame(indexer, &frame)) {
+                add_entry(indexer, &header, pos, timestamp_us);
+            } else if (timestamp > second) {
+                add_entry(indexer, &header, LOG_INDEX_TIME_MARK, timestamp_us);
+            }
+            if (timestamp > second) second = timestamp;
+        }
+        flush_entries(indexer);
+
+        if (fseek(indexer->file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, indexer->file) != 1) indexer->failed = true;
+        if (fclose(indexer->file) != 0) indexer->failed = true;
+        ok = !indexer->failed;
+    }
+
+    free(indexer);
+    if (binary) can_bin_reader_close(&bin);
+    else asc_reader_close(&asc);
+    if (ok && header_out) *header_out = header;
+    return ok;
+}
+
+bool log_index_reader_open(LogIndexReader_t* reader, const char* log_path, const char* index_path) {
+    memset((void*)reader, 0, sizeof(LogIndexReader_t));
+    if (!file_map_open(&reader->index, index_path)) return false;
+
+    const LogIndexHeader_t* header = (const LogIndexHeader_t*)reader->index.data;
+    bool ok = reader->index.size >= sizeof(LogIndexHeader_t) &&
+              memcmp(header->magic, LOG_INDEX_MAGIC, 4) == 0 && header->version == LOG_INDEX_VERSION &&
+              header->entry_count == (reader->index.size - sizeof(LogIndexHeader_t)) / sizeof(LogIndexEntry_t);
+    if (ok) {
+        reader->binary = (header->flags & LOG_INDEX_FLAG_BINARY_LOG) != 0;
+        if (reader->binary) {
+            ok = can_bin_reader_open(&reader->bin, log_path, false) && reader->bin.map.size == header->log_size;
+        } else {
+            ok = asc_reader_open(&reader->asc, log_path) && reader->asc.map.size == header->log_size;
+        }
+    }
+    if (!ok) {
+        log_index_reader_close(reader);
+        return false;
+    }
+
+    reader->entries = (const LogIndexEntry_t*)(reader->index.data + sizeof(LogIndexHeader_t));
+    reader->entry_count = (size_t)header->entry_count;
+    return true;
+}
+
+void log_index_reader_close(LogIndexReader_t* reader) {
+    if (reader->binary) can_bin_reader_close(&reader->bin);
+    else asc_reader_close(&reader->asc);
+    file_map_close(&reader->index);
+    memset((void*)reader, 0, sizeof(LogIndexReader_t));
+}
+
+size_t log_index_read_frames(LogIndexReader_t* reader, CanFrame_t* frames, size_t max_frames, uint32_t stop_timestamp) {
+    uint64_t stop_us = (uint64_t)stop_timestamp * 1000000u;
+    size_t n = 0;
+
+    while (n < max_frames && reader->next < reader->entry_count) {
+        const LogIndexEntry_t* entry = &reader->entries[reader->next++];
+        reader->timestamp_us = entry->timestamp_us;
+        if (entry->offset != LOG_INDEX_TIME_MARK) {
+            CanFrame_t* frame = &frames[n];
+            bool found = reader->binary ? can_bin_frame_at(&reader->bin, (size_t)entry->offset, frame)
+                                        : asc_reader_frame_at(&reader->asc, (size_t)entry->offset, frame);
+            if (found) {
+                frame->timestamp = (uint32_t)(entry->timestamp_us / 1000000u);
+                n++;
+            }
+        }
+        if (reader->timestamp_us >= stop_us) break;
+    }
+
+    reader->frame_count += n;
+    return n;
+}
+
+uint32_t log_index_reader_timestamp(const LogIndexReader_t* reader) {
+    return (uint32_t)(reader->timestamp_us / 1000000u);
+}
+
+bool log_index_reader_eof(const LogIndexReader_t* reader) {
+    return reader->next >= reader->entry_count;
+}
@@ -0,0 +1,127 @@
+/**
+ * @file log_index.h
+ * @brief Header file for the DTC-only sidecar index of CAN logs
+ *
+ * Most of a log is made of PGNs the DTC parser never looks at. `log_index_build` scans a log
+ * (.ASC or binary capture) once and writes a sidecar file with the offset and timestamp of every
+ * frame the parser acts on: DM1 single frames, TP.CM frames for PGN 0xFECA (BAM, RTS, CTS,
+ * abort) and the TP.DT frames of those sessions. Replays reading the log through the index (`log_index_reader`)
+ * only touch these frames, whatever the debounce configuration of the replay is.
+ *
+ * The index also keeps a time mark on the first line of each second that is not indexed, so the
+ * replay calls `check_dtcs` at the same points and gives the same results as the full log.
+ *
+ * @authored by Roger da Silva Moschiel
+ * @date 1 August 2024
+ */
+
+#ifndef LOG_INDEX_H
+#define LOG_INDEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "dtc_parser.h"
+#include "asc_reader.h"
+#include "can_bin.h"
+#include "file_map.h"
+
+#define LOG_INDEX_MAGIC "DTCX"
+#define LOG_INDEX_VERSION 2
+#define LOG_INDEX_EXTENSION ".dtcidx"            // Suffix appended to the log path by the tools
+#define LOG_INDEX_FLAG_BINARY_LOG (1u << 0)      // The indexed log is a binary capture
+#define LOG_INDEX_TIME_MARK UINT64_MAX           // Entry offset of a time mark
+
+/**
+ * @brief Struct for the sidecar file header
+ */
+typedef struct {
+    char magic[4];              // LOG_INDEX_MAGIC
+    uint16_t version;           // LOG_INDEX_VERSION
+    uint16_t flags;             // LOG_INDEX_FLAG_*
+    uint64_t log_size;          // Size of the indexed log, the index of another version of the log is rejected
+    uint64_t entry_count;
+    uint64_t frame_count;       // Frames of the whole log
+} LogIndexHeader_t; // (32 bytes)
+
+/**
+ * @brief Struct for a sidecar entry
+ */
+typedef struct {
+    uint64_t offset;            // Offset of the frame line/record in the log, LOG_INDEX_TIME_MARK for time marks
+    uint64_t timestamp_us;      // Timestamp in microseconds
+} LogIndexEntry_t; // (16 bytes)
+
+/**
+ * @brief Struct for a log read through its index
+ */
+typedef struct {
+    bool binary;
+    AscReader_t asc;
+    CanBinReader_t bin;
+    FileMap_t index;
+    const LogIndexEntry_t* entries;
+    size_t entry_count;
+    size_t next;                // Next entry
+    uint64_t timestamp_us;      // Timestamp of the last read entry
+    uint64_t frame_count;       // Frames delivered so far
+} LogIndexReader_t;
+
+/**
+ * @brief Scans a log and writes its DTC-only index
+ *
+ * @param log_path Path of the .ASC log or binary capture
+ * @param index_path Path of the sidecar file, it is overwritten if it exists
+ * @param header Optional pointer where the header of the written index is stored, can be NULL
+ * @return bool True on success
+ */
+bool log_index_build(const char* log_path, const char* index_path, LogIndexHeader_t* header);
+
+/**
+ * @brief Opens a log to be read through its index
+ *
+ * @param reader Reader context to be initialized
+ * @param log_path Path of the indexed log
+ * @param index_path Path of the sidecar file
+ * @return bool True on success, false if a file could not be opened or the index does not belong to the log
+ */
+bool log_index_reader_open(LogIndexReader_t* reader, const char* log_path, const char* index_path);
+
+/**
+ * @brief Closes a log opened by `log_index_reader_open`
+ *
+ * @param reader Reader context
+ */
+void log_index_reader_close(LogIndexReader_t* reader);
+
+/**
+ * @brief Reads the next indexed CAN frames of the log
+ *
+ * Same contract as `asc_reader_read_frames`: reads until `max_frames` frames were stored or
+ * until an entry with a timestamp of at least `stop_timestamp` seconds was read.
+ *
+ * @param reader Reader context
+ * @param frames Output buffer, the frame timestamps are in seconds
+ * @param max_frames Number of frames that fit in `frames`
+ * @param stop_timestamp Timestamp in seconds where the reading stops
+ * @return size_t Number of frames stored in `frames`
+ */
+size_t log_index_read_frames(LogIndexReader_t* reader, CanFrame_t* frames, size_t max_frames, uint32_t stop_timestamp);
+
+/**
+ * @brief Returns the timestamp of the last read entry, in seconds
+ *
+ * @param reader Reader context
+ * @return uint32_t Timestamp in seconds
+ */
+uint32_t log_index_reader_timestamp(const LogIndexReader_t* reader);
+
+/**
+ * @brief Tells if every entry of the index was read
+ *
+ * @param reader Reader context
+ * @return bool True if there are no more entries
+ */
+bool log_index_reader_eof(const LogIndexReader_t* reader);
+
+#endif // LOG_INDEX_H
@@ -0,0 +1,494 @@
+/**
+ * @file log_replay.c
+ * @brief Source file for the parallel log replay engine
+ *
+ * Every worker thread owns a queue of jobs. The jobs are sorted by file size and dealt round-robin,
+ * so each queue starts with its largest file. A worker takes jobs from its own queue and, once it
+ * is empty, steals the largest pending job of the other queues, so a few big logs do not leave the
+ * other cores idle at the end of the run. Each job records its active DTC changes in a private
+ * timeline; the timelines are merged with a binary heap once all workers are done.
+ *
+ * @authored by Roger da Silva Moschiel
+ * @date 1 August 2024
+ */
+
+#include "log_replay.h"
+#include "asc_reader.h"
+#include "can_bin.h"
+#include "file_map.h"
+#include "log_index.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REPLAY_BATCH_SIZE 256 // Frames read from the log per 'process_dtc_frames' call
+#define REPLAY_RING_DRAIN 16  // Frames enqueued between two 'drain_dtc_frames' of a differential replay (less than DTC_FRAME_RING_SIZE)
+
+/**
+ * @brief Struct for a recorded change of the active DTC list, the DTCs are kept in the timeline pool
+ */
+typedef struct {
+    uint32_t timestamp;
+    size_t dtc_count;
+    size_t dtc_offset;
+} TimelineEvent_t;
+
+/**
+ * @brief Struct for the active DTC timeline of a job
+ */
+typedef struct {
+    TimelineEvent_t* events;
+    size_t event_count;
+    size_t event_capacity;
+    DTC_Info_t* dtcs;
+    size_t dtc_count;
+    size_t dtc_capacity;
+    bool out_of_memory;
+    ReplayJobResult_t result;
+} JobTimeline_t;
+
+/**
+ * @brief Struct for the job queue of a worker
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    size_t* jobs;   // Job indexes, largest file first
+    size_t head;    // Next job to be taken
+    size_t tail;    // End of the queue
+} WorkQueue_t;
+
+/**
+ * @brief Struct shared by the workers of a replay
+ */
+typedef struct {
+    const ReplayJob_t* jobs;
+    JobTimeline_t* timelines;
+    WorkQueue_t* queues;
+    size_t worker_count;
+} ReplayContext_t;
+
+/**
+ * @brief Struct for a worker thread
+ */
+typedef struct {
+    ReplayContext_t* ctx;
+    size_t id;
+    pthread_t thread;
+} ReplayWorker_t;
+
+/**
+ * @brief Struct for the log of a job, .ASC or binary capture, read whole or through its index
+ */
+typedef struct {
+    bool indexed;
+    bool binary;
+    AscReader_t asc;
+    CanBinReader_t bin;
+    LogIndexReader_t index;
+} LogSource_t;
+
+/**
+ * @brief Struct for the last `UpdatedActiveDTCsCallback` emission of a parser of a differential replay
+ */
+typedef struct {
+    bool emitted;
+    size_t dtc_count;
+    DTC_Info_t dtcs[MAX_ACTIVE_DTCS];
+} DiffEmission_t;
+
+// Private function prototypes
+static bool take_job(WorkQueue_t* queue, size_t* job);
+static bool record_event(JobTimeline_t* timeline, DtcParser_t* parser, uint32_t timestamp);
+static void run_job(ReplayContext_t* ctx, size_t job);
+static void* worker_main(void* arg);
+static void merge_timelines(const ReplayJob_t* jobs, const JobTimeline_t* timelines, size_t job_count, ReplayEventCallback callback, void* user_data);
+static void capture_emission(void* user_data, const DTC_Info_t* active_dtcs, const size_t active_dtcs_count);
+static bool same_emission(const DiffEmission_t* a, const DiffEmission_t* b);
+static void note_list_difference(DiffReplayResult_t* result, DtcParser_t* reference, DtcParser_t* optimized, uint64_t frame_index);
+
+// Private functions
+static bool source_open(LogSource_t* source, const char* file_path, const char* index_path) {
+    source->indexed = index_path != NULL;
+    if (source->indexed) return log_index_reader_open(&source->index, file_path, index_path);
+    // Binary captures are recognized by their header, only their blocks with DTC frames are parsed
+    source->binary = can_bin_reader_open(&source->bin, file_path, true);
+    return source->binary || asc_reader_open(&source->asc, file_path);
+}
+
+static void source_close(LogSource_t* source) {
+    if (source->indexed) log_index_reader_close(&source->index);
+    else if (source->binary) can_bin_reader_close(&source->bin);
+    else asc_reader_close(&source->asc);
+}
+
+static size_t source_read_frames(LogSource_t* source, CanFrame_t* frames, size_t max_frames, uint32_t stop_timestamp) {
+    if (source->indexed) return log_index_read_frames(&source->index, frames, max_frames, stop_timestamp);
+    return source->binary ? can_bin_read_frames(&source->bin, frames, max_frames, stop_timestamp)
+                          : asc_reader_read_frames(&source->asc, frames, max_frames, stop_timestamp);
+}
+
+static uint32_t source_timestamp(const LogSource_t* source) {
+    if (source->indexed) return log_index_reader_timestamp(&source->index);
+    return source->binary ? can_bin_reader_timestamp(&source->bin) : asc_reader_timestamp(&source->asc);
+}
+
+static bool source_eof(const LogSource_t* source) {
+    if (source->indexed) return log_index_reader_eof(&source->index);
+    return source->binary ? can_bin_reader_eof(&source->bin) : asc_reader_eof(&source->asc);
+}
+
+static bool take_job(WorkQueue_t* queue, size_t* job) {
+    bool ok = false;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->head < queue->tail) {
+        *job = queue->jobs[queue->head++];
+        ok = true;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return ok;
+}
+
+static bool record_event(JobTimeline_t* timeline, DtcParser_t* parser, uint32_t timestamp) {
+    size_t dtc_count = 0;
+    uint32_t generation = 0;
+    const DTC_Info_t* dtcs = acquire_dtc_snapshot(parser, &dtc_count, &generation);
+    bool ok = true;
+
+    if (timeline->event_count == timeline->event_capacity) {
+        size_t capacity = timeline->event_capacity ? timeline->event_capacity * 2 : 64;
+        TimelineEvent_t* events = realloc(timeline->events, capacity * sizeof(TimelineEvent_t));
+        if (events) {
+            timeline->events = events;
+            timeline->event_capacity = capacity;
+        } else {
+            ok = false;
+        }
+    }
+    if (ok && (timeline->dtc_count + dtc_count) > timeline->dtc_capacity) {
+        size_t capacity = timeline->dtc_capacity ? timeline->dtc_capacity * 2 : 256;
+        while (capacity < (timeline->dtc_count + dtc_count)) capacity *= 2;
+        DTC_Info_t* pool = realloc(timeline->dtcs, capacity * sizeof(DTC_Info_t));
+        if (pool) {
+            timeline->dtcs = pool;
+            timeline->dtc_capacity = capacity;
+        } else {
+            ok = false;
+        }
+    }
+
+    if (ok) {
+        TimelineEvent_t* event = &timeline->events[timeline->event_count++];
+        event->timestamp = timestamp;
+        event->dtc_count = dtc_count;
+        event->dtc_offset = timeline->dtc_count;
+        memcpy(&timeline->dtcs[timeline->dtc_count], dtcs, dtc_count * sizeof(DTC_Info_t));
+        timeline->dtc_count += dtc_count;
+    }
+
+    release_dtc_snapshot(parser, generation);
+    return ok;
+}
+
+static void run_job(ReplayContext_t* ctx, size_t job) {
+    const ReplayJob_t* j = &ctx->jobs[job];
+    JobTimeline_t* timeline = &ctx->timelines[job];
+
+    LogSource_t source;
+    if (!source_open(&source, j->file_path, j->index_path)) return;
+    timeline->result.opened = true;
+
+    DtcParser_t* parser = malloc(sizeof(DtcParser_t));
+    CanFrame_t* frames = malloc(REPLAY_BATCH_SIZE * sizeof(CanFrame_t));
+    if (parser && frames) {
+        init_dtc_parser(parser);
+        set_dtc_parser_options(parser, j->options);
+        set_dtc_filtering(parser, j->config.dtc_active_read_count, j->config.dtc_active_time_window,
+            j->config.debounce_dtc_inactive_time, j->config.timeout_multi_frame);
+
+        // Same pacing as a live application: 'check_dtcs' once per second of log time
+        uint32_t last_timestamp = 0;
+        while (!source_eof(&source) && !timeline->out_of_memory) {
+            size_t frame_count = source_read_frames(&source, frames, REPLAY_BATCH_SIZE, last_timestamp + 1);
+            process_dtc_frames(parser, frames, frame_count, NULL);
+            timeline->result.frame_count += frame_count;
+
+            uint32_t timestamp = source_timestamp(&source);
+            if (timestamp - last_timestamp >= 1) {
+                last_timestamp = timestamp;
+                if (check_dtcs(parser, timestamp) && !record_event(timeline, parser, timestamp)) {
+                    timeline->out_of_memory = true;
+                }
+            }
+        }
+        timeline->result.event_count = timeline->event_count;
+    } else {
+        timeline->out_of_memory = true;
+    }
+
+    free(frames);
+    free(parser);
+    source_close(&source);
+}
+
+static void* worker_main(void* arg) {
+    ReplayWorker_t* worker = (ReplayWorker_t*)arg;
+    ReplayContext_t* ctx = worker->ctx;
+    size_t job;
+
+    for (;;) {
+        bool found = take_job(&ctx->queues[worker->id], &job);
+        // Own queue is empty, steal from the others (jobs are never added, so one empty pass ends the worker)
+        for (size_t k = 1; !found && k < ctx->worker_count; k++) {
+            found = take_job(&ctx->queues[(worker->id + k) % ctx->worker_count], &job);
+        }
+        if (!found) break;
+        run_job(ctx, job);
+    }
+    return NULL;
+}
+
+// Orders by timestamp, then by job index
+static inline bool cursor_before(const JobTimeline_t* timelines, const size_t* cursors, size_t a, size_t b) {
+    uint32_t ta = timelines[a].events[cursors[a]].timestamp;
+    uint32_t tb = timelines[b].events[cursors[b]].timestamp;
+    return (ta < tb) || (ta == tb && a < b);
+}
+
+static void heap_sift_down(const JobTimeline_t* timelines, const size_t* cursors, size_t* heap, size_t count, size_t i) {
+    for (;;) {
+        size_t l = 2 * i + 1;
+        size_t m = i;
+        if (l < count && cursor_before(timelines, cursors, heap[l], heap[m])) m = l;
+        if (l + 1 < count && cursor_before(timelines, cursors, heap[l + 1], heap[m])) m = l + 1;
+        if (m == i) return;
+        size_t t = heap[i];
+        heap[i] = heap[m];
+        heap[m] = t;
+        i = m;
+    }
+}
+
+static void merge_timelines(const ReplayJob_t* jobs, const JobTimeline_t* timelines, size_t job_count, ReplayEventCallback callback, void* user_data) {
+    size_t* cursors = calloc(job_count, sizeof(size_t));
+    size_t* heap = malloc(job_count * sizeof(size_t));
+    if (cursors && heap) {
+        size_t count = 0;
+        for (size_t j = 0; j < job_count; j++) {
+            if (timelines[j].event_count > 0) heap[count++] = j;
+        }
+        for (size_t i = count / 2; i-- > 0; ) heap_sift_down(timelines, cursors, heap, count, i);
+
+        while (count > 0) {
+            size_t j = heap[0];
+            const TimelineEvent_t* e = &timelines[j].events[cursors[j]];
+            ReplayEvent_t event = {
+                .job = j,
+                .timestamp = e->timestamp,
+                .dtc_count = e->dtc_count,
+                .dtcs = &timelines[j].dtcs[e->dtc_offset]
+            };
+            callback(user_data, &jobs[j], &event);
+
+            if (++cursors[j] == timelines[j].event_count) heap[0] = heap[--count];
+            heap_sift_down(timelines, cursors, heap, count, 0);
+        }
+    }
+    free(heap);
+    free(cursors);
+}
+
+static void capture_emission(void* user_data, const DTC_Info_t* active_dtcs, const size_t active_dtcs_count) {
+    DiffEmission_t* emission = (DiffEmission_t*)user_data;
+    emission->emitted = true;
+    emission->dtc_count = active_dtcs_count;
+    memcpy(emission->dtcs, active_dtcs, active_dtcs_count * sizeof(DTC_Info_t));
+}
+
+static bool same_emission(const DiffEmission_t* a, const DiffEmission_t* b) {
+    if (a->emitted != b->emitted) return false;
+    if (!a->emitted) return true;
+    return a->dtc_count == b->dtc_count && memcmp(a->dtcs, b->dtcs, a->dtc_count * sizeof(DTC_Info_t)) == 0;
+}
+
+static void note_list_difference(DiffReplayResult_t* result, DtcParser_t* reference, DtcParser_t* optimized, uint64_t frame_index) {
+    if (result->first_difference_frame != UINT64_MAX) return;
+
+    // Both parsers are only used by this thread, the lists are read without the mutex
+    size_t reference_count = 0;
+    size_t optimized_count = 0;
+    const DTC_Info_t* reference_dtcs = get_reference_to_dtcs(reference, &reference_count);
+    const DTC_Info_t* optimized_dtcs = get_reference_to_dtcs(optimized, &optimized_count);
+    if (reference_count != optimized_count || memcmp(reference_dtcs, optimized_dtcs, reference_count * sizeof(DTC_Info_t)) != 0) {
+        result->first_difference_frame = frame_index;
+    }
+}
+
+// Public functions
+bool replay_logs(const ReplayJob_t* jobs, size_t job_count, size_t thread_count, ReplayEventCallback callback, void* user_data, ReplayJobResult_t* results) {
+    if (job_count == 0) return true;
+
+    size_t worker_count = thread_count ? thread_count : 1;
+    if (worker_count > job_count) worker_count = job_count;
+
+    JobTimeline_t* timelines = calloc(job_count, sizeof(JobTimeline_t));
+    WorkQueue_t* queues = calloc(worker_count, sizeof(WorkQueue_t));
+    size_t* queue_jobs = malloc(job_count * sizeof(size_t));
+    size_t* order = malloc(job_count * sizeof(size_t));
+    uint64_t* sizes = malloc(job_count * sizeof(uint64_t));
+    ReplayWorker_t* workers = calloc(worker_count, sizeof(ReplayWorker_t));
+    bool ok = timelines && queues && queue_jobs && order && sizes && workers;
+
+    if (ok) {
+        // Largest first (insertion sort, the job list is short compared to the replay itself)
+        for (size_t j = 0; j < job_count; j++) {
+            FileMap_t map;
+            sizes[j] = 0;
+            if (file_map_open(&map, jobs[j].file_path)) {
+                sizes[j] = map.size;
+                file_map_close(&map);
+            }
+            size_t k = j;
+            while (k > 0 && sizes[order[k - 1]] < sizes[j]) {
+                order[k] = order[k - 1];
+                k--;
+            }
+            order[k] = j;
+        }
+
+        // Deal the sorted jobs round-robin, each queue is a contiguous slice of 'queue_jobs'
+        size_t offset = 0;
+        for (size_t w = 0; w < worker_count; w++) {
+            pthread_mutex_init(&queues[w].lock, NULL);
+            queues[w].jobs = &queue_jobs[offset];
+            for (size_t i = w; i < job_count; i += worker_count) {
+                queues[w].jobs[queues[w].tail++] = order[i];
+            }
+            offset += queues[w].tail;
+        }
+
+        ReplayContext_t ctx = {
+            .jobs = jobs,
+            .timelines = timelines,
+            .queues = queues,
+            .worker_count = worker_count
+        };
+        if (thread_count == 0) {
+            workers[0].ctx = &ctx;
+            worker_main(&workers[0]);
+        } else {
+            size_t started = 0;
+            for (size_t w = 0; w < worker_count; w++) {
+                workers[w].ctx = &ctx;
+                workers[w].id = w;
+                if (pthread_create(&workers[w].thread, NULL, worker_main, &workers[w]) != 0) break;
+                started++;
+            }
+            if (started == 0) worker_main(&workers[0]); // Queues of the missing workers are stolen by the running ones
+            for (size_t w = 0; w < started; w++) pthread_join(workers[w].thread, NULL);
+        }
+
+        for (size_t w = 0; w < worker_count; w++) pthread_mutex_destroy(&queues[w].lock);
+
+        for (size_t j = 0; j < job_count; j++) {
+            if (!timelines[j].result.opened || timelines[j].out_of_memory) ok = false;
+            if (results) results[j] = timelines[j].result;
+        }
+        if (callback) merge_timelines(jobs, timelines, job_count, callback, user_data);
+    }
+
+    if (timelines) {
+        for (size_t j = 0; j < job_count; j++) {
+            free(timelines[j].events);
+            free(timelines[j].dtcs);
+        }
+    }
+    free(workers);
+    free(sizes);
+    free(order);
+    free(queue_jobs);
+    free(queues);
+    free(timelines);
+    return ok;
+}
+
+bool diff_replay_log(const ReplayJob_t* job, ReplayIngest_t ingest, DiffReplayResult_t* result) {
+    memset((void*)result, 0, sizeof(DiffReplayResult_t));
+    result->first_difference_frame = UINT64_MAX;
+
+    LogSource_t source;
+    if (!source_open(&source, job->file_path, job->index_path)) return false;
+    result->opened = true;
+
+    DtcParser_t* parsers = malloc(2 * sizeof(DtcParser_t)); // Reference, optimized
+    DiffEmission_t* emissions = malloc(2 * sizeof(DiffEmission_t));
+    CanFrame_t* frames = malloc(REPLAY_BATCH_SIZE * sizeof(CanFrame_t));
+    bool ok = parsers && emissions && frames;
+    if (ok) {
+        DtcParser_t* reference = &parsers[0];
+        DtcParser_t* optimized = &parsers[1];
+        for (int k = 0; k < 2; k++) {
+            init_dtc_parser(&parsers[k]);
+            set_dtc_parser_options(&parsers[k], k ? job->options : 0);
+            set_dtc_filtering(&parsers[k], job->config.dtc_active_read_count, job->config.dtc_active_time_window,
+                job->config.debounce_dtc_inactive_time, job->config.timeout_multi_frame);
+            register_dtc_updated_callback(&parsers[k], capture_emission, &emissions[k]);
+        }
+
+        uint32_t last_timestamp = 0;
+        uint64_t frame_index = 0;
+        while (!source_eof(&source) && !result->diverged) {
+            size_t frame_count = source_read_frames(&source, frames, REPLAY_BATCH_SIZE, last_timestamp + 1);
+            if (ingest == REPLAY_INGEST_BATCH) {
+                for (size_t i = 0; i < frame_count; i++) {
+                    process_dtc_frame(reference, frames[i].can_id, frames[i].data, frames[i].timestamp);
+                }
+                process_dtc_frames(optimized, frames, frame_count, NULL);
+                frame_index += frame_count;
+                if (frame_count > 0) note_list_difference(result, reference, optimized, frame_index - 1);
+            } else {
+                for (size_t i = 0; i < frame_count; i++, frame_index++) {
+                    process_dtc_frame(reference, frames[i].can_id, frames[i].data, frames[i].timestamp);
+                    if (ingest == REPLAY_INGEST_RING) {
+                        enqueue_dtc_frame(optimized, frames[i].can_id, frames[i].data, frames[i].timestamp);
+                        if (((frame_index + 1) % REPLAY_RING_DRAIN) != 0) continue; // The optimized parser lags until the drain
+                        drain_dtc_frames(optimized);
+                    } else {
+                        process_dtc_frame(optimized, frames[i].can_id, frames[i].data, frames[i].timestamp);
+                    }
+                    note_list_difference(result, reference, optimized, frame_index);
+                }
+            }
+
+            uint32_t timestamp = source_timestamp(&source);
+            if (timestamp - last_timestamp >= 1) {
+                last_timestamp = timestamp;
+                if (ingest == REPLAY_INGEST_RING) drain_dtc_frames(optimized);
+                emissions[0].emitted = false;
+                emissions[1].emitted = false;
+                check_dtcs(reference, timestamp);
+                check_dtcs(optimized, timestamp);
+                if (!emissions[0].emitted && !emissions[1].emitted) continue;
+
+                result->emission_count++;
+                if (same_emission(&emissions[0], &emissions[1])) {
+                    result->first_difference_frame = UINT64_MAX; // The lists met again
+                    continue;
+                }
+                result->diverged = true;
+                result->divergence_frame = frame_index ? frame_index - 1 : 0;
+                result->divergence_timestamp = timestamp;
+                result->reference_dtc_count = emissions[0].emitted ? emissions[0].dtc_count : 0;
+                result->optimized_dtc_count = emissions[1].emitted ? emissions[1].dtc_count : 0;
+                memcpy(result->reference_dtcs, emissions[0].dtcs, result->reference_dtc_count * sizeof(DTC_Info_t));
+                memcpy(result->optimized_dtcs, emissions[1].dtcs, result->optimized_dtc_count * sizeof(DTC_Info_t));
+            }
+        }
+        result->frame_count = frame_index;
+    }
+
+    free(frames);
+    free(emissions);
+    free(parsers);
+    source_close(&source);
+    return ok && !result->diverged;
+}
@@ -0,0 +1,127 @@
+/**
+ * @file log_replay.h
+ * @brief Header file for the parallel log replay engine
+ *
+ * Replays many CANalyzer logs (.ASC or binary captures, see `can_bin.h`) through the DTC parser on a pool of worker threads. Each job
+ * (a log file with its own debounce configuration) runs on a private `DtcParser_t` context, so
+ * several `set_dtc_filtering` experiments over the same archive can run in one pass. The jobs
+ * are distributed by a work-stealing scheduler, largest files first, and the per-job active DTC
+ * timelines are merged into one output ordered by timestamp.
+ *
+ * A job is the smallest unit of work: the DTC state of a log depends on all its previous frames,
+ * so a single file is always replayed by a single thread.
+ *
+ * `diff_replay_log` replays a log through the reference parser (no engine option) and an optimized
+ * one in lockstep, to check that the optimized engines give the same active DTC timeline.
+ *
+ * @authored by Roger da Silva Moschiel
+ * @date 1 August 2024
+ */
+
+#ifndef LOG_REPLAY_H
+#define LOG_REPLAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "dtc_parser.h"
+
+/**
+ * @brief Struct for a replay job
+ */
+typedef struct {
+    const char* file_path;      // .ASC log or binary capture to be replayed
+    const char* index_path;     // DTC-only index of the log (see `log_index.h`), NULL to read the whole log
+    DtcParseConfig_t config;    // Debounce configuration, zero fields keep the library defaults (see `set_dtc_filtering`)
+    uint32_t options;           // Engine options (see `set_dtc_parser_options`)
+} ReplayJob_t;
+
+/**
+ * @brief Struct for a change of the active DTC list of a job
+ */
+typedef struct {
+    size_t job;                 // Index of the job in the list given to `replay_logs`
+    uint32_t timestamp;         // Timestamp (seconds) of the `check_dtcs` call that reported the change
+    size_t dtc_count;           // Number of active DTCs after the change
+    const DTC_Info_t* dtcs;     // Active DTCs after the change
+} ReplayEvent_t;
+
+/**
+ * @brief Struct for the result of a replay job
+ */
+typedef struct {
+    bool opened;                // False if the log could not be opened
+    uint64_t frame_count;       // Frames read from the log (binary captures: frames of the blocks with DTC frames, indexed logs: indexed frames)
+    size_t event_count;         // Changes of the active DTC list
+} ReplayJobResult_t;
+
+/**
+ * @brief Callback type for the merged timeline
+ */
+typedef void (*ReplayEventCallback)(void* user_data, const ReplayJob_t* job, const ReplayEvent_t* event);
+
+/**
+ * @brief Replays log files in parallel and reports their merged active DTC timeline
+ *
+ * Blocks until every job was replayed. The callback is then called from the calling thread for
+ * every change of the active DTC list of every job, ordered by timestamp (changes with the same
+ * timestamp are ordered by job index, then by occurrence).
+ *
+ * @param jobs Jobs to be replayed
+ * @param job_count Number of jobs
+ * @param thread_count Number of worker threads (0 runs everything on the calling thread)
+ * @param callback Function called for each event of the merged timeline, can be NULL
+ * @param user_data User pointer passed back to the callback, can be NULL
+ * @param results Optional array of `job_count` entries where the result of each job is stored, can be NULL
+ * @return bool True if every log was opened and replayed, false otherwise
+ */
+bool replay_logs(const ReplayJob_t* jobs, size_t job_count, size_t thread_count, ReplayEventCallback callback, void* user_data, ReplayJobResult_t* results);
+
+/**
+ * @brief Ingestion API of the optimized parser of a differential replay
+ */
+typedef enum {
+    REPLAY_INGEST_FRAME = 0,    // 'process_dtc_frame' for each frame
+    REPLAY_INGEST_BATCH,        // 'process_dtc_frames' for each batch read from the log (vectorized pre-filter)
+    REPLAY_INGEST_RING          // 'enqueue_dtc_frame' for each frame, 'drain_dtc_frames' periodically and before 'check_dtcs'
+} ReplayIngest_t;
+
+/**
+ * @brief Struct for the result of a differential replay
+ */
+typedef struct {
+    bool opened;                    // False if the log could not be opened
+    bool diverged;                  // True if an emission of the optimized parser differs from the reference
+    uint64_t frame_count;           // Frames given to both parsers (until the divergence)
+    size_t emission_count;          // Callback emissions compared (including the divergent one)
+    uint64_t divergence_frame;      // Index of the last frame given before the divergent 'check_dtcs'
+    uint32_t divergence_timestamp;  // Timestamp of the divergent 'check_dtcs'
+    uint64_t first_difference_frame;// First frame after the previous emission where the active lists differed, UINT64_MAX if never
+    size_t reference_dtc_count;     // Divergent emission of the reference parser (0 if it did not emit)
+    DTC_Info_t reference_dtcs[MAX_ACTIVE_DTCS];
+    size_t optimized_dtc_count;     // Divergent emission of the optimized parser (0 if it did not emit)
+    DTC_Info_t optimized_dtcs[MAX_ACTIVE_DTCS];
+} DiffReplayResult_t;
+
+/**
+ * @brief Replays a log through the reference parser and an optimized one side by side
+ *
+ * The reference parser runs without any engine option (`set_dtc_parser_options(parser, 0)`) and
+ * takes the frames one by one with `process_dtc_frame`. The optimized parser runs with the options
+ * of the job, through the given ingestion API. Both get the same debounce configuration and the
+ * same `check_dtcs` pacing as `replay_logs`, and every `UpdatedActiveDTCsCallback` emission is
+ * compared (presence, count and content of the list). The replay stops at the first divergence.
+ *
+ * The active lists are also compared after each ingestion step (one frame, or one batch with
+ * `REPLAY_INGEST_BATCH`). The lists may legitimately differ between two emissions (the streaming
+ * DM1 decode updates the DTCs before the end of the session), so this position is only reported
+ * as a hint of where the divergence started.
+ *
+ * @param job Log and configuration, `options` are those of the optimized parser
+ * @param ingest Ingestion API of the optimized parser
+ * @param result Output result
+ * @return bool True if the log was replayed without divergence, false on divergence or if the log could not be opened
+ */
+bool diff_replay_log(const ReplayJob_t* job, ReplayIngest_t ingest, DiffReplayResult_t* result);
+
+#endif // LOG_REPLAY_H
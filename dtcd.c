@@ -0,0 +1,150 @@
+/**
+ * @file dtcd.c
+ * @brief Live DTC monitor of SocketCAN interfaces (Linux)
+ *
+ * Each interface given on the command line is read by its own thread, with its own socket
+ * (`can_socket`, kernel filtered to the DTC frames) and its own parser context. The active DTC
+ * list of a bus is printed every time it changes, until SIGINT or SIGTERM.
+ *
+ * Usage:
+ *   dtcd [-t ticks_per_second] [-w] [-c read_count,time_window,inactive_time,multi_frame_timeout] can0 [can1...]
+ *
+ * `-t` selects the time base of the parsers (1000 for milliseconds, see `set_dtc_time_base`), the
+ * debounce times of `-c` stay in seconds. `-w` uses the hardware timestamps of the CAN controllers.
+ *
+ * @authored by Roger da Silva Moschiel
+ * @date 1 August 2024
+ */
+
+#if !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "dtc_parser/dtc_parser.h"
+#include "dtc_parser/can_socket.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <pthread.h>
+
+#define MAX_BUSES 8
+
+typedef struct {
+    const char* ifname;
+    CanSocket_t sock;
+    DtcParser_t parser;
+    pthread_t thread;
+} Bus_t;
+
+static Bus_t buses[MAX_BUSES];
+static volatile sig_atomic_t running = 1;
+static uint32_t ticks_per_second = 1;
+static bool hw_timestamps = false;
+static DtcParseConfig_t config; // Zero fields keep the library defaults
+
+static void stop(int sig) {
+    (void)sig;
+    running = 0;
+}
+
+static void print_active_dtcs(void* user_data, const DTC_Info_t* active_dtcs, const size_t active_dtc_count) {
+    const Bus_t* bus = (const Bus_t*)user_data;
+    flockfile(stdout); // Lines of the other buses are not interleaved
+    printf("[%u] %s: %u active DTCs\n", can_socket_now(&bus->sock), bus->ifname, (unsigned)active_dtc_count);
+    print_dtcs(active_dtcs, active_dtc_count);
+    fflush(stdout);
+    funlockfile(stdout);
+}
+
+static void* bus_main(void* arg) {
+    Bus_t* bus = (Bus_t*)arg;
+    uint32_t last_check = can_socket_now(&bus->sock);
+
+    while (running) {
+        // Wakes up at least once per period for 'check_dtcs', with a quiet bus too
+        can_socket_process(&bus->sock, &bus->parser, 100);
+        uint32_t now = can_socket_now(&bus->sock);
+        if (now - last_check >= ticks_per_second) {
+            last_check = now;
+            check_dtcs(&bus->parser, now);
+        }
+    }
+    return NULL;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [-t ticks_per_second] [-w] [-c read_count,time_window,inactive_time,multi_frame_timeout] can0 [can1...]\n", name);
+}
+
+int main(int argc, char* argv[]) {
+    int first_bus = argc;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && (i + 1) < argc) {
+            ticks_per_second = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-w") == 0) {
+            hw_timestamps = true;
+        } else if (strcmp(argv[i], "-c") == 0 && (i + 1) < argc) {
+            unsigned read_count, time_window, inactive_time, multi_frame_timeout;
+            if (sscanf(argv[++i], "%u,%u,%u,%u", &read_count, &time_window, &inactive_time, &multi_frame_timeout) != 4) {
+                usage(argv[0]);
+                return 1;
+            }
+            config.dtc_active_read_count = read_count;
+            config.dtc_active_time_window = time_window;
+            config.debounce_dtc_inactive_time = inactive_time;
+            config.timeout_multi_frame = multi_frame_timeout;
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            first_bus = i;
+            break;
+        }
+    }
+    size_t bus_count = (first_bus < argc) ? (size_t)(argc - first_bus) : 0;
+    if (bus_count == 0 || bus_count > MAX_BUSES || ticks_per_second == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (size_t b = 0; b < bus_count; b++) {
+        Bus_t* bus = &buses[b];
+        bus->ifname = argv[first_bus + (int)b];
+        if (!can_socket_open(&bus->sock, bus->ifname, ticks_per_second, hw_timestamps)) {
+            fprintf(stderr, "%s: ", bus->ifname);
+            perror("Failed to open CAN interface");
+            for (size_t j = 0; j < b; j++) can_socket_close(&buses[j].sock);
+            return 1;
+        }
+        init_dtc_parser(&bus->parser);
+        set_dtc_time_base(&bus->parser, ticks_per_second);
+        set_dtc_filtering(&bus->parser, config.dtc_active_read_count, config.dtc_active_time_window,
+            config.debounce_dtc_inactive_time, config.timeout_multi_frame);
+        register_dtc_updated_callback(&bus->parser, print_active_dtcs, bus);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop; // No SA_RESTART: a blocked poll returns at once
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    size_t started = 0;
+    for (; started < bus_count; started++) {
+        if (pthread_create(&buses[started].thread, NULL, bus_main, &buses[started]) != 0) {
+            running = 0;
+            break;
+        }
+    }
+    for (size_t b = 0; b < started; b++) pthread_join(buses[b].thread, NULL);
+
+    for (size_t b = 0; b < bus_count; b++) {
+        fprintf(stderr, "%s: %u frames read, %u dropped by the kernel%s\n", buses[b].ifname, buses[b].sock.frames_read,
+            buses[b].sock.kernel_drops, buses[b].sock.hw_timestamps ? ", hardware timestamps" : "");
+        can_socket_close(&buses[b].sock);
+    }
+    return started == bus_count ? 0 : 1;
+}
@@ -0,0 +1,48 @@
+/**
+ * @file logindex.c
+ * @brief Builds the DTC-only sidecar index of CAN logs
+ *
+ * Writes `<log>.dtcidx` next to every given .ASC log or binary capture, for `replay -x`.
+ *
+ * Usage:
+ * @code
+ * logindex log...
+ * @endcode
+ *
+ * @authored by Roger da Silva Moschiel
+ * @date 1 August 2024
+ */
+
+#include "dtc_parser/log_index.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s log...\n", argv[0]);
+        return 1;
+    }
+
+    bool ok = true;
+    for (int i = 1; i < argc; i++) {
+        char* index_path = malloc(strlen(argv[i]) + sizeof(LOG_INDEX_EXTENSION));
+        if (!index_path) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+        strcpy(index_path, argv[i]);
+        strcat(index_path, LOG_INDEX_EXTENSION);
+
+        LogIndexHeader_t header;
+        if (log_index_build(argv[i], index_path, &header)) {
+            fprintf(stderr, "%s: %llu frames, %llu index entries -> %s\n", argv[i],
+                (unsigned long long)header.frame_count, (unsigned long long)header.entry_count, index_path);
+        } else {
+            fprintf(stderr, "Failed to index %s\n", argv[i]);
+            ok = false;
+        }
+        free(index_path);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,199 @@
+/**
+ * @file notify_check.c
+ * @brief Scripted check of the DTC list notify policy (`set_dtc_notify_policy`)
+ *
+ * Feeds short synthetic DM1 sequences to a parser and compares the updated callbacks made by
+ * `check_dtcs` with the expected ones: every change notified by default, the minimum interval,
+ * the coalescing of a DTC added and removed within the interval, the MIL/RSL bypass, and the
+ * callback running outside the mutex on the published snapshot (delayed while a reader holds
+ * the buffer it would overwrite). Each failed expectation is printed, the exit code is 0 only
+ * when every step matches.
+ *
+ * Usage:
+ * @code
+ * notify_check
+ * @endcode
+ *
+ * @authored by Roger da Silva Moschiel
+ * @date 1 August 2024
+ */
+
+#include "dtc_parser/dtc_parser.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define LAMP_MIL_ON 0x40 // DM1 byte 0: MIL on (bits 7-6 = 01)
+#define LAMP_RSL_ON 0x10 // DM1 byte 0: RSL on (bits 5-4 = 01)
+
+typedef struct {
+    DtcParser_t* parser;
+    int callbacks;              // Callbacks made since the start of the scenario
+    size_t last_count;          // DTC count of the last callback
+    bool outside_lock;          // Every callback could take the mutex
+    bool on_snapshot;           // Every callback was given the published snapshot
+} NotifyLog_t;
+
+static DtcParser_t parser;
+static NotifyLog_t notify_log;
+static int failures = 0;
+
+#define CHECK(scenario, condition) do { \
+    if (!(condition)) { \
+        printf("FAIL %s: %s (line %d)\n", scenario, #condition, __LINE__); \
+        failures++; \
+    } \
+} while (0)
+
+static void on_updated(void* user_data, const DTC_Info_t* active_dtcs, const size_t active_dtc_count) {
+    NotifyLog_t* log = (NotifyLog_t*)user_data;
+    log->callbacks++;
+    log->last_count = active_dtc_count;
+
+    // The mutex is free: frames of an ISR would be processed, and the library can be called
+    if (take_dtc_mutex(log->parser)) {
+        give_dtc_mutex(log->parser);
+    } else {
+        log->outside_lock = false;
+    }
+
+    size_t dtc_count;
+    uint32_t generation;
+    const DTC_Info_t* snapshot = acquire_dtc_snapshot(log->parser, &dtc_count, &generation);
+    if (snapshot != active_dtcs || dtc_count != active_dtc_count) log->on_snapshot = false;
+    release_dtc_snapshot(log->parser, generation);
+}
+
+// Single frame DM1 of source 0x00 with one DTC (FMI 3, OC 1)
+static void send_dm1(uint32_t timestamp, uint8_t lamps, uint32_t spn) {
+    uint8_t data[8] = { lamps, 0xFF, spn & 0xFF, (spn >> 8) & 0xFF, (uint8_t)(((spn >> 11) & 0xE0) | 3), 1, 0xFF, 0xFF };
+    process_dtc_frame(&parser, 0x18FECA00, data, timestamp);
+}
+
+static void start_scenario(uint32_t min_interval, uint32_t flags) {
+    init_dtc_parser(&parser);
+    set_dtc_filtering(&parser, 1, 10, 3, 5); // Active on the first DM1, removed 3 s after the last one
+    set_dtc_notify_policy(&parser, min_interval, flags);
+    memset(&notify_log, 0, sizeof(notify_log));
+    notify_log.parser = &parser;
+    notify_log.outside_lock = true;
+    notify_log.on_snapshot = true;
+    register_dtc_updated_callback(&parser, on_updated, &notify_log);
+}
+
+static void check_every_change(void) {
+    const char* name = "every change";
+    start_scenario(0, 0);
+    send_dm1(1, 0, 100);
+    CHECK(name, check_dtcs(&parser, 1) && notify_log.callbacks == 1 && notify_log.last_count == 1);
+    send_dm1(2, 0, 100);
+    send_dm1(2, 0, 200);
+    CHECK(name, check_dtcs(&parser, 2) && notify_log.callbacks == 2 && notify_log.last_count == 2);
+    for (uint32_t t = 3; t <= 6; t++) {
+        send_dm1(t, 0, 100);
+        check_dtcs(&parser, t);
+    }
+    CHECK(name, notify_log.callbacks == 3 && notify_log.last_count == 1); // SPN 200 removed at t=6
+    CHECK(name, notify_log.outside_lock && notify_log.on_snapshot);
+}
+
+static void check_interval_and_coalescing(void) {
+    const char* name = "interval";
+    DtcParserStats_t stats;
+    start_scenario(10, 0);
+    send_dm1(100, 0, 100);
+    CHECK(name, check_dtcs(&parser, 100) && notify_log.callbacks == 1); // First change is never delayed
+
+    // SPN 200 comes and goes within the interval, the list is back to the one notified
+    send_dm1(101, 0, 100);
+    send_dm1(101, 0, 200);
+    CHECK(name, !check_dtcs(&parser, 101) && notify_log.callbacks == 1);
+    for (uint32_t t = 102; t <= 112; t++) {
+        send_dm1(t, 0, 100);
+        CHECK(name, !check_dtcs(&parser, t));
+    }
+    CHECK(name, notify_log.callbacks == 1);
+    CHECK(name, get_dtc_parser_stats(&parser, &stats) && stats.notifications == 1 && stats.notifications_coalesced == 1);
+
+    // A real change waits for the interval, counted from the last notification (t=100)
+    send_dm1(113, 0, 100);
+    send_dm1(113, 0, 300);
+    CHECK(name, check_dtcs(&parser, 113) && notify_log.callbacks == 2 && notify_log.last_count == 2);
+    send_dm1(114, 0, 100);
+    send_dm1(114, 0, 300);
+    send_dm1(114, 0, 400);
+    for (uint32_t t = 114; t < 123; t++) {
+        send_dm1(t, 0, 100);
+        send_dm1(t, 0, 300);
+        send_dm1(t, 0, 400);
+        CHECK(name, !check_dtcs(&parser, t));
+    }
+    send_dm1(123, 0, 100);
+    CHECK(name, check_dtcs(&parser, 123) && notify_log.callbacks == 3 && notify_log.last_count == 3);
+    CHECK(name, notify_log.outside_lock && notify_log.on_snapshot);
+}
+
+static void check_lamp_bypass(void) {
+    const char* name = "lamp bypass";
+    start_scenario(10, DTC_NOTIFY_LAMP_BYPASS);
+    send_dm1(100, 0, 100);
+    CHECK(name, check_dtcs(&parser, 100) && notify_log.callbacks == 1);
+    send_dm1(101, LAMP_MIL_ON, 100); // MIL of an active DTC turned on
+    CHECK(name, check_dtcs(&parser, 101) && notify_log.callbacks == 2);
+    send_dm1(102, LAMP_MIL_ON, 200); // DTC added with the MIL on
+    CHECK(name, check_dtcs(&parser, 102) && notify_log.callbacks == 3 && notify_log.last_count == 2);
+    send_dm1(103, LAMP_RSL_ON, 100); // MIL off and RSL on
+    CHECK(name, check_dtcs(&parser, 103) && notify_log.callbacks == 4);
+    send_dm1(104, LAMP_RSL_ON, 300); // DTC added with the RSL on
+    CHECK(name, check_dtcs(&parser, 104) && notify_log.callbacks == 5);
+    send_dm1(105, 0x04, 400);        // DTC added with only the AWL on: waits for the interval
+    CHECK(name, !check_dtcs(&parser, 105) && notify_log.callbacks == 5);
+
+    // Without the flag a lamp change is not a list change, and a new DTC waits for the interval
+    start_scenario(10, 0);
+    send_dm1(100, 0, 100);
+    check_dtcs(&parser, 100);
+    send_dm1(101, LAMP_MIL_ON, 100);
+    CHECK(name, !check_dtcs(&parser, 101) && notify_log.callbacks == 1);
+    send_dm1(102, LAMP_MIL_ON, 200);
+    CHECK(name, !check_dtcs(&parser, 102) && notify_log.callbacks == 1);
+    CHECK(name, notify_log.outside_lock && notify_log.on_snapshot);
+}
+
+static void check_snapshot_reader(void) {
+    const char* name = "snapshot reader";
+    size_t dtc_count;
+    uint32_t generation;
+    start_scenario(0, 0);
+    send_dm1(1, 0, 100);
+    check_dtcs(&parser, 1);
+
+    // The buffer held is overwritten by the second publication after it, which waits for the release
+    const DTC_Info_t* held = acquire_dtc_snapshot(&parser, &dtc_count, &generation);
+    send_dm1(2, 0, 100);
+    send_dm1(2, 0, 200);
+    CHECK(name, check_dtcs(&parser, 2) && notify_log.callbacks == 2);
+    send_dm1(3, 0, 100);
+    send_dm1(3, 0, 200);
+    send_dm1(3, 0, 300);
+    CHECK(name, !check_dtcs(&parser, 3) && notify_log.callbacks == 2);
+    CHECK(name, dtc_count == 1 && held[0].dtc.spn == 100);
+    release_dtc_snapshot(&parser, generation);
+    send_dm1(4, 0, 100);
+    CHECK(name, check_dtcs(&parser, 4) && notify_log.callbacks == 3 && notify_log.last_count == 3);
+    CHECK(name, notify_log.outside_lock && notify_log.on_snapshot);
+}
+
+int main(void) {
+    check_every_change();
+    check_interval_and_coalescing();
+    check_lamp_bypass();
+    check_snapshot_reader();
+
+    if (failures > 0) {
+        printf("%d notify policy checks failed\n", failures);
+        return 1;
+    }
+    printf("notify policy checks passed\n");
+    return 0;
+}
@@ -0,0 +1,255 @@
+/**
+ * @file replay.c
+ * @brief Parallel replay tool for CANalyzer logs
+ *
+ * Replays every given .ASC log with every given debounce configuration, one parser context per
+ * (log, configuration) job, on all the cores of the machine, and prints the merged timeline of
+ * active DTC changes ordered by timestamp. With `-x` the logs are read through their DTC-only
+ * index (`<log>.dtcidx`, written by the logindex tool).
+ *
+ * With `-d engine` every job is instead replayed through the reference parser and through the
+ * given engine side by side (`diff_replay_log`), and the first divergence of their active DTC
+ * timelines is reported. The engine is a comma separated list of `default`, `hash`, `swap`, `heap`,
+ * `events`, `stream`, `repeat` (engine options, none selects the reference engine itself) and of one of
+ * `frame`, `batch`, `ring` (ingestion API, `frame` by default), e.g. `-d default,stream,batch`.
+ *
+ * Usage:
+ * @code
+ * replay [-x] [-j threads] [-d engine] [-c read_count,time_window,inactive_time,multi_frame_timeout]... log.asc...
+ * @endcode
+ *
+ * @authored by Roger da Silva Moschiel
+ * @date 1 August 2024
+ */
+
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "dtc_parser/dtc_parser.h"
+#include "dtc_parser/log_replay.h"
+#include "dtc_parser/log_index.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#define MAX_CONFIGS 32
+
+typedef struct {
+    size_t config_count;
+} ReplayOutput_t;
+
+static size_t online_cpus(void) {
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (size_t)info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (size_t)n : 1;
+#endif
+}
+
+static void print_event(void* user_data, const ReplayJob_t* job, const ReplayEvent_t* event) {
+    const ReplayOutput_t* output = (const ReplayOutput_t*)user_data;
+    if (output->config_count > 1) {
+        printf("[%u] %s (config %u): %u active DTCs\n", event->timestamp, job->file_path,
+            (unsigned)(event->job % output->config_count), (unsigned)event->dtc_count);
+    } else {
+        printf("[%u] %s: %u active DTCs\n", event->timestamp, job->file_path, (unsigned)event->dtc_count);
+    }
+    print_dtcs(event->dtcs, event->dtc_count);
+}
+
+static bool parse_engine(const char* spec, uint32_t* options, ReplayIngest_t* ingest) {
+    static const struct {
+        const char* name;
+        uint32_t options;
+    } option_names[] = {
+        { "default", DTC_PARSER_DEFAULT_OPTIONS },
+        { "hash", DTC_OPT_HASH_INDEX },
+        { "swap", DTC_OPT_SWAP_REMOVE },
+        { "heap", DTC_OPT_TIMER_HEAP },
+        { "events", DTC_OPT_EVENT_RING },
+        { "stream", DTC_OPT_STREAM_DM1 },
+        { "repeat", DTC_OPT_DM1_REPEAT_CACHE },
+    };
+    *options = 0;
+    *ingest = REPLAY_INGEST_FRAME;
+
+    while (*spec) {
+        size_t len = strcspn(spec, ",");
+        bool found = false;
+        for (size_t i = 0; i < sizeof(option_names) / sizeof(option_names[0]); i++) {
+            if (strlen(option_names[i].name) == len && strncmp(spec, option_names[i].name, len) == 0) {
+                *options |= option_names[i].options;
+                found = true;
+            }
+        }
+        if (len == 5 && strncmp(spec, "frame", len) == 0) { *ingest = REPLAY_INGEST_FRAME; found = true; }
+        if (len == 5 && strncmp(spec, "batch", len) == 0) { *ingest = REPLAY_INGEST_BATCH; found = true; }
+        if (len == 4 && strncmp(spec, "ring", len) == 0) { *ingest = REPLAY_INGEST_RING; found = true; }
+        if (!found) return false;
+        spec += len;
+        if (*spec == ',') spec++;
+    }
+    return true;
+}
+
+// Differential replay of every job, one after the other, returns the process exit code
+static int diff_jobs(const ReplayJob_t* jobs, size_t job_count, size_t config_count, ReplayIngest_t ingest) {
+    int status = 0;
+    DiffReplayResult_t* result = malloc(sizeof(DiffReplayResult_t));
+    if (!result) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    for (size_t j = 0; j < job_count; j++) {
+        if (diff_replay_log(&jobs[j], ingest, result)) {
+            printf("%s (config %u): identical, %llu frames, %u emissions\n", jobs[j].file_path, (unsigned)(j % config_count),
+                (unsigned long long)result->frame_count, (unsigned)result->emission_count);
+            continue;
+        }
+        status = 1;
+        if (!result->opened) {
+            fprintf(stderr, jobs[j].index_path ? "Failed to open %s or its index\n" : "Failed to open %s\n", jobs[j].file_path);
+            continue;
+        }
+        if (!result->diverged) {
+            fprintf(stderr, "%s (config %u): out of memory\n", jobs[j].file_path, (unsigned)(j % config_count));
+            continue;
+        }
+        printf("%s (config %u): DIVERGED at emission %u, frame %llu, timestamp %u\n", jobs[j].file_path, (unsigned)(j % config_count),
+            (unsigned)result->emission_count, (unsigned long long)result->divergence_frame, result->divergence_timestamp);
+        if (result->first_difference_frame != UINT64_MAX) {
+            printf("    active lists differ since frame %llu\n", (unsigned long long)result->first_difference_frame);
+        }
+        printf("    reference: %u active DTCs\n", (unsigned)result->reference_dtc_count);
+        print_dtcs(result->reference_dtcs, result->reference_dtc_count);
+        printf("    optimized: %u active DTCs\n", (unsigned)result->optimized_dtc_count);
+        print_dtcs(result->optimized_dtcs, result->optimized_dtc_count);
+    }
+
+    free(result);
+    return status;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [-x] [-j threads] [-d engine] [-c read_count,time_window,inactive_time,multi_frame_timeout]... log.asc...\n", name);
+}
+
+int main(int argc, char* argv[]) {
+    DtcParseConfig_t configs[MAX_CONFIGS];
+    size_t config_count = 0;
+    size_t thread_count = online_cpus();
+    bool indexed = false;
+    bool differential = false;
+    uint32_t options = DTC_PARSER_DEFAULT_OPTIONS;
+    ReplayIngest_t ingest = REPLAY_INGEST_FRAME;
+    int first_file = argc;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-x") == 0) {
+            indexed = true;
+        } else if (strcmp(argv[i], "-j") == 0 && (i + 1) < argc) {
+            thread_count = (size_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-d") == 0 && (i + 1) < argc) {
+            if (!parse_engine(argv[++i], &options, &ingest)) {
+                usage(argv[0]);
+                return 1;
+            }
+            differential = true;
+        } else if (strcmp(argv[i], "-c") == 0 && (i + 1) < argc) {
+            unsigned read_count, time_window, inactive_time, multi_frame_timeout;
+            if (config_count == MAX_CONFIGS ||
+                sscanf(argv[++i], "%u,%u,%u,%u", &read_count, &time_window, &inactive_time, &multi_frame_timeout) != 4) {
+                usage(argv[0]);
+                return 1;
+            }
+            configs[config_count].dtc_active_read_count = read_count;
+            configs[config_count].dtc_active_time_window = time_window;
+            configs[config_count].debounce_dtc_inactive_time = inactive_time;
+            configs[config_count].timeout_multi_frame = multi_frame_timeout;
+            config_count++;
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            first_file = i;
+            break;
+        }
+    }
+    if (first_file >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (config_count == 0) {
+        memset(&configs[0], 0, sizeof(DtcParseConfig_t)); // Library defaults
+        config_count = 1;
+    }
+
+    // One job per (log, configuration), the configuration is the fastest changing index
+    size_t file_count = (size_t)(argc - first_file);
+    size_t job_count = file_count * config_count;
+    ReplayJob_t* jobs = calloc(job_count, sizeof(ReplayJob_t));
+    ReplayJobResult_t* results = calloc(job_count, sizeof(ReplayJobResult_t));
+    char** index_paths = calloc(file_count, sizeof(char*));
+    if (!jobs || !results || !index_paths) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (size_t f = 0; f < file_count; f++) {
+        if (indexed) {
+            const char* file_path = argv[first_file + f];
+            index_paths[f] = malloc(strlen(file_path) + sizeof(LOG_INDEX_EXTENSION));
+            if (!index_paths[f]) {
+                fprintf(stderr, "Out of memory\n");
+                return 1;
+            }
+            strcpy(index_paths[f], file_path);
+            strcat(index_paths[f], LOG_INDEX_EXTENSION);
+        }
+        for (size_t c = 0; c < config_count; c++) {
+            ReplayJob_t* job = &jobs[f * config_count + c];
+            job->file_path = argv[first_file + f];
+            job->index_path = index_paths[f];
+            job->config = configs[c];
+            job->options = options;
+        }
+    }
+
+    if (differential) {
+        int status = diff_jobs(jobs, job_count, config_count, ingest);
+        for (size_t f = 0; f < file_count; f++) free(index_paths[f]);
+        free(index_paths);
+        free(results);
+        free(jobs);
+        return status;
+    }
+
+    ReplayOutput_t output = { .config_count = config_count };
+    bool ok = replay_logs(jobs, job_count, thread_count, print_event, &output, results);
+
+    for (size_t j = 0; j < job_count; j++) {
+        if (!results[j].opened) {
+            fprintf(stderr, indexed ? "Failed to open %s or its index\n" : "Failed to open %s\n", jobs[j].file_path);
+        } else {
+            fprintf(stderr, "%s (config %u): %llu frames, %u DTC list changes\n", jobs[j].file_path,
+                (unsigned)(j % config_count), (unsigned long long)results[j].frame_count, (unsigned)results[j].event_count);
+        }
+    }
+
+    for (size_t f = 0; f < file_count; f++) free(index_paths[f]);
+    free(index_paths);
+    free(results);
+    free(jobs);
+    return ok ? 0 : 1;
+}
@@ -9,114 +9,243 @@
  */
 
 #include "dtc_parser/dtc_parser.h"
+#include "dtc_parser/asc_reader.h"
+#include "dtc_parser/dtc_trace.h"
+#include "dtc_parser/dtc_history.h"
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
 
-#define MAX_LINE_LENGTH 256
 //There are 3 different methods for reading the current DTCs list:
 #define TEST_DTCS_CALLBACK 1      // Test DTC callback notification to get the DTCs list whenever it has changed
 #define TEST_DTCS_COPY 1          // Test DTC copy that is triggered when 'check_dtcs' returns 'true'
 #define TEST_DTCS_DYNAMIC_COPY 1  // Test DTC dynamic copy that is triggered when 'check_dtcs' returns 'true'
 #define TEST_DTCS_REFERENCE 1     // Test DTC direct access that is triggered when 'check_dtcs' returns 'true'
+#define TEST_DTCS_SNAPSHOT 0      // Test DTC zero-copy snapshot that is triggered when 'check_dtcs' returns 'true'
+#define TEST_DTCS_SEQLOCK 0       // Test DTC lock-free read (seqlock) that is triggered when 'check_dtcs' returns 'true'
+#define TEST_DTC_EVENTS 0         // Test DTC delta events ('DTC_OPT_EVENT_RING') read after each 'check_dtcs'
+#define TEST_FRAME_RING 0         // Feed frames through 'enqueue_dtc_frame'/'drain_dtc_frames' (ISR style) instead of 'process_dtc_frame'
+#define TEST_FRAME_BATCH 0        // Feed frames in batches through 'process_dtc_frames' instead of 'process_dtc_frame'
+#define TEST_FRAME_BATCH_SIZE 64
+#define TEST_DTC_TRACE 0          // Print the parser binary trace (new/removed DTCs, warnings, TP order errors) before each 'check_dtcs'
+#define TEST_PARSER_STATS 0       // Print the parser counters and cycle histograms ('get_dtc_parser_stats') at the end of the log
+#define TEST_TICKS_PER_SECOND 1   // Time base of the timestamps ('set_dtc_time_base'), e.g. 1000 to run in milliseconds
+#define TEST_CHECK_DTCS_PERIOD TEST_TICKS_PER_SECOND // Ticks between 'check_dtcs' calls, e.g. 100 ms with a millisecond time base
+#define TEST_DTC_SOURCE_QUOTA 0   // Candidate and active DTCs allowed per source address ('set_dtc_source_quota'), 0 for no quota
+#define TEST_NOTIFY_MIN_INTERVAL 0 // Ticks between two DTC list notifications ('set_dtc_notify_policy', MIL/RSL bypass), 0 for every change
+#define TEST_DTC_HISTORY 0        // Record the DTC events in the occurrence history (RAM simulated flash) and query it at the end of the log
+#define TEST_HISTORY_PAGE_SIZE 256
+#define TEST_HISTORY_PAGE_COUNT 4
 
-void active_dtcs_callback(const DTC_Info_t* active_dtcs, const size_t active_dtc_count) {
-    printf("TEST Active DTCs Callback: %i\n", active_dtc_count);
+static DtcParser_t parser;
+
+#if TEST_DTC_HISTORY
+static DtcHistory_t history;
+static DtcHistoryRecord_t history_ring[64];
+static uint8_t history_flash[TEST_HISTORY_PAGE_COUNT * TEST_HISTORY_PAGE_SIZE]; // Simulated NOR flash: erase sets 0xFF, program only clears bits
+
+static bool history_erase_page(void* user_data, size_t page) {
+    (void)user_data;
+    memset(&history_flash[page * TEST_HISTORY_PAGE_SIZE], 0xFF, TEST_HISTORY_PAGE_SIZE);
+    return true;
+}
+
+static bool history_program(void* user_data, size_t offset, const void* data, size_t size) {
+    (void)user_data;
+    for (size_t i = 0; i < size; i++) history_flash[offset + i] &= ((const uint8_t*)data)[i];
+    return true;
+}
+
+static void print_dtc_history(uint32_t key, uint32_t key_mask) {
+    static const char* event_names[] = { "Added", "Removed", "Changed" };
+    DtcHistoryCursor_t cursor = {0};
+    DtcEvent_t events[16];
+    size_t event_count;
+    while ((event_count = dtc_history_query(&history, key, key_mask, &cursor, events, 16)) > 0) {
+        for (size_t i = 0; i < event_count; i++) {
+            const DtcEvent_t* e = &events[i];
+            printf("TEST DTC History [%u] %s -> SRC: 0x%02X (%u), SPN: 0x%X (%u), FMI: %u, OC: %u\n",
+                e->timestamp, event_names[e->type], e->dtc.src, e->dtc.src, e->dtc.spn, e->dtc.spn, e->dtc.fmi, e->dtc.oc);
+        }
+    }
+}
+#endif
+
+void active_dtcs_callback(void* user_data, const DTC_Info_t* active_dtcs, const size_t active_dtc_count) {
+    (void)user_data;
+    printf("TEST Active DTCs Callback: %i\n", (int)active_dtc_count);
     print_dtcs(active_dtcs, active_dtc_count);
 }
 
+static void check_dtcs_and_print(uint32_t timestamp) {
+    // 'check_dtcs' MUST be called at least once per second by the user's application
+    // in order to remove inactive DTCs and verify if DTCs list was changed
+    #if TEST_FRAME_RING
+    drain_dtc_frames(&parser);
+    #endif
+    #if TEST_DTC_TRACE
+    print_dtc_trace(&parser); // Formatted here, outside of the frame processing
+    #endif
+    bool dtcs_changed = check_dtcs(&parser, timestamp);
+
+    #if TEST_DTC_EVENTS
+    // Events are produced also when the list membership does not change (DTC_EVENT_CHANGED)
+    static const char* event_names[] = { "Added", "Removed", "Changed" };
+    DtcEvent_t events[16];
+    size_t event_count;
+    while ((event_count = read_dtc_events(&parser, events, 16)) > 0) {
+        for (size_t i = 0; i < event_count; i++) {
+            const DtcEvent_t* e = &events[i];
+            printf("TEST DTC Event [%u] %s -> SRC: 0x%02X (%u), SPN: 0x%X (%u), FMI: %u, OC: %u, MIL: %u, RSL: %u, AWL: %u, PL: %u\n",
+                e->timestamp, event_names[e->type], e->dtc.src, e->dtc.src, e->dtc.spn, e->dtc.spn, e->dtc.fmi, e->dtc.oc, e->dtc.mil, e->dtc.rsl, e->dtc.awl, e->dtc.pl);
+        }
+        #if TEST_DTC_HISTORY
+        dtc_history_append(&history, events, event_count);
+        #endif
+    }
+    #elif TEST_DTC_HISTORY
+    dtc_history_collect(&history, &parser);
+    #endif
+
+    #if TEST_DTC_HISTORY
+    if (dtc_history_pending(&history) >= 32) dtc_history_flush(&history); // Batched writes to the flash
+    #endif
+
+    if(dtcs_changed) {
+        #if TEST_DTCS_COPY
+        DTC_Info_t dtcs_copy[MAX_ACTIVE_DTCS];
+        size_t dtc_copy_count = 0;
+        if(copy_dtcs(&parser, dtcs_copy, sizeof(dtcs_copy), &dtc_copy_count)) {
+            printf("TEST Active DTCs Copy: %i\n", (int)dtc_copy_count);
+            print_dtcs(dtcs_copy, dtc_copy_count);
+        }
+        #endif
+
+        #if TEST_DTCS_DYNAMIC_COPY
+        DTC_Info_t *dtcs_dynamic = NULL;
+        size_t dtcs_dynamic_count = 0;
+        if(dynamic_copy_dtcs(&parser, &dtcs_dynamic, &dtcs_dynamic_count)) {
+            printf("TEST Active DTCs Dynamic Copy: %i\n", (int)dtcs_dynamic_count);
+            print_dtcs(dtcs_dynamic, dtcs_dynamic_count);
+            free(dtcs_dynamic);
+        }
+        #endif
+
+        #if TEST_DTCS_REFERENCE
+        if (take_dtc_mutex(&parser)) {
+            size_t dtcs_reference_count = 0;
+            const DTC_Info_t* dtcs_reference = get_reference_to_dtcs(&parser, &dtcs_reference_count);
+            printf("TEST Active DTCs Reference: %i\n", (int)dtcs_reference_count);
+            print_dtcs(dtcs_reference, dtcs_reference_count);
+            give_dtc_mutex(&parser);
+        }
+        #endif
+
+        #if TEST_DTCS_SNAPSHOT
+        size_t dtcs_snapshot_count = 0;
+        uint32_t dtcs_snapshot_generation = 0;
+        const DTC_Info_t* dtcs_snapshot = acquire_dtc_snapshot(&parser, &dtcs_snapshot_count, &dtcs_snapshot_generation);
+        printf("TEST Active DTCs Snapshot: %i, Generation: %u\n", (int)dtcs_snapshot_count, dtcs_snapshot_generation);
+        print_dtcs(dtcs_snapshot, dtcs_snapshot_count);
+        release_dtc_snapshot(&parser, dtcs_snapshot_generation);
+        #endif
+
+        #if TEST_DTCS_SEQLOCK
+        DTC_Info_t dtcs_seqlock[MAX_ACTIVE_DTCS];
+        size_t dtcs_seqlock_count = 0;
+        uint32_t seq;
+        do {
+            seq = read_dtcs_begin(&parser);
+            const DTC_Info_t* dtcs_reference = get_reference_to_dtcs(&parser, &dtcs_seqlock_count);
+            memcpy(dtcs_seqlock, dtcs_reference, dtcs_seqlock_count * sizeof(DTC_Info_t));
+        } while (read_dtcs_retry(&parser, seq));
+        printf("TEST Active DTCs Seqlock: %i\n", (int)dtcs_seqlock_count);
+        print_dtcs(dtcs_seqlock, dtcs_seqlock_count);
+        #endif
+    }
+}
+
+static void process_frames(const CanFrame_t* frames, size_t frame_count) {
+    #if TEST_FRAME_RING
+    static uint32_t ring_frames = 0;
+    for (size_t i = 0; i < frame_count; i++) {
+        if (!enqueue_dtc_frame(&parser, frames[i].can_id, frames[i].data, frames[i].timestamp)) {
+            printf("TEST Frame ring full, overflows: %u\n", get_dtc_frame_ring_overflows(&parser));
+        }
+        if ((++ring_frames % 16) == 0) drain_dtc_frames(&parser); // Simulates the parsing task running periodically
+    }
+    #elif TEST_FRAME_BATCH
+    process_dtc_frames(&parser, frames, frame_count, NULL);
+    #else
+    for (size_t i = 0; i < frame_count; i++) {
+        process_dtc_frame(&parser, frames[i].can_id, (uint8_t*)frames[i].data, frames[i].timestamp);
+    }
+    #endif
+}
+
 void process_asc_file(const char* file_path) {
-    FILE* file = fopen(file_path, "r");
-    if (!file) {
+    AscReader_t reader;
+    if (!asc_reader_open(&reader, file_path)) {
         perror("Failed to open file");
         return;
     }
+    asc_reader_set_time_base(&reader, TEST_TICKS_PER_SECOND);
     uint32_t last_timestamp = 0;
+    CanFrame_t frames[TEST_FRAME_BATCH_SIZE];
 
-    char line[MAX_LINE_LENGTH];
-    while (fgets(line, sizeof(line), file)) {
-        if (strstr(line, "Rx") && !strstr(line, "J1939TP")) {
-            uint32_t can_id;
-            double double_timestamp;
-            int timestamp;
-            char direction[3];
-            char can_id_str[10];
-            uint8_t data_bytes[8];
-
-            // Parse the line to extract CAN frame information
-            // Example line format: "   6.474846 1  18FECA03x       Rx   d 8 04 FF 22 EE E3 81 FF FF  Length = 559804 BitCount = 144 ID = 419351043x"
-            if (sscanf(line, "%lf %s %s %*s %*s %*s %x %hhx %hhx %hhx %hhx %hhx %hhx %hhx %hhx",
-                    &double_timestamp, direction, can_id_str,
-                    &data_bytes[0], &data_bytes[1], &data_bytes[2], &data_bytes[3],
-                    &data_bytes[4], &data_bytes[5], &data_bytes[6], &data_bytes[7]) == 11) {
-                // timestamp = (int)(float_timestamp * 1000); // Convert to milliseconds
-                timestamp = (unsigned int)double_timestamp;
-
-                can_id = strtoul(can_id_str, NULL, 16);
-
-                // Process the CAN frame
-                process_dtc_frame(can_id, data_bytes, timestamp);
-            }
-            else if(sscanf(line, "%lf ", &double_timestamp) == 1) {
-                timestamp = (unsigned int)double_timestamp;
-            }
+    while (!asc_reader_eof(&reader)) {
+        // Stops at the first line of the next period, so 'check_dtcs' runs at the same point of the log
+        size_t frame_count = asc_reader_read_frames(&reader, frames, TEST_FRAME_BATCH_SIZE, last_timestamp + TEST_CHECK_DTCS_PERIOD);
+        process_frames(frames, frame_count);
 
-            //Check if it has passed 1 second
-            if(timestamp - last_timestamp >= 1) {
-                last_timestamp = timestamp;
-                
-                // 'check_dtcs' MUST be called once per second by the user's application 
-                // in order to remove inactive DTCs and verify if DTCs list was changed
-                bool dtcs_changed = check_dtcs(timestamp); 
-                
-                if(dtcs_changed) {
-                    #if TEST_DTCS_COPY
-                    DTC_Info_t dtcs_copy[MAX_ACTIVE_DTCS];
-                    uint8_t dtc_copy_count = 0;
-                    if(copy_dtcs(dtcs_copy, sizeof(dtcs_copy), &dtc_copy_count)) {
-                        printf("TEST Active DTCs Copy: %i\n", dtc_copy_count);
-                        print_dtcs(dtcs_copy, dtc_copy_count);
-                    }
-                    #endif
-
-                    #if TEST_DTCS_DYNAMIC_COPY
-                    DTC_Info_t *dtcs_dynamic = NULL;
-                    uint8_t dtcs_dynamic_count = 0;
-                    if(dynamic_copy_dtcs(&dtcs_dynamic, &dtcs_dynamic_count)) {
-                        printf("TEST Active DTCs Dynamic Copy: %i\n", dtcs_dynamic_count);
-                        print_dtcs(dtcs_dynamic, dtcs_dynamic_count);
-                        free(dtcs_dynamic);
-                    }
-                    #endif
-
-                    #if TEST_DTCS_REFERENCE
-                    if (take_dtc_mutex()) {
-                        uint8_t dtcs_reference_count = 0;
-                        const DTC_Info_t* dtcs_reference = get_reference_to_dtcs(&dtcs_reference_count);
-                        printf("TEST Active DTCs Reference: %i\n", dtcs_reference_count);
-                        print_dtcs(dtcs_reference, dtcs_reference_count);
-                        give_dtc_mutex();
-                    } 
-                    #endif
-                }
-                
-            }
+        //Check if it has passed 1 period
+        uint32_t timestamp = asc_reader_timestamp(&reader);
+        if(timestamp - last_timestamp >= TEST_CHECK_DTCS_PERIOD) {
+            last_timestamp = timestamp;
+            check_dtcs_and_print(timestamp);
         }
     }
 
-    fclose(file);
+    asc_reader_close(&reader);
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+    init_dtc_parser(&parser);
+    set_dtc_time_base(&parser, TEST_TICKS_PER_SECOND);
+
+    #if TEST_DTC_TRACE
+    set_dtc_trace_mask(&parser, DTC_TRACE_NEW_AND_REMOVED_DTC | DTC_TRACE_WARNINGS | DTC_TRACE_TP_DT_INCORRECT_ORDER);
+    #endif
+
+    #if TEST_DTC_EVENTS || TEST_DTC_HISTORY
+    set_dtc_parser_options(&parser, DTC_PARSER_DEFAULT_OPTIONS | DTC_OPT_EVENT_RING);
+    #endif
+
+    #if TEST_DTC_HISTORY
+    const DtcHistoryStore_t history_store = {
+        history_flash, TEST_HISTORY_PAGE_SIZE, TEST_HISTORY_PAGE_COUNT, history_erase_page, history_program, NULL
+    };
+    memset(history_flash, 0xFF, sizeof(history_flash));
+    dtc_history_init(&history, &history_store, history_ring, 64);
+    #endif
+
     #if TEST_DTCS_CALLBACK
     // Register callback
-    register_dtc_updated_callback(active_dtcs_callback);
+    register_dtc_updated_callback(&parser, active_dtcs_callback, NULL);
+    #endif
+
+    #if TEST_NOTIFY_MIN_INTERVAL
+    set_dtc_notify_policy(&parser, TEST_NOTIFY_MIN_INTERVAL, DTC_NOTIFY_LAMP_BYPASS);
+    #endif
+
+    #if TEST_DTC_SOURCE_QUOTA
+    set_dtc_source_quota(&parser, TEST_DTC_SOURCE_QUOTA, TEST_DTC_SOURCE_QUOTA);
     #endif
 
     // Set debounce times
-    set_dtc_filtering(10, 10, 10, 5);
+    set_dtc_filtering(&parser, 10, 10, 10, 5);
 
     // Process the .asc file
     // const char* file_path = "canalyzer_logs/test.asc";
@@ -128,8 +257,37 @@ int main() {
     // const char* file_path = "canalyzer_logs/Daf_BoaViagem_BDE8B87.asc";
     // const char* file_path = "canalyzer_logs/DAF_E6.asc";
     // const char* file_path = "canalyzer_logs/DAFBoa viagem.asc";
+    if (argc > 1) file_path = argv[1];
     
     process_asc_file(file_path);
 
+    #if TEST_DTC_HISTORY
+    dtc_history_flush(&history);
+    printf("TEST DTC History, dropped: %u\n", history.dropped);
+    print_dtc_history(0, 0);
+    printf("TEST DTC History of SRC 0x00:\n");
+    print_dtc_history(DTC_HISTORY_KEY(0x00, 0, 0), DTC_HISTORY_MASK_SRC);
+    #endif
+
+    #if TEST_PARSER_STATS
+    DtcParserStats_t stats;
+    if (get_dtc_parser_stats(&parser, &stats)) {
+        printf("TEST Stats -> Frames: %u, Dropped (locked): %u, Dropped (ring): %u, DM1: %u (repeats %u), TP.CM: %u, TP.DT: %u (unmatched %u)\n",
+            stats.frames_seen, stats.frames_dropped_locked, stats.frames_dropped_ring, stats.frames_dm1, stats.dm1_repeats, stats.frames_tp_cm, stats.frames_tp_dt, stats.frames_tp_dt_unmatched);
+        printf("TEST Stats -> Sessions: %u started, %u completed, %u out of order, %u timed out, %u aborted\n",
+            stats.tp_sessions_started, stats.tp_sessions_completed, stats.tp_sessions_aborted_order, stats.tp_sessions_aborted_timeout, stats.tp_sessions_aborted_remote);
+        printf("TEST Stats -> Notifications: %u, coalesced %u\n", stats.notifications, stats.notifications_coalesced);
+        printf("TEST Stats -> Overflows: %u candidate, %u active, %u candidate quota, %u active quota, %u multi-frame slot, %u multi-frame size, %u multi-frame pool\n",
+            stats.candidate_overflows, stats.active_overflows, stats.candidate_quota_overflows, stats.active_quota_overflows,
+            stats.multi_frame_slot_overflows, stats.multi_frame_size_overflows, stats.multi_frame_pool_overflows);
+        printf("TEST Stats -> Cycles (log2 bins), process_dtc_frame max: %u, check_dtcs max: %u\n", stats.process_frame_max_cycles, stats.check_dtcs_max_cycles);
+        for (int i = 0; i < DTC_STATS_HISTOGRAM_BINS; i++) {
+            if (stats.process_frame_cycles[i] || stats.check_dtcs_cycles[i]) {
+                printf("    >= %7lu: %8u %8u\n", 1ul << i, stats.process_frame_cycles[i], stats.check_dtcs_cycles[i]);
+            }
+        }
+    }
+    #endif
+
     return 0;
 }